@@ -0,0 +1,240 @@
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include "EpochDomain.h"
+#include "EventCount.h"
+#include "Noncopyable.h"
+#include "RecycleQueueMPMC.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace sunflower
+{
+    enum class ChangeType : uint8_t
+    {
+        INSERT = 0,
+        UPDATE,
+        ERASE
+    };
+
+    template <class Key, class Value>
+    struct ChangeEvent
+    {
+        uint64_t seq = 0;
+        ChangeType type = ChangeType::INSERT;
+        Key key = Key();
+        // new value, the erased one for ERASE
+        Value value = Value();
+    };
+
+    /**
+     * Change feed of a HashMapSafe (set_change_feed), every insert, update
+     * and erase is published with a sequence number into one
+     * RecycleQueueMPMC ring per subscriber.
+     * Publishing takes no lock: the sequence number is a fetch_add, the
+     * subscriber list is read under an epoch guard and each push is a CAS
+     * on the ring plus a notify that costs a load while nobody polls, so
+     * writers of different stripes never serialize on the feed.
+     * The map publishes under the bucket's stripe lock, so sequence order is
+     * map order for every key and a ring holds the events of one key in
+     * that order; events of different keys may reach a ring out of sequence
+     * order.
+     * A full ring never blocks the writer, the subscriber is flagged
+     * overflowed and misses events until resync().
+     * Replica: subscribe(), copy the map with for_each(), then apply events
+     * in ring order. Events carry whole values, replaying one the copy
+     * already holds is harmless. On overflow resync() and copy again.
+     */
+    template <class Key, class Value>
+    class ChangeFeed : public Noncopyable
+    {
+    public:
+        using Event = ChangeEvent<Key, Value>;
+
+        class Subscriber : public Noncopyable
+        {
+        public:
+            explicit Subscriber(uint32_t power) : _ring(power) {}
+
+            bool try_pop(Event &event) { return _ring.tryPop(event); }
+            // Waits up to timeout for an event, then moves up to max of them
+            // into events
+            size_t poll(std::vector<Event> &events, size_t max, std::chrono::milliseconds timeout);
+
+            bool overflowed() const { return _overflowed.load(std::memory_order_acquire); }
+            // events lost to overflows so far
+            uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+            size_t size() const { return _ring.size(); }
+
+        private:
+            friend class ChangeFeed;
+
+            void push(const Event &event);
+            void reset();
+
+        private:
+            RecycleQueueMPMC<Event> _ring;
+            EventCount _ready;
+            std::atomic<bool> _overflowed{false};
+            std::atomic<uint64_t> _dropped{0};
+        };
+
+        ChangeFeed() {}
+        ~ChangeFeed() { delete _subscribers.load(std::memory_order_relaxed); }
+
+        // ring of 2^power events
+        std::shared_ptr<Subscriber> subscribe(uint32_t power = 16);
+        void unsubscribe(const std::shared_ptr<Subscriber> &subscriber);
+        // Empties the ring and clears the overflow flag, the subscriber then
+        // copies the map again
+        void resync(Subscriber &subscriber);
+
+        // Called by the map, a no-op without subscribers
+        void publish(ChangeType type, const Key &key, const Value &value);
+
+        // last sequence number handed out
+        uint64_t seq() const { return _seq.load(std::memory_order_relaxed); }
+        size_t subscriber_count() const { return _numSubscribers.load(std::memory_order_relaxed); }
+
+    private:
+        using List = std::vector<std::shared_ptr<Subscriber>>;
+
+        // copy on write under _mutex, the old list retired to _domain
+        void replace(List *next);
+
+    private:
+        EpochDomain _domain;
+        // serializes subscribe / unsubscribe only
+        std::mutex _mutex;
+        std::atomic<List *> _subscribers{nullptr};
+        std::atomic<size_t> _numSubscribers{0};
+        alignas(64) std::atomic<uint64_t> _seq{0};
+    };
+
+    template <class Key, class Value>
+    size_t ChangeFeed<Key, Value>::Subscriber::poll(std::vector<Event> &events, size_t max, std::chrono::milliseconds timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (_ring.empty())
+        {
+            EventCount::Key key = _ready.PrepareWait();
+            if (not _ring.empty())
+            {
+                _ready.CancelWait();
+                break;
+            }
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero())
+            {
+                _ready.CancelWait();
+                return 0;
+            }
+            _ready.WaitFor(key, left);
+        }
+        size_t n = 0;
+        Event event;
+        for (; n < max && _ring.tryPop(event); n++)
+        {
+            events.push_back(std::move(event));
+        }
+        return n;
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::Subscriber::push(const Event &event)
+    {
+        if (_overflowed.load(std::memory_order_relaxed) || !_ring.tryPush(event))
+        {
+            _overflowed.store(true, std::memory_order_release);
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        _ready.NotifyOne();
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::Subscriber::reset()
+    {
+        // an event pushed before the flag clears is older than the copy
+        // the subscriber makes next, one pushed after lands in the ring
+        _ring.clear();
+        _overflowed.store(false, std::memory_order_release);
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::replace(List *next)
+    {
+        List *prev = _subscribers.exchange(next, std::memory_order_acq_rel);
+        _numSubscribers.store(next->size(), std::memory_order_relaxed);
+        if (prev)
+        {
+            _domain.RetireShared(prev, [](void *p)
+                                 { delete static_cast<List *>(p); });
+        }
+        _domain.Collect();
+    }
+
+    template <class Key, class Value>
+    std::shared_ptr<typename ChangeFeed<Key, Value>::Subscriber> ChangeFeed<Key, Value>::subscribe(uint32_t power)
+    {
+        auto subscriber = std::make_shared<Subscriber>(power);
+        std::lock_guard<std::mutex> lck(_mutex);
+        List *prev = _subscribers.load(std::memory_order_relaxed);
+        List *next = prev ? new List(*prev) : new List;
+        next->push_back(subscriber);
+        replace(next);
+        return subscriber;
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::unsubscribe(const std::shared_ptr<Subscriber> &subscriber)
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        List *prev = _subscribers.load(std::memory_order_relaxed);
+        if (prev == nullptr)
+        {
+            return;
+        }
+        List *next = new List(*prev);
+        next->erase(std::remove(next->begin(), next->end(), subscriber), next->end());
+        replace(next);
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::resync(Subscriber &subscriber)
+    {
+        subscriber.reset();
+    }
+
+    template <class Key, class Value>
+    void ChangeFeed<Key, Value>::publish(ChangeType type, const Key &key, const Value &value)
+    {
+        // a subscriber joining now copies the map after this stripe unlocks
+        if (_numSubscribers.load(std::memory_order_relaxed) == 0)
+        {
+            return;
+        }
+
+        EpochDomain::Guard guard(_domain);
+        const List *subscribers = _subscribers.load(std::memory_order_acquire);
+        if (subscribers == nullptr || subscribers->empty())
+        {
+            return;
+        }
+        Event event;
+        event.seq = _seq.fetch_add(1, std::memory_order_relaxed) + 1;
+        event.type = type;
+        event.key = key;
+        event.value = value;
+        for (auto &subscriber : *subscribers)
+        {
+            subscriber->push(event);
+        }
+    }
+} // namespace sunflower
+#endif // CHANGEFEED_H
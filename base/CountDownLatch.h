@@ -0,0 +1,45 @@
+#ifndef COUNTDOWNLATCH_H
+#define COUNTDOWNLATCH_H
+
+#include "Noncopyable.h"
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+
+namespace sunflower
+{
+    class CountDownLatch : public Noncopyable
+    {
+    public:
+        explicit CountDownLatch(uint32_t count) : _count(count) {}
+
+        void CountDown()
+        {
+            std::lock_guard<std::mutex> lck(_mutex);
+            if (_count > 0 && --_count == 0)
+            {
+                _condition.notify_all();
+            }
+        }
+
+        void Wait()
+        {
+            std::unique_lock<std::mutex> lck(_mutex);
+            _condition.wait(lck, [this]
+                            { return _count == 0; });
+        }
+
+        uint32_t GetCount()
+        {
+            std::lock_guard<std::mutex> lck(_mutex);
+            return _count;
+        }
+
+    private:
+        uint32_t _count = 0;
+        std::mutex _mutex = {};
+        std::condition_variable _condition = {};
+    };
+} // namespace sunflower
+
+#endif // COUNTDOWNLATCH_H
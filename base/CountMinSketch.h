@@ -0,0 +1,113 @@
+#ifndef COUNTMINSKETCH_H
+#define COUNTMINSKETCH_H
+
+#include "Hash.h"
+#include "Noncopyable.h"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Count-min sketch with relaxed atomic counters, add() from any thread.
+     * estimate() never under-counts, it over-counts by at most
+     * e * total / width with probability 1 - e^-depth.
+     * Key is hashed once with Hash, rows derive their index by Mix64 with a row seed.
+     */
+    template <class Key, class Hash = std::hash<Key>>
+    class CountMinSketch : public Noncopyable
+    {
+    public:
+        // 2^widthPower counters per row
+        explicit CountMinSketch(size_t widthPower = 12, size_t depth = 4);
+        ~CountMinSketch() {}
+
+        void add(const Key &key, uint32_t n = 1) { add_hash(_hash(key), n); }
+        void add_hash(size_t hash, uint32_t n = 1);
+        uint64_t estimate(const Key &key) const { return estimate_hash(_hash(key)); }
+        uint64_t estimate_hash(size_t hash) const;
+
+        // Halve every counter so old traffic fades out
+        void decay();
+        void clear();
+
+        size_t width() const { return _width; }
+        size_t depth() const { return _depth; }
+        uint64_t total() const { return _total.load(std::memory_order_relaxed); }
+        size_t hash(const Key &key) const { return _hash(key); }
+
+    private:
+        size_t index(size_t row, size_t hash) const { return row * _width + (Mix64(hash ^ _seeds[row]) & _mask); }
+
+    private:
+        size_t _width = 0;
+        size_t _mask = 0;
+        size_t _depth = 0;
+        std::vector<uint64_t> _seeds;
+        std::unique_ptr<std::atomic<uint32_t>[]> _counters;
+        std::atomic<uint64_t> _total{0};
+        Hash _hash;
+    };
+
+    template <class Key, class Hash>
+    CountMinSketch<Key, Hash>::CountMinSketch(size_t widthPower, size_t depth)
+    {
+        _width = pow(2, widthPower);
+        _mask = _width - 1;
+        _depth = std::max(depth, (size_t)1);
+        ReseedHash(_hash);
+        for (size_t row = 0; row < _depth; row++)
+        {
+            _seeds.push_back(RandomSeed());
+        }
+        _counters.reset(new std::atomic<uint32_t>[_width * _depth]);
+        clear();
+    }
+
+    template <class Key, class Hash>
+    void CountMinSketch<Key, Hash>::add_hash(size_t hash, uint32_t n)
+    {
+        for (size_t row = 0; row < _depth; row++)
+        {
+            _counters[index(row, hash)].fetch_add(n, std::memory_order_relaxed);
+        }
+        _total.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    template <class Key, class Hash>
+    uint64_t CountMinSketch<Key, Hash>::estimate_hash(size_t hash) const
+    {
+        uint64_t least = UINT64_MAX;
+        for (size_t row = 0; row < _depth; row++)
+        {
+            least = std::min<uint64_t>(least, _counters[index(row, hash)].load(std::memory_order_relaxed));
+        }
+        return least;
+    }
+
+    template <class Key, class Hash>
+    void CountMinSketch<Key, Hash>::decay()
+    {
+        // concurrent adds may be lost for a counter being halved, fine for an estimate
+        for (size_t i = 0; i < _width * _depth; i++)
+        {
+            _counters[i].store(_counters[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+        }
+        _total.store(_total.load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+
+    template <class Key, class Hash>
+    void CountMinSketch<Key, Hash>::clear()
+    {
+        for (size_t i = 0; i < _width * _depth; i++)
+        {
+            _counters[i].store(0, std::memory_order_relaxed);
+        }
+        _total.store(0, std::memory_order_relaxed);
+    }
+} // namespace sunflower
+#endif // COUNTMINSKETCH_H
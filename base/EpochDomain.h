@@ -0,0 +1,327 @@
+#ifndef EPOCHDOMAIN_H
+#define EPOCHDOMAIN_H
+
+#include "Noncopyable.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Epoch based reclamation for lock-free readers.
+     * Readers wrap every access in a Guard, writers unlink an object and
+     * hand it to Retire(), it is deleted once every Guard that might still
+     * see it has been left. A Guard costs a store and a fence, no lock.
+     * Keep guards short, a parked reader holds back every retired object.
+     * The domain must outlive its users, destroying it frees all pending objects.
+     */
+    class EpochDomain : public Noncopyable
+    {
+    public:
+        class Guard : public Noncopyable
+        {
+        public:
+            explicit Guard(EpochDomain &domain) : _domain(domain) { _domain.Enter(); }
+            ~Guard() { _domain.Leave(); }
+
+        private:
+            EpochDomain &_domain;
+        };
+
+        EpochDomain() : _state(std::make_shared<State>()), _id(s_nextId++) {}
+        ~EpochDomain() { _state->FreeAll(); }
+
+        // Process wide domain for callers without one of their own
+        static EpochDomain &Default()
+        {
+            static EpochDomain domain;
+            return domain;
+        }
+
+        // Nestable, only the outermost pair publishes the epoch
+        void Enter()
+        {
+            Slot *slot = GetSlot();
+            if (slot->nesting++ == 0)
+            {
+                slot->epoch.store(_state->epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                // the epoch must be visible before any shared pointer is read
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        void Leave()
+        {
+            Slot *slot = GetSlot();
+            if (--slot->nesting == 0)
+            {
+                slot->epoch.store(0, std::memory_order_release);
+            }
+        }
+
+        // ptr is already unreachable for new readers
+        void Retire(void *ptr, void (*deleter)(void *))
+        {
+            Slot *slot = GetSlot();
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            slot->retired.push_back(Retired{_state->epoch.load(std::memory_order_relaxed), ptr, deleter});
+            if (slot->retired.size() >= kCollectBatch)
+            {
+                Collect();
+            }
+        }
+
+        // Like Retire(), but the object goes to the shared list so the
+        // Collect() of any thread may free it, for objects whose last reader
+        // rather than their writer should trigger the reclamation
+        void RetireShared(void *ptr, void (*deleter)(void *))
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::lock_guard<std::mutex> lck(_state->mutex);
+            _state->orphans.push_back(Retired{_state->epoch.load(std::memory_order_relaxed), ptr, deleter});
+        }
+
+        template <class T>
+        void Retire(T *ptr)
+        {
+            Retire(ptr, [](void *p)
+                   { delete static_cast<T *>(p); });
+        }
+
+        // Try to advance the epoch and free what the calling thread retired
+        // before it, returns the number of objects freed
+        size_t Collect()
+        {
+            Slot *slot = GetSlot();
+            _state->TryAdvance();
+            size_t freed = _state->FreeSafe(slot->retired);
+
+            std::unique_lock<std::mutex> lck(_state->mutex, std::try_to_lock);
+            if (lck.owns_lock())
+            {
+                freed += _state->FreeSafe(_state->orphans);
+            }
+            return freed;
+        }
+
+        // Wait until everything the caller retired so far is freed, must not
+        // be called inside a Guard
+        void Synchronize()
+        {
+            Slot *slot = GetSlot();
+            while (not slot->retired.empty())
+            {
+                if (Collect() == 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        uint64_t Epoch() const { return _state->epoch.load(std::memory_order_relaxed); }
+        size_t Pending() { return GetSlot()->retired.size(); }
+
+    private:
+        static const size_t kCollectBatch = 64;
+
+        struct Retired
+        {
+            uint64_t epoch;
+            void *ptr;
+            void (*deleter)(void *);
+        };
+
+        // one per thread, 0 = outside any guard
+        struct alignas(64) Slot
+        {
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool> used{false};
+            uint32_t nesting = 0;
+            std::vector<Retired> retired;
+            Slot *next = nullptr;
+        };
+
+        // outlives the domain while threads still cache one of its slots
+        struct State
+        {
+            std::atomic<uint64_t> epoch{1};
+            std::atomic<Slot *> slots{nullptr};
+            std::mutex mutex = {};
+            std::vector<Retired> orphans;
+
+            ~State()
+            {
+                FreeAll();
+                Slot *slot = slots.load();
+                while (slot)
+                {
+                    Slot *next = slot->next;
+                    delete slot;
+                    slot = next;
+                }
+            }
+
+            Slot *Acquire()
+            {
+                for (Slot *slot = slots.load(std::memory_order_acquire); slot; slot = slot->next)
+                {
+                    bool expected = false;
+                    if (not slot->used.load(std::memory_order_relaxed) && slot->used.compare_exchange_strong(expected, true))
+                    {
+                        return slot;
+                    }
+                }
+                Slot *slot = new Slot;
+                slot->used.store(true, std::memory_order_relaxed);
+                Slot *head = slots.load(std::memory_order_relaxed);
+                do
+                {
+                    slot->next = head;
+                } while (not slots.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+                return slot;
+            }
+
+            void Release(Slot *slot)
+            {
+                {
+                    std::lock_guard<std::mutex> lck(mutex);
+                    orphans.insert(orphans.end(), slot->retired.begin(), slot->retired.end());
+                }
+                slot->retired.clear();
+                slot->nesting = 0;
+                slot->epoch.store(0, std::memory_order_relaxed);
+                slot->used.store(false, std::memory_order_release);
+            }
+
+            // epoch e -> e+1 once every thread inside a guard has seen e
+            bool TryAdvance()
+            {
+                uint64_t current = epoch.load(std::memory_order_seq_cst);
+                for (Slot *slot = slots.load(std::memory_order_acquire); slot; slot = slot->next)
+                {
+                    uint64_t local = slot->epoch.load(std::memory_order_seq_cst);
+                    if (local != 0 && local != current)
+                    {
+                        return false;
+                    }
+                }
+                return epoch.compare_exchange_strong(current, current + 1);
+            }
+
+            // retired at e is unreachable once the epoch reached e+2
+            size_t FreeSafe(std::vector<Retired> &list)
+            {
+                uint64_t current = epoch.load(std::memory_order_acquire);
+                size_t kept = 0;
+                size_t freed = 0;
+                for (size_t i = 0; i < list.size(); i++)
+                {
+                    if (list[i].epoch + 2 <= current)
+                    {
+                        list[i].deleter(list[i].ptr);
+                        freed++;
+                    }
+                    else
+                    {
+                        list[kept++] = list[i];
+                    }
+                }
+                list.resize(kept);
+                return freed;
+            }
+
+            void FreeAll()
+            {
+                std::lock_guard<std::mutex> lck(mutex);
+                for (Slot *slot = slots.load(); slot; slot = slot->next)
+                {
+                    for (auto &r : slot->retired)
+                        r.deleter(r.ptr);
+                    slot->retired.clear();
+                }
+                for (auto &r : orphans)
+                    r.deleter(r.ptr);
+                orphans.clear();
+            }
+        };
+
+        // slots of this thread, handed back on thread exit
+        struct LocalSlots
+        {
+            struct Entry
+            {
+                uint64_t id;
+                std::shared_ptr<State> state;
+                Slot *slot;
+            };
+            std::vector<Entry> entries;
+
+            ~LocalSlots()
+            {
+                for (auto &e : entries)
+                    e.state->Release(e.slot);
+            }
+        };
+
+        struct Cache
+        {
+            uint64_t owner = 0;
+            Slot *slot = nullptr;
+        };
+
+        Slot *GetSlot()
+        {
+            static thread_local Cache cache;
+            if (cache.owner == _id)
+            {
+                return cache.slot;
+            }
+            return GetSlotSlow(cache);
+        }
+
+        Slot *GetSlotSlow(Cache &cache)
+        {
+            static thread_local LocalSlots local;
+            Slot *slot = nullptr;
+            size_t kept = 0;
+            for (size_t i = 0; i < local.entries.size(); i++)
+            {
+                auto &e = local.entries[i];
+                if (e.id == _id)
+                {
+                    slot = e.slot;
+                }
+                else if (e.state.use_count() == 1)
+                {
+                    // domain destroyed, this thread holds the last reference
+                    e.state->Release(e.slot);
+                    continue;
+                }
+                if (kept != i)
+                {
+                    local.entries[kept] = std::move(e);
+                }
+                kept++;
+            }
+            local.entries.resize(kept);
+            if (slot == nullptr)
+            {
+                slot = _state->Acquire();
+                local.entries.push_back(LocalSlots::Entry{_id, _state, slot});
+            }
+            cache.owner = _id;
+            cache.slot = slot;
+            return slot;
+        }
+
+    private:
+        static inline std::atomic<uint64_t> s_nextId{1};
+        std::shared_ptr<State> _state;
+        uint64_t _id = 0;
+    };
+} // namespace sunflower
+#endif // EPOCHDOMAIN_H
@@ -0,0 +1,191 @@
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+
+#include "Noncopyable.h"
+#include <atomic>
+#include <chrono>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace sunflower
+{
+    // How a waiter waits for its condition
+    enum class WaitPolicy
+    {
+        BUSY_POLL,      // spin until true, never sleeps, burns the core
+        SPIN_THEN_PARK, // spin a bounded number of checks, then sleep on the futex
+        PARK            // sleep right away
+    };
+
+    /**
+     * Futex based event count: sleep until a condition kept elsewhere (a
+     * queue position, a flag) turns true, with no mutex around it.
+     * A waiter registers before its last check of the condition, a notifier
+     * publishes the condition first and skips the syscall while nobody is
+     * registered, so notifying costs a fence and a load when nobody sleeps,
+     * and while every waiter already has a wake on its way.
+     *
+     *     EventCount::Key key = ec.PrepareWait();
+     *     if (condition()) ec.CancelWait(); else ec.Wait(key);
+     *
+     * Await() runs that loop behind the spin phase of a WaitPolicy.
+     * A processShared event count may live in shared memory and wakes
+     * waiters of every process mapping it.
+     */
+    class EventCount : public Noncopyable
+    {
+    public:
+        using Key = uint32_t;
+
+        static const uint32_t kDefaultSpins = 128;
+
+        explicit EventCount(bool processShared = false) : _shared(processShared) {}
+
+        Key PrepareWait()
+        {
+            uint64_t state = _state.fetch_add(kWaiter, std::memory_order_relaxed);
+            // pairs with the fence in Notify: it sees the waiter or the waiter sees the condition
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return state >> kEpochShift;
+        }
+
+        void CancelWait() { Leave(); }
+
+        // Sleeps until a notify after PrepareWait, may return spuriously
+        void Wait(Key key)
+        {
+            while ((_state.load(std::memory_order_acquire) >> kEpochShift) == key)
+            {
+                syscall(SYS_futex, EpochWord(), _shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+            }
+            Leave();
+        }
+
+        // Wait() for at most timeout, false if it ran out before a notify
+        bool WaitFor(Key key, std::chrono::nanoseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            bool notified = true;
+            while ((_state.load(std::memory_order_acquire) >> kEpochShift) == key)
+            {
+                auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if (left <= 0)
+                {
+                    notified = false;
+                    break;
+                }
+                struct timespec ts = {(time_t)(left / 1000000000), (long)(left % 1000000000)};
+                syscall(SYS_futex, EpochWord(), _shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, key, &ts, nullptr, 0);
+            }
+            Leave();
+            return notified;
+        }
+
+        void NotifyOne() { Notify(false); }
+        void NotifyAll() { Notify(true); }
+
+        template <typename Pred>
+        void Await(Pred pred, WaitPolicy policy = WaitPolicy::SPIN_THEN_PARK, uint32_t spins = kDefaultSpins)
+        {
+            if (policy != WaitPolicy::PARK)
+            {
+                for (uint32_t i = 0; policy == WaitPolicy::BUSY_POLL || i < spins; i++)
+                {
+                    if (pred())
+                    {
+                        return;
+                    }
+                    CpuRelax();
+                }
+            }
+
+            while (not pred())
+            {
+                Key key = PrepareWait();
+                if (pred())
+                {
+                    CancelWait();
+                    return;
+                }
+                Wait(key);
+            }
+        }
+
+        uint32_t GetWaiters() const { return _state.load(std::memory_order_relaxed) & kCountMask; }
+
+        static void CpuRelax()
+        {
+#if defined(__SSE2__)
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+    private:
+        // state: epoch << 32 | wakes in flight << 16 | waiters
+        static const uint64_t kWaiter = 1;
+        static const uint64_t kWake = 1ULL << 16;
+        static const uint64_t kCountMask = 0xffff;
+        static const int kEpochShift = 32;
+
+        uint32_t *EpochWord()
+        {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return reinterpret_cast<uint32_t *>(&_state) + 1;
+#else
+            return reinterpret_cast<uint32_t *>(&_state);
+#endif
+        }
+
+        // a leaving waiter takes one wake with it, woken by it or not
+        void Leave()
+        {
+            uint64_t state = _state.load(std::memory_order_relaxed);
+            uint64_t next;
+            do
+            {
+                next = state - kWaiter;
+                if ((state >> 16) & kCountMask)
+                {
+                    next -= kWake;
+                }
+            } while (!_state.compare_exchange_weak(state, next, std::memory_order_relaxed));
+        }
+
+        // Skips the syscall while every registered waiter already has a wake
+        // on its way, a parked waiter that was woken but not yet scheduled
+        // costs the notifiers nothing
+        void Notify(bool all)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            uint64_t state = _state.load(std::memory_order_relaxed);
+            uint64_t next;
+            do
+            {
+                uint64_t waiters = state & kCountMask;
+                uint64_t wakes = (state >> 16) & kCountMask;
+                if (waiters <= wakes)
+                {
+                    return;
+                }
+                next = ((state >> kEpochShift) + 1) << kEpochShift | (all ? waiters : wakes + 1) << 16 | waiters;
+            } while (!_state.compare_exchange_weak(state, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+            syscall(SYS_futex, EpochWord(), _shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+        }
+
+    private:
+        std::atomic<uint64_t> _state{0};
+        bool _shared = false;
+    };
+} // namespace sunflower
+
+#endif // EVENTCOUNT_H
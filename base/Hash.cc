@@ -1,4 +1,13 @@
 #include "Hash.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <sys/random.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 namespace sunflower
 {
@@ -11,4 +20,308 @@ namespace sunflower
         }
         return (hash & 0x7FFFFFFF);
     }
+
+    size_t SeededStrHash(const char *str, size_t seed)
+    {
+        uint32_t hash = 2166136261u ^ (uint32_t)seed;
+        while (*str)
+        {
+            hash ^= (unsigned char)(*str++);
+            hash *= 16777619u;
+        }
+        // fmix32 with the high half of the seed
+        hash ^= (uint32_t)((uint64_t)seed >> 32);
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    size_t RandomSeed()
+    {
+        static std::atomic<uint64_t> counter(0);
+        uint64_t seed = 0;
+        if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+        {
+            // entropy pool not ready, clock + pid + aslr is good enough for bucket spreading
+            seed = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+            seed ^= (uint64_t)getpid() << 32;
+            seed ^= (uint64_t)(uintptr_t)&counter;
+        }
+        seed = Mix64(seed + counter.fetch_add(0x9E3779B97F4A7C15ULL));
+        return seed ? seed : 1;
+    }
+
+    namespace
+    {
+#if defined(__x86_64__)
+        // A lane reads its key 8 bytes at a time, bytes after the terminator
+        // are masked off. A word load never crosses into the next page unless
+        // the key pointer sits in the last 7 bytes of one, those steps fall
+        // back to one byte per lane.
+        const uintptr_t kPageMask = 4095;
+        const uintptr_t kLastWordOffset = 4096 - 8;
+
+        template <int K>
+        struct Time33Byte8
+        {
+            __attribute__((target("avx2"))) static __m256i Get(__m256i w) { return _mm256_srai_epi32(_mm256_slli_epi32(w, 24 - 8 * K), 24); }
+        };
+
+        template <int K>
+        struct FnvByte8
+        {
+            __attribute__((target("avx2"))) static __m256i Get(__m256i w) { return _mm256_and_si256(_mm256_srli_epi32(w, 8 * K), _mm256_set1_epi32(0xFF)); }
+        };
+
+        __attribute__((target("avx2"))) inline __m256i Time33Step8(__m256i hash, __m256i c)
+        {
+            return _mm256_add_epi32(_mm256_add_epi32(hash, _mm256_slli_epi32(hash, 5)), c);
+        }
+
+        __attribute__((target("avx2"))) inline __m256i FnvStep8(__m256i hash, __m256i c)
+        {
+            return _mm256_mullo_epi32(_mm256_xor_si256(hash, c), _mm256_set1_epi32(16777619));
+        }
+
+        template <template <int> class Char, __m256i (*Step)(__m256i, __m256i)>
+        struct Avx2Lanes
+        {
+            template <int K>
+            __attribute__((target("avx2"))) static void Mix(__m256i w, __m256i &hash, __m256i &done)
+            {
+                __m256i c = Char<K>::Get(w);
+                done = _mm256_or_si256(done, _mm256_cmpeq_epi32(c, _mm256_setzero_si256()));
+                hash = _mm256_blendv_epi8(Step(hash, c), hash, done);
+            }
+
+            // 8 lanes, pointers live in two vectors of 4, each step gathers
+            // 8 bytes per lane and splits them into low and high dwords
+            __attribute__((target("avx2"))) static __m256i Run(const char *const *strs, __m256i hash)
+            {
+                __m256i lo = _mm256_loadu_si256((const __m256i *)strs);
+                __m256i hi = _mm256_loadu_si256((const __m256i *)(strs + 4));
+                const __m256i pageMask = _mm256_set1_epi64x(kPageMask);
+                const __m256i lastWord = _mm256_set1_epi64x(kLastWordOffset);
+                const __m256i evens = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+                __m256i done = _mm256_setzero_si256();
+                while (true)
+                {
+                    __m256i edge = _mm256_or_si256(_mm256_cmpgt_epi64(_mm256_and_si256(lo, pageMask), lastWord),
+                                                   _mm256_cmpgt_epi64(_mm256_and_si256(hi, pageMask), lastWord));
+                    int steps = 8;
+                    if (_mm256_testz_si256(edge, edge))
+                    {
+                        // lane order 0..7 for the low dwords, then the high dwords
+                        __m256i a = _mm256_permutevar8x32_epi32(_mm256_i64gather_epi64((const long long *)nullptr, lo, 1), evens);
+                        __m256i b = _mm256_permutevar8x32_epi32(_mm256_i64gather_epi64((const long long *)nullptr, hi, 1), evens);
+                        __m256i w0 = _mm256_permute2x128_si256(a, b, 0x20);
+                        __m256i w1 = _mm256_permute2x128_si256(a, b, 0x31);
+                        Mix<0>(w0, hash, done);
+                        Mix<1>(w0, hash, done);
+                        Mix<2>(w0, hash, done);
+                        Mix<3>(w0, hash, done);
+                        Mix<0>(w1, hash, done);
+                        Mix<1>(w1, hash, done);
+                        Mix<2>(w1, hash, done);
+                        Mix<3>(w1, hash, done);
+                    }
+                    else
+                    {
+                        alignas(32) const unsigned char *p[8];
+                        _mm256_store_si256((__m256i *)p, lo);
+                        _mm256_store_si256((__m256i *)(p + 4), hi);
+                        __m256i w = _mm256_setr_epi32(p[0][0], p[1][0], p[2][0], p[3][0], p[4][0], p[5][0], p[6][0], p[7][0]);
+                        Mix<0>(w, hash, done);
+                        steps = 1;
+                    }
+                    if (_mm256_movemask_epi8(done) == -1)
+                        break;
+                    __m256i step = _mm256_set1_epi64x(steps);
+                    lo = _mm256_add_epi64(lo, _mm256_andnot_si256(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(done)), step));
+                    hi = _mm256_add_epi64(hi, _mm256_andnot_si256(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(done, 1)), step));
+                }
+                return hash;
+            }
+        };
+
+        __attribute__((target("avx2"))) inline void Store8(__m256i hash, size_t *out)
+        {
+            _mm256_storeu_si256((__m256i *)out, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(hash)));
+            _mm256_storeu_si256((__m256i *)(out + 4), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(hash, 1)));
+        }
+
+        __attribute__((target("avx2"))) void Time33Avx2(const char *const *strs, size_t *out)
+        {
+            __m256i hash = Avx2Lanes<Time33Byte8, Time33Step8>::Run(strs, _mm256_set1_epi32(5381));
+            Store8(_mm256_and_si256(hash, _mm256_set1_epi32(0x7FFFFFFF)), out);
+        }
+
+        __attribute__((target("avx2"))) void SeededStrHashAvx2(const char *const *strs, size_t seed, size_t *out)
+        {
+            __m256i hash = Avx2Lanes<FnvByte8, FnvStep8>::Run(strs, _mm256_set1_epi32((int)(2166136261u ^ (uint32_t)seed)));
+            hash = _mm256_xor_si256(hash, _mm256_set1_epi32((int)(uint32_t)((uint64_t)seed >> 32)));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+            hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32((int)0x85ebca6bu));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 13));
+            hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32((int)0xc2b2ae35u));
+            hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 16));
+            Store8(hash, out);
+        }
+
+        bool HasAvx2()
+        {
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            return avx2;
+        }
+#endif
+    } // namespace
+
+    void Time33Batch(const char *const *strs, size_t n, size_t *out)
+    {
+        size_t i = 0;
+#if defined(__x86_64__)
+        if (HasAvx2())
+        {
+            for (; i + 8 <= n; i += 8)
+                Time33Avx2(strs + i, out + i);
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = Time33(strs[i]);
+    }
+
+    void SeededStrHashBatch(const char *const *strs, size_t n, size_t seed, size_t *out)
+    {
+        size_t i = 0;
+#if defined(__x86_64__)
+        if (HasAvx2())
+        {
+            for (; i + 8 <= n; i += 8)
+                SeededStrHashAvx2(strs + i, seed, out + i);
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = SeededStrHash(strs[i], seed);
+    }
+
+    void JumpConsistentHashBatch(const uint64_t *keys, size_t n, int32_t buckets, int32_t *out)
+    {
+        size_t i = 0;
+        // 4 walks in lockstep, finished ones keep their bucket by select so
+        // the loop has no per-lane branch and the divisions overlap
+        for (; i + 4 <= n; i += 4)
+        {
+            uint64_t key[4];
+            int64_t b[4], j[4];
+            for (size_t l = 0; l < 4; l++)
+            {
+                key[l] = keys[i + l];
+                b[l] = -1;
+                j[l] = 0;
+            }
+            while (j[0] < buckets || j[1] < buckets || j[2] < buckets || j[3] < buckets)
+            {
+                for (size_t l = 0; l < 4; l++)
+                {
+                    bool active = j[l] < buckets;
+                    b[l] = active ? j[l] : b[l];
+                    key[l] = key[l] * 2862933555777941757ULL + 1;
+                    int64_t next = (b[l] + 1) * ((double)(1LL << 31) / (double)((key[l] >> 33) + 1));
+                    j[l] = active ? next : j[l];
+                }
+            }
+            for (size_t l = 0; l < 4; l++)
+                out[i + l] = (int32_t)b[l];
+        }
+        for (; i < n; i++)
+            out[i] = JumpConsistentHash(keys[i], buckets);
+    }
+
+    const uint64_t RendezvousHash::kNoNode;
+
+    long RendezvousHash::find_node(uint64_t id) const
+    {
+        for (size_t i = 0; i < _ids.size(); i++)
+        {
+            if (_ids[i] == id)
+                return i;
+        }
+        return -1;
+    }
+
+    bool RendezvousHash::add_node(uint64_t id, double weight)
+    {
+        if (!(weight > 0) || find_node(id) >= 0)
+            return false;
+        _ids.push_back(id);
+        _seeds.push_back(Mix64(id));
+        _weights.push_back(weight);
+        return true;
+    }
+
+    bool RendezvousHash::remove_node(uint64_t id)
+    {
+        long i = find_node(id);
+        if (i < 0)
+            return false;
+        _ids.erase(_ids.begin() + i);
+        _seeds.erase(_seeds.begin() + i);
+        _weights.erase(_weights.begin() + i);
+        return true;
+    }
+
+    bool RendezvousHash::set_weight(uint64_t id, double weight)
+    {
+        long i = find_node(id);
+        if (i < 0 || !(weight > 0))
+            return false;
+        _weights[i] = weight;
+        return true;
+    }
+
+    double RendezvousHash::score(size_t i, uint64_t hash) const
+    {
+        // 53 random bits, centred so u is never 0 or 1
+        double u = ((Mix64(hash ^ _seeds[i]) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+        return _weights[i] / -log(u);
+    }
+
+    uint64_t RendezvousHash::pick(uint64_t hash) const
+    {
+        uint64_t best = kNoNode;
+        double bestScore = -1;
+        for (size_t i = 0; i < _ids.size(); i++)
+        {
+            double s = score(i, hash);
+            if (s > bestScore)
+            {
+                bestScore = s;
+                best = _ids[i];
+            }
+        }
+        return best;
+    }
+
+    void RendezvousHash::pick_batch(const uint64_t *hashes, size_t n, uint64_t *out) const
+    {
+        for (size_t i = 0; i < n; i++)
+            out[i] = pick(hashes[i]);
+    }
+
+    size_t RendezvousHash::pick_replicas(uint64_t hash, size_t k, uint64_t *out) const
+    {
+        k = std::min(k, _ids.size());
+        std::vector<std::pair<double, uint64_t>> scores(_ids.size());
+        for (size_t i = 0; i < _ids.size(); i++)
+            scores[i] = std::make_pair(score(i, hash), _ids[i]);
+        std::partial_sort(scores.begin(), scores.begin() + k, scores.end(),
+                          [](const std::pair<double, uint64_t> &a, const std::pair<double, uint64_t> &b)
+                          { return a.first > b.first; });
+        for (size_t i = 0; i < k; i++)
+            out[i] = scores[i].second;
+        return k;
+    }
 } // namespace sunflower
@@ -1,7 +1,12 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <functional>
+#include <type_traits>
+#include <vector>
 
 namespace sunflower
 {
@@ -11,9 +16,113 @@ namespace sunflower
      */
     size_t Time33(const char *str);
 
+    /**
+     * seeded fnv-1a, the seed goes into the basis and the finalizer.
+     * Not cryptographic, but colliding keys built for one seed do not
+     * collide under another one.
+     */
+    size_t SeededStrHash(const char *str, size_t seed);
+
+    /**
+     * batch forms, out[i] is bit-identical to the single key call.
+     * Keys are hashed 8 at a time across AVX2 lanes when the CPU has them,
+     * the tail and CPUs without AVX2 one by one.
+     * Lanes read keys in 8 byte words and may touch up to 7 bytes past the
+     * terminator, never past its page.
+     */
+    void Time33Batch(const char *const *strs, size_t n, size_t *out);
+    void SeededStrHashBatch(const char *const *strs, size_t n, size_t seed, size_t *out);
+
+    /**
+     * random non-zero seed, a zero seed keeps the unseeded legacy hash
+     */
+    size_t RandomSeed();
+
+    // murmur3 fmix64
+    inline uint64_t Mix64(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    /**
+     * jump consistent hash (Lamping, Veach), bucket of key in [0, buckets).
+     * Going from n to n + 1 buckets moves 1 / (n + 1) of the keys, all to
+     * the new bucket, where hash % n moves nearly all of them. Buckets can
+     * only be added or removed at the end, use RendezvousHash for named nodes.
+     */
+    inline int32_t JumpConsistentHash(uint64_t key, int32_t buckets)
+    {
+        int64_t b = -1, j = 0;
+        while (j < buckets)
+        {
+            b = j;
+            key = key * 2862933555777941757ULL + 1;
+            j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+        }
+        return (int32_t)b;
+    }
+
+    // batch form, several keys walk their jumps interleaved
+    void JumpConsistentHashBatch(const uint64_t *keys, size_t n, int32_t buckets, int32_t *out);
+
+    /**
+     * weighted rendezvous (highest random weight) hashing over named nodes.
+     * Node i scores a key with weight_i / -ln(u), u uniform in (0, 1) from
+     * the key hash and the node id, the best score owns the key: node i gets
+     * weight_i / sum of weights of the keys. Adding, removing or reweighting
+     * a node only moves keys to or from that node.
+     * pick() is O(nodes), meant for tens of shards. Not thread safe for
+     * writers, readers may share a const one.
+     */
+    class RendezvousHash
+    {
+    public:
+        static const uint64_t kNoNode = UINT64_MAX;
+
+        // false if id is there already or weight is not positive
+        bool add_node(uint64_t id, double weight = 1.0);
+        bool remove_node(uint64_t id);
+        bool set_weight(uint64_t id, double weight);
+        size_t node_count() const { return _ids.size(); }
+
+        // node of a hashed key, kNoNode without nodes
+        uint64_t pick(uint64_t hash) const;
+        void pick_batch(const uint64_t *hashes, size_t n, uint64_t *out) const;
+        // the best min(k, nodes) nodes of hash, best first, for replica placement
+        size_t pick_replicas(uint64_t hash, size_t k, uint64_t *out) const;
+
+    private:
+        long find_node(uint64_t id) const;
+        double score(size_t i, uint64_t hash) const;
+
+    private:
+        std::vector<uint64_t> _ids;
+        // Mix64 of the id, so nearby ids score independently
+        std::vector<uint64_t> _seeds;
+        std::vector<double> _weights;
+    };
+
     struct CharPtrHash
     {
-        size_t operator()(const char *str) const { return Time33(str); }
+        explicit CharPtrHash(size_t seed = 0) : _seed(seed) {}
+        size_t operator()(const char *str) const { return _seed ? SeededStrHash(str, _seed) : Time33(str); }
+        void hash_batch(const char *const *strs, size_t n, size_t *out) const
+        {
+            if (_seed)
+                SeededStrHashBatch(strs, n, _seed, out);
+            else
+                Time33Batch(strs, n, out);
+        }
+        void set_seed(size_t seed) { _seed = seed; }
+        size_t seed() const { return _seed; }
+
+    private:
+        size_t _seed;
     };
 
     struct CharPtrEqual
@@ -24,5 +133,81 @@ namespace sunflower
         }
     };
 
+    /**
+     * seeded wrapper over any hash, e.g. std::hash<uint64_t> which is the identity
+     */
+    template <class Key, class Base = std::hash<Key>>
+    struct SeededHash
+    {
+        explicit SeededHash(size_t seed = 0) : _seed(seed) {}
+        size_t operator()(const Key &key) const { return _seed ? Mix64(_base(key) ^ _seed) : _base(key); }
+        void set_seed(size_t seed) { _seed = seed; }
+        size_t seed() const { return _seed; }
+
+    private:
+        Base _base;
+        size_t _seed;
+    };
+
+    // hash functors with set_seed() can be re-seeded by the containers
+    template <class Hash, class = void>
+    struct IsSeededHash : std::false_type
+    {
+    };
+
+    template <class Hash>
+    struct IsSeededHash<Hash, std::void_t<decltype(std::declval<Hash &>().set_seed(size_t()))>> : std::true_type
+    {
+    };
+
+    // hash functors with hash_batch() hash several keys per call
+    template <class Hash, class = void>
+    struct IsBatchHash : std::false_type
+    {
+    };
+
+    template <class Hash>
+    struct IsBatchHash<Hash, std::void_t<decltype(std::declval<const Hash &>().hash_batch(nullptr, size_t(), (size_t *)nullptr))>> : std::true_type
+    {
+    };
+
+    // out[i] = hash(keys[i]), batched when the functor supports it
+    template <class Hash, class Key>
+    inline void HashBatch(const Hash &hash, const Key *keys, size_t n, size_t *out)
+    {
+        if constexpr (IsBatchHash<Hash>::value)
+        {
+            hash.hash_batch(keys, n, out);
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++)
+                out[i] = hash(keys[i]);
+        }
+    }
+
+    template <class Hash>
+    inline bool SeedHash(Hash &hash, size_t seed)
+    {
+        if constexpr (IsSeededHash<Hash>::value)
+        {
+            hash.set_seed(seed);
+            return true;
+        }
+        return false;
+    }
+
+    // fresh random seed for a seedable functor, no-op for the others
+    template <class Hash>
+    inline bool ReseedHash(Hash &hash)
+    {
+        if constexpr (IsSeededHash<Hash>::value)
+        {
+            hash.set_seed(RandomSeed());
+            return true;
+        }
+        return false;
+    }
+
 } // namespace sunflower
 #endif // HASH_H
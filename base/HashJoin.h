@@ -0,0 +1,356 @@
+#ifndef HASHJOIN_H
+#define HASHJOIN_H
+
+#include "CountDownLatch.h"
+#include "Hash.h"
+#include "Noncopyable.h"
+#include "TaskThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Radix partitioned parallel hash join on a TaskThreadPool.
+     * Both inputs are hashed once (HashBatch) and scattered by the low hash
+     * bits into 2^bits partitions sized to stay in cache, every partition
+     * then gets a bucket table (heads + next links over its rows, duplicate
+     * build keys allowed) and is probed with prefetching. Each worker task
+     * takes partitions from a shared counter and appends its matches to its
+     * own output buffer.
+     * join() must not be called from one of the pool workers.
+     */
+    template <class Key, class BuildValue, class ProbeValue, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashJoin : public Noncopyable
+    {
+    public:
+        struct Match
+        {
+            Key key;
+            BuildValue build;
+            ProbeValue probe;
+        };
+
+        struct Stats
+        {
+            size_t buildRows = 0;
+            size_t probeRows = 0;
+            size_t matches = 0;
+            size_t partitions = 0;
+            // wall time of each phase
+            double buildPartitionSeconds = 0;
+            double probePartitionSeconds = 0;
+            double buildSeconds = 0;
+            double probeSeconds = 0;
+
+            // rows per second, partitioning of the side included
+            double build_rate() const { return Rate(buildRows, buildPartitionSeconds + buildSeconds); }
+            double probe_rate() const { return Rate(probeRows, probePartitionSeconds + probeSeconds); }
+
+        private:
+            static double Rate(size_t rows, double seconds) { return seconds > 0 ? rows / seconds : 0; }
+        };
+
+        // 2^partitionBits partitions, 0 sizes them from the build input
+        explicit HashJoin(size_t partitionBits = 0);
+        ~HashJoin() {}
+
+        // Joins build and probe rows on equal keys, returns the number of matches
+        size_t join(const Key *buildKeys, const BuildValue *buildValues, size_t buildRows,
+                    const Key *probeKeys, const ProbeValue *probeValues, size_t probeRows,
+                    TaskThreadPool &pool);
+
+        // Matches of the last join, one buffer per worker task
+        const std::vector<std::vector<Match>> &outputs() const { return _outputs; }
+        template <class Fn>
+        void for_each_match(Fn fn) const;
+        size_t match_count() const { return _stats.matches; }
+        const Stats &stats() const { return _stats; }
+        // Releases the partitions and outputs of the last join
+        void clear();
+
+    private:
+        template <class Value>
+        struct Row
+        {
+            size_t hash = 0;
+            Key key = Key();
+            Value value = Value();
+        };
+
+        // build side bytes a partition aims for, about half of a L2
+        static const size_t kPartitionBytes = 256 * 1024;
+        static const size_t kMaxPartitionBits = 12;
+        static const size_t kPrefetchDistance = 16;
+
+        size_t partition_bits(size_t buildRows) const;
+        template <class Value>
+        void partition(const Key *keys, const Value *values, size_t n, std::vector<Row<Value>> &rows,
+                       std::vector<size_t> &offsets, TaskThreadPool &pool, size_t tasks);
+        void build(size_t p);
+        void probe(size_t p, std::vector<Match> &out);
+        // fn(task) for task in [0, tasks) on the pool, returns when all are done
+        template <class Fn>
+        static void Run(TaskThreadPool &pool, size_t tasks, Fn fn);
+
+    private:
+        size_t _partitionBits = 0;
+        size_t _bits = 0;
+        std::vector<Row<BuildValue>> _build;
+        std::vector<size_t> _buildOffsets;
+        std::vector<Row<ProbeValue>> _probe;
+        std::vector<size_t> _probeOffsets;
+        // bucket heads of partition p start at _headOffsets[p], 1 + row in
+        // the partition, 0 ends a chain; _next is indexed like _build
+        std::vector<uint32_t> _heads;
+        std::vector<size_t> _headOffsets;
+        std::vector<uint32_t> _next;
+        std::vector<std::vector<Match>> _outputs;
+        Stats _stats;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::HashJoin(size_t partitionBits)
+        : _partitionBits(std::min(partitionBits, (size_t)kMaxPartitionBits))
+    {
+        ReseedHash(_hash);
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    template <class Fn>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::Run(TaskThreadPool &pool, size_t tasks, Fn fn)
+    {
+        CountDownLatch latch(tasks);
+        for (size_t t = 0; t < tasks; t++)
+        {
+            pool.WaitPushTask([&fn, &latch, t]()
+                              {
+                                  fn(t);
+                                  latch.CountDown();
+                              });
+        }
+        latch.Wait();
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    size_t HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::partition_bits(size_t buildRows) const
+    {
+        if (_partitionBits)
+        {
+            return _partitionBits;
+        }
+        size_t bytes = buildRows * (sizeof(Row<BuildValue>) + 2 * sizeof(uint32_t));
+        size_t bits = 0;
+        while (bits < kMaxPartitionBits && (bytes >> bits) > kPartitionBytes)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    template <class Value>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::partition(const Key *keys, const Value *values, size_t n, std::vector<Row<Value>> &rows,
+                                                                          std::vector<size_t> &offsets, TaskThreadPool &pool, size_t tasks)
+    {
+        size_t partitions = (size_t)1 << _bits;
+        size_t mask = partitions - 1;
+        size_t chunk = (n + tasks - 1) / tasks;
+        std::vector<size_t> hashes(n);
+        std::vector<size_t> cursors(tasks * partitions, 0);
+
+        // pass 1: hash and count per chunk and partition
+        Run(pool, tasks, [&](size_t t)
+            {
+                size_t begin = std::min(n, t * chunk), end = std::min(n, begin + chunk);
+                HashBatch(_hash, keys + begin, end - begin, hashes.data() + begin);
+                size_t *count = &cursors[t * partitions];
+                for (size_t i = begin; i < end; i++)
+                {
+                    count[hashes[i] & mask]++;
+                }
+            });
+
+        // counts to write positions, chunk order inside a partition keeps the input order
+        offsets.assign(partitions + 1, 0);
+        size_t pos = 0;
+        for (size_t p = 0; p < partitions; p++)
+        {
+            offsets[p] = pos;
+            for (size_t t = 0; t < tasks; t++)
+            {
+                size_t count = cursors[t * partitions + p];
+                cursors[t * partitions + p] = pos;
+                pos += count;
+            }
+        }
+        offsets[partitions] = pos;
+
+        // pass 2: scatter
+        rows.resize(n);
+        Run(pool, tasks, [&](size_t t)
+            {
+                size_t begin = std::min(n, t * chunk), end = std::min(n, begin + chunk);
+                size_t *cursor = &cursors[t * partitions];
+                for (size_t i = begin; i < end; i++)
+                {
+                    Row<Value> &row = rows[cursor[hashes[i] & mask]++];
+                    row.hash = hashes[i];
+                    row.key = keys[i];
+                    row.value = values[i];
+                }
+            });
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::build(size_t p)
+    {
+        size_t begin = _buildOffsets[p], end = _buildOffsets[p + 1];
+        uint32_t *heads = &_heads[_headOffsets[p]];
+        size_t mask = _headOffsets[p + 1] - _headOffsets[p] - 1;
+
+        for (size_t i = begin; i < end; i++)
+        {
+            if (i + kPrefetchDistance < end)
+            {
+                __builtin_prefetch(&heads[(_build[i + kPrefetchDistance].hash >> _bits) & mask], 1);
+            }
+            uint32_t &head = heads[(_build[i].hash >> _bits) & mask];
+            _next[i] = head;
+            head = (uint32_t)(i - begin + 1);
+        }
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::probe(size_t p, std::vector<Match> &out)
+    {
+        // chain links are 1 based, base + idx is the build row
+        size_t base = _buildOffsets[p] - 1;
+        size_t begin = _probeOffsets[p], end = _probeOffsets[p + 1];
+        const uint32_t *heads = &_heads[_headOffsets[p]];
+        size_t mask = _headOffsets[p + 1] - _headOffsets[p] - 1;
+
+        for (size_t j = begin; j < end; j++)
+        {
+            if (j + kPrefetchDistance < end)
+            {
+                __builtin_prefetch(&heads[(_probe[j + kPrefetchDistance].hash >> _bits) & mask]);
+            }
+            const Row<ProbeValue> &row = _probe[j];
+            for (uint32_t idx = heads[(row.hash >> _bits) & mask]; idx; idx = _next[base + idx])
+            {
+                const Row<BuildValue> &match = _build[base + idx];
+                if (match.hash == row.hash && _equal(match.key, row.key))
+                {
+                    out.push_back(Match{row.key, match.value, row.value});
+                }
+            }
+        }
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    size_t HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::join(const Key *buildKeys, const BuildValue *buildValues, size_t buildRows,
+                                                                       const Key *probeKeys, const ProbeValue *probeValues, size_t probeRows,
+                                                                       TaskThreadPool &pool)
+    {
+        using Clock = std::chrono::steady_clock;
+        auto seconds = [](Clock::time_point from)
+        { return std::chrono::duration<double>(Clock::now() - from).count(); };
+
+        size_t tasks = std::max<uint32_t>(pool.GetWorkerNum(), 1);
+        _bits = partition_bits(buildRows);
+        size_t partitions = (size_t)1 << _bits;
+        _stats = Stats();
+        _stats.buildRows = buildRows;
+        _stats.probeRows = probeRows;
+        _stats.partitions = partitions;
+
+        auto start = Clock::now();
+        partition(buildKeys, buildValues, buildRows, _build, _buildOffsets, pool, tasks);
+        _stats.buildPartitionSeconds = seconds(start);
+        start = Clock::now();
+        partition(probeKeys, probeValues, probeRows, _probe, _probeOffsets, pool, tasks);
+        _stats.probePartitionSeconds = seconds(start);
+
+        // a power of two bucket count per partition, at least its row count
+        _headOffsets.assign(partitions + 1, 0);
+        for (size_t p = 0; p < partitions; p++)
+        {
+            size_t rows = _buildOffsets[p + 1] - _buildOffsets[p];
+            size_t buckets = 1;
+            while (buckets < rows)
+            {
+                buckets *= 2;
+            }
+            _headOffsets[p + 1] = _headOffsets[p] + buckets;
+        }
+
+        start = Clock::now();
+        _heads.assign(_headOffsets[partitions], 0);
+        _next.resize(buildRows);
+        std::atomic<size_t> nextPartition{0};
+        Run(pool, tasks, [&](size_t)
+            {
+                for (size_t p; (p = nextPartition.fetch_add(1, std::memory_order_relaxed)) < partitions;)
+                {
+                    build(p);
+                }
+            });
+        _stats.buildSeconds = seconds(start);
+
+        start = Clock::now();
+        _outputs.resize(tasks);
+        for (auto &out : _outputs)
+        {
+            out.clear();
+        }
+        nextPartition = 0;
+        Run(pool, tasks, [&](size_t t)
+            {
+                for (size_t p; (p = nextPartition.fetch_add(1, std::memory_order_relaxed)) < partitions;)
+                {
+                    probe(p, _outputs[t]);
+                }
+            });
+        _stats.probeSeconds = seconds(start);
+
+        for (auto &out : _outputs)
+        {
+            _stats.matches += out.size();
+        }
+        return _stats.matches;
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    template <class Fn>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::for_each_match(Fn fn) const
+    {
+        for (auto &out : _outputs)
+        {
+            for (auto &match : out)
+            {
+                fn(match);
+            }
+        }
+    }
+
+    template <class Key, class BuildValue, class ProbeValue, class Hash, class KeyEqual>
+    void HashJoin<Key, BuildValue, ProbeValue, Hash, KeyEqual>::clear()
+    {
+        std::vector<Row<BuildValue>>().swap(_build);
+        std::vector<Row<ProbeValue>>().swap(_probe);
+        std::vector<uint32_t>().swap(_heads);
+        std::vector<uint32_t>().swap(_next);
+        std::vector<std::vector<Match>>().swap(_outputs);
+        _buildOffsets.clear();
+        _probeOffsets.clear();
+        _headOffsets.clear();
+        _stats = Stats();
+    }
+} // namespace sunflower
+#endif // HASHJOIN_H
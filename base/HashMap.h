@@ -1,6 +1,8 @@
 #ifndef HASHMAP_H
 #define HASHMAP_H
 
+#include "Hash.h"
+#include "MmapAllocator.h"
 #include "Noncopyable.h"
 #include <atomic>
 #include <list>
@@ -11,21 +13,23 @@
 #include <string.h>
 #include <vector>
 
-#ifndef POS_MOD_BASE
-#define POS_MOD_BASE(x) (x & _mask)
-#endif
-
 namespace sunflower
 {
+    template <class Key, class Value, class Hash, class KeyEqual>
+    class HashMapCombinable;
+
     template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
     class HashMap : public Noncopyable
     {
+        // merges thread maps by relinking their nodes
+        friend class HashMapCombinable<Key, Value, Hash, KeyEqual>;
+
     public:
         class Node
         {
         public:
             Node(const Key &key, const Value &value, Node *next) : _k(key), _v(value), _next(next) {}
-            Node(const Key &key, Node *next) : _k(key), _next(next) {}
+            Node(const Key &key, Node *next) : _k(key), _v(), _next(next) {}
             void set(const Key &key, const Value &value)
             {
                 _k = key;
@@ -41,7 +45,7 @@ namespace sunflower
             Value _v;
             Node *_next = nullptr;
         };
-        explicit HashMap(size_t power = 20);
+        explicit HashMap(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
         ~HashMap() { clear(); }
 
         // Capacity
@@ -65,31 +69,51 @@ namespace sunflower
         size_t bucket_count() const { return _capacity; }
         size_t bucket(const Key &key) const;
 
+        // Seeding, a chain longer than max_chain re-seeds a seedable Hash
+        // (see Hash.h) and rebuilds the table, 0 disables it
+        void set_max_chain(size_t maxChain) { _maxChain = maxChain; }
+        size_t max_chain() const { return _maxChain; }
+        size_t reseed_count() const { return _reseeds; }
+
+        // Memory backing of the bucket array
+        MemoryInfo memory_info() const { return _bucket[_lastest].get_allocator().info(); }
+
     private:
+        using BucketVector = std::vector<Node *, MmapAllocator<Node *>>;
+
         size_t next_capacity();
+        void rebuild(size_t capacity);
+        void check_chain(size_t chain);
 
     private:
         // lastest bucket and old bucket for rehash
-        std::vector<Node *> _bucket[2];
+        BucketVector _bucket[2];
         size_t _numElements = 0;
         size_t _capacity = 0;
         size_t _mask = 0;
         size_t _lastest = 0;
+        size_t _maxChain = 32;
+        size_t _reseeds = 0;
+        size_t _reseedAt = 0;
         Hash _hash;
         KeyEqual _equal;
     };
     template <class Key, class Value, class Hash, class KeyEqual>
-    HashMap<Key, Value, Hash, KeyEqual>::HashMap(size_t power)
+    HashMap<Key, Value, Hash, KeyEqual>::HashMap(size_t power, unsigned memFlags)
     {
+        MmapAllocator<Node *> alloc(memFlags);
+        _bucket[0] = BucketVector(alloc);
+        _bucket[1] = BucketVector(alloc);
         _capacity = pow(2, power);
         _mask = _capacity - 1;
         _bucket[_lastest].resize(_capacity);
+        ReseedHash(_hash);
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
     size_t HashMap<Key, Value, Hash, KeyEqual>::bucket(const Key &key) const
     {
-        return POS_MOD_BASE(_hash(key));
+        return _hash(key) & _mask;
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
@@ -98,6 +122,7 @@ namespace sunflower
         size_t id = bucket(key);
         auto head = _bucket[_lastest][id];
         auto node = head;
+        size_t chain = 0;
 
         while (node)
         {
@@ -106,6 +131,7 @@ namespace sunflower
                 return std::make_pair<Value, bool>(std::move(node->v()), false);
             }
             node = node->next();
+            chain++;
         }
 
         Node *newNode = new Node(key, value, head);
@@ -117,6 +143,10 @@ namespace sunflower
         {
             rehash(next_capacity());
         }
+        else
+        {
+            check_chain(chain);
+        }
 
         return ret;
     }
@@ -209,6 +239,7 @@ namespace sunflower
         size_t id = bucket(key);
         auto head = _bucket[_lastest][id];
         auto node = head;
+        size_t chain = 0;
 
         while (node)
         {
@@ -217,6 +248,7 @@ namespace sunflower
                 return node->v();
             }
             node = node->next();
+            chain++;
         }
 
         Node *newNode = new Node(key, head);
@@ -227,6 +259,10 @@ namespace sunflower
         {
             rehash(next_capacity());
         }
+        else
+        {
+            check_chain(chain);
+        }
         return ret;
     }
 
@@ -236,6 +272,7 @@ namespace sunflower
         size_t id = bucket(key);
         auto head = _bucket[_lastest][id];
         auto node = head;
+        size_t chain = 0;
 
         while (node)
         {
@@ -244,6 +281,7 @@ namespace sunflower
                 return node->v();
             }
             node = node->next();
+            chain++;
         }
 
         Node *newNode = new Node(key, head);
@@ -254,6 +292,10 @@ namespace sunflower
         {
             rehash(next_capacity());
         }
+        else
+        {
+            check_chain(chain);
+        }
         return ret;
     }
 
@@ -268,28 +310,46 @@ namespace sunflower
     {
         if (_capacity == capacity)
             return;
+        rebuild(capacity);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMap<Key, Value, Hash, KeyEqual>::check_chain(size_t chain)
+    {
+        // at most one re-seed per doubling of the element count, a hash that
+        // collides whatever the seed cannot turn every insert into a rebuild
+        if (_maxChain == 0 || chain < _maxChain || _numElements < 2 * _reseedAt)
+            return;
+        if (ReseedHash(_hash))
+        {
+            _reseeds++;
+            _reseedAt = _numElements;
+            rebuild(_capacity);
+        }
+    }
 
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMap<Key, Value, Hash, KeyEqual>::rebuild(size_t capacity)
+    {
         size_t new_index = (_lastest == 0 ? 1 : 0);
         size_t new_mask = capacity - 1;
 
         _bucket[new_index].resize(capacity);
 
-        // copy from _lastest bucket to new_index bucket
+        // relink nodes from _lastest bucket to new_index bucket,
+        // references handed out by operator[] stay valid
         for (size_t id = 0; id < _capacity; id++)
         {
             auto node = _bucket[_lastest][id];
 
             while (node)
             {
-                auto key = node->k();
-                size_t new_id = _hash(key) & new_mask;
-
-                Node *newNode = new Node(key, node->v(), _bucket[new_index][new_id]);
-                _bucket[new_index][new_id] = newNode;
+                Node *next = node->next();
+                size_t new_id = _hash(node->k()) & new_mask;
 
-                Node *prev = node;
-                node = node->next();
-                delete prev;
+                node->set_next(_bucket[new_index][new_id]);
+                _bucket[new_index][new_id] = node;
+                node = next;
             }
             _bucket[_lastest][id] = nullptr;
         }
@@ -0,0 +1,263 @@
+#ifndef HASHMAPCOMBINABLE_H
+#define HASHMAPCOMBINABLE_H
+
+#include "HashMap.h"
+#include "CountDownLatch.h"
+#include "Noncopyable.h"
+#include "TaskThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Per-thread HashMap accumulators for counting and group-by.
+     * Every thread aggregates into its own unsynchronized map from local(),
+     * merge() then moves all entries into one map, in parallel by bucket range.
+     * All thread maps share one hash seed so a source bucket maps onto a fixed
+     * set of destination buckets and merge tasks never touch the same bucket.
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashMapCombinable : public Noncopyable
+    {
+    public:
+        using map_t = HashMap<Key, Value, Hash, KeyEqual>;
+        using Node = typename map_t::Node;
+
+        struct Accumulate
+        {
+            void operator()(Value &dst, Value &src) const { dst += src; }
+        };
+
+        explicit HashMapCombinable(size_t power = 10);
+        ~HashMapCombinable() {}
+
+        // Unsynchronized map of the calling thread, created on first use.
+        // Lock free after a thread's first call unless a colliding instance evicted it
+        map_t &local();
+        size_t local_count();
+        void clear();
+
+        // Move every entry into dst, combine(dstValue, srcValue) on equal keys.
+        // Thread maps are empty afterwards, nobody may use local() meanwhile.
+        // The pool variant must not be called from one of the pool workers.
+        template <class Combine = Accumulate>
+        void merge(map_t &dst, Combine combine = Combine());
+        template <class Combine = Accumulate>
+        void merge(map_t &dst, TaskThreadPool &pool, Combine combine = Combine());
+
+    private:
+        struct Cache
+        {
+            uint64_t owner = 0;
+            map_t *map = nullptr;
+        };
+
+        // per-thread cache slots indexed by _id, ids are handed out in sequence
+        // so up to kCacheSlots instances created together never evict each other
+        static constexpr size_t kCacheSlots = 16;
+
+        map_t &local_slow(Cache &cache);
+        size_t prepare(map_t &dst, size_t partitions);
+        template <class Combine>
+        size_t merge_partition(map_t &dst, size_t partition, size_t partitions, Combine &combine);
+
+    private:
+        static inline std::atomic<uint64_t> s_nextId{1};
+        uint64_t _id = 0;
+        size_t _power = 0;
+        Hash _hash;
+        std::mutex _mutex = {};
+        std::vector<std::thread::id> _owners;
+        std::vector<std::unique_ptr<map_t>> _locals;
+    };
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapCombinable<Key, Value, Hash, KeyEqual>::HashMapCombinable(size_t power)
+        : _id(s_nextId++), _power(power)
+    {
+        ReseedHash(_hash);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    typename HashMapCombinable<Key, Value, Hash, KeyEqual>::map_t &HashMapCombinable<Key, Value, Hash, KeyEqual>::local()
+    {
+        static thread_local Cache caches[kCacheSlots];
+        Cache &cache = caches[_id & (kCacheSlots - 1)];
+        if (cache.owner == _id)
+        {
+            return *cache.map;
+        }
+        return local_slow(cache);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    typename HashMapCombinable<Key, Value, Hash, KeyEqual>::map_t &HashMapCombinable<Key, Value, Hash, KeyEqual>::local_slow(Cache &cache)
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        auto self = std::this_thread::get_id();
+        map_t *map = nullptr;
+        for (size_t i = 0; i < _owners.size(); i++)
+        {
+            if (_owners[i] == self)
+            {
+                map = _locals[i].get();
+                break;
+            }
+        }
+
+        if (map == nullptr)
+        {
+            _locals.push_back(std::make_unique<map_t>(_power));
+            _owners.push_back(self);
+            map = _locals.back().get();
+            // shared seed, a re-seed would break the bucket correspondence
+            map->_hash = _hash;
+            map->_maxChain = 0;
+        }
+
+        cache.owner = _id;
+        cache.map = map;
+        return *map;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapCombinable<Key, Value, Hash, KeyEqual>::local_count()
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        return _locals.size();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapCombinable<Key, Value, Hash, KeyEqual>::clear()
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        for (auto &map : _locals)
+        {
+            map->clear();
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapCombinable<Key, Value, Hash, KeyEqual>::prepare(map_t &dst, size_t partitions)
+    {
+        size_t total = dst._numElements;
+        size_t capacity = dst._capacity;
+        for (auto &map : _locals)
+        {
+            total += map->_numElements;
+            capacity = std::max(capacity, map->_capacity);
+        }
+        while (capacity < total)
+        {
+            capacity *= 2;
+        }
+
+        // dst takes the shared seed, its own entries are rehashed with it
+        dst._hash = _hash;
+        dst.rebuild(capacity);
+
+        // a partition must divide every capacity, the smallest one is 2^_power
+        return std::min(partitions, (size_t)pow(2, _power));
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Combine>
+    size_t HashMapCombinable<Key, Value, Hash, KeyEqual>::merge_partition(map_t &dst, size_t partition, size_t partitions, Combine &combine)
+    {
+        // source bucket b and destination bucket hash & dst._mask are both
+        // congruent to hash mod partitions, so this task owns its dst buckets
+        size_t moved = 0;
+        auto &buckets = dst._bucket[dst._lastest];
+        for (auto &map : _locals)
+        {
+            auto &source = map->_bucket[map->_lastest];
+            for (size_t b = partition; b < map->_capacity; b += partitions)
+            {
+                Node *node = source[b];
+                while (node)
+                {
+                    Node *next = node->next();
+                    size_t id = dst._hash(node->k()) & dst._mask;
+
+                    Node *curr = buckets[id];
+                    while (curr && !dst._equal(node->k(), curr->k()))
+                    {
+                        curr = curr->next();
+                    }
+
+                    if (curr)
+                    {
+                        combine(curr->v(), node->v());
+                        delete node;
+                    }
+                    else
+                    {
+                        node->set_next(buckets[id]);
+                        buckets[id] = node;
+                        moved++;
+                    }
+                    node = next;
+                }
+                source[b] = nullptr;
+            }
+        }
+        return moved;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Combine>
+    void HashMapCombinable<Key, Value, Hash, KeyEqual>::merge(map_t &dst, Combine combine)
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        prepare(dst, 1);
+        dst._numElements += merge_partition(dst, 0, 1, combine);
+        for (auto &map : _locals)
+        {
+            map->_numElements = 0;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Combine>
+    void HashMapCombinable<Key, Value, Hash, KeyEqual>::merge(map_t &dst, TaskThreadPool &pool, Combine combine)
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+
+        // a few partitions per worker to even out skewed buckets
+        size_t partitions = 1;
+        while (partitions < 4 * (size_t)pool.GetWorkerNum())
+        {
+            partitions *= 2;
+        }
+        partitions = prepare(dst, partitions);
+
+        std::vector<size_t> moved(partitions, 0);
+        CountDownLatch latch(partitions);
+        for (size_t p = 0; p < partitions; p++)
+        {
+            pool.WaitPushTask([this, &dst, &moved, &latch, &combine, p, partitions]()
+                              {
+                                  Combine local = combine;
+                                  moved[p] = merge_partition(dst, p, partitions, local);
+                                  latch.CountDown();
+                              });
+        }
+        latch.Wait();
+
+        for (size_t p = 0; p < partitions; p++)
+        {
+            dst._numElements += moved[p];
+        }
+        for (auto &map : _locals)
+        {
+            map->_numElements = 0;
+        }
+    }
+} // namespace sunflower
+#endif // HASHMAPCOMBINABLE_H
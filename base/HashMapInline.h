@@ -0,0 +1,483 @@
+#ifndef HASHMAPINLINE_H
+#define HASHMAPINLINE_H
+
+#include "Hash.h"
+#include "MmapAllocator.h"
+#include "Noncopyable.h"
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * HashMap with the first entry of every bucket stored inline in the
+     * bucket array, next to a 32 bit hash tag. Collisions overflow to a
+     * chain of heap nodes hanging off the slot.
+     * At load factor <= 1 most buckets hold one entry, a lookup is then a
+     * single cache miss instead of bucket pointer + node, and the tag skips
+     * key compares on the chain.
+     * Key and Value must be default constructible, an empty slot keeps
+     * default ones. References from operator[] and at() are invalidated by
+     * rehash and by erase of a key sharing the bucket, unlike HashMap.
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashMapInline : public Noncopyable
+    {
+    public:
+        class Node
+        {
+        public:
+            Node(uint32_t tag, const Key &key, const Value &value, Node *next) : _tag(tag), _k(key), _v(value), _next(next) {}
+            void set_tag(uint32_t tag) { _tag = tag; }
+            void set_next(Node *next) { _next = next; }
+            uint32_t tag() const { return _tag; }
+            Key &k() { return _k; }
+            Value &v() { return _v; }
+            Node *next() const { return _next; }
+
+        private:
+            uint32_t _tag;
+            Key _k;
+            Value _v;
+            Node *_next = nullptr;
+        };
+
+        // bucket array element, tag 0 marks an empty slot
+        struct Slot
+        {
+            uint32_t tag = 0;
+            Key k = Key();
+            Value v = Value();
+            Node *next = nullptr;
+        };
+
+        explicit HashMapInline(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
+        ~HashMapInline() { clear(); }
+
+        // Capacity
+        bool empty() const noexcept { return _numElements == 0; }
+        size_t size() const noexcept { return _numElements; }
+
+        // Modifiers
+        std::pair<Value, bool> insert(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void rehash(size_t capacity);
+        void clear();
+
+        // Lookup
+        Value find(const Key &key);
+        void find(const Key &key, Value &value, bool &exsit);
+        size_t count(const Key &key);
+        Value &operator[](const Key &key);
+        Value &at(const Key &key) { return (*this)[key]; }
+
+        // Bucket interface
+        size_t bucket_count() const { return _capacity; }
+        size_t bucket(const Key &key) const;
+        // entries stored in chain nodes instead of inline
+        size_t overflow_count() const { return _numOverflow; }
+
+        // Seeding, a chain longer than max_chain re-seeds a seedable Hash
+        // (see Hash.h) and rebuilds the table, 0 disables it
+        void set_max_chain(size_t maxChain) { _maxChain = maxChain; }
+        size_t max_chain() const { return _maxChain; }
+        size_t reseed_count() const { return _reseeds; }
+
+        // Memory backing of the slot array
+        MemoryInfo memory_info() const { return _slots[_lastest].get_allocator().info(); }
+
+    private:
+        using SlotVector = std::vector<Slot, MmapAllocator<Slot>>;
+
+        static uint32_t Tag(size_t hash) { return (uint32_t)(hash ^ (hash >> 32)) | 1; }
+
+        // slot or chain value of key, nullptr if absent
+        Value *search(const Key &key, size_t hash);
+        // key is known absent
+        Value &emplace(size_t hash, const Key &key, const Value &value);
+        // moves an inline entry into slots
+        void place(SlotVector &slots, size_t mask, Key &key, Value &value);
+        // relinks a chain node into slots, or pulls it inline if its slot is empty
+        void place(SlotVector &slots, size_t mask, Node *node);
+        size_t next_capacity();
+        void rebuild(size_t capacity);
+        void check_chain(size_t chain);
+
+    private:
+        // lastest slots and old slots for rehash
+        SlotVector _slots[2];
+        size_t _numElements = 0;
+        size_t _numOverflow = 0;
+        size_t _capacity = 0;
+        size_t _mask = 0;
+        size_t _lastest = 0;
+        size_t _maxChain = 32;
+        size_t _reseeds = 0;
+        size_t _reseedAt = 0;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapInline<Key, Value, Hash, KeyEqual>::HashMapInline(size_t power, unsigned memFlags)
+    {
+        MmapAllocator<Slot> alloc(memFlags);
+        _slots[0] = SlotVector(alloc);
+        _slots[1] = SlotVector(alloc);
+        _capacity = pow(2, power);
+        _mask = _capacity - 1;
+        _slots[_lastest].resize(_capacity);
+        ReseedHash(_hash);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapInline<Key, Value, Hash, KeyEqual>::bucket(const Key &key) const
+    {
+        return _hash(key) & _mask;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    Value *HashMapInline<Key, Value, Hash, KeyEqual>::search(const Key &key, size_t hash)
+    {
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return &slot.v;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return &node->v();
+            }
+            node = node->next();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    Value &HashMapInline<Key, Value, Hash, KeyEqual>::emplace(size_t hash, const Key &key, const Value &value)
+    {
+        Slot &slot = _slots[_lastest][hash & _mask];
+        Value *ret = nullptr;
+        size_t chain = 0;
+        if (slot.tag == 0)
+        {
+            slot.tag = Tag(hash);
+            slot.k = key;
+            slot.v = value;
+            ret = &slot.v;
+        }
+        else
+        {
+            for (auto node = slot.next; node; node = node->next())
+            {
+                chain++;
+            }
+            slot.next = new Node(Tag(hash), key, value, slot.next);
+            ret = &slot.next->v();
+            chain++;
+            _numOverflow++;
+        }
+        _numElements++;
+
+        // a rebuild moves the entry, find it again
+        size_t reseeds = _reseeds;
+        if (_numElements >= _capacity)
+        {
+            rehash(next_capacity());
+            ret = search(key, _hash(key));
+        }
+        else
+        {
+            check_chain(chain);
+            if (_reseeds != reseeds)
+            {
+                ret = search(key, _hash(key));
+            }
+        }
+        return *ret;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    std::pair<Value, bool> HashMapInline<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        size_t hash = _hash(key);
+        Value *found = search(key, hash);
+        if (found)
+        {
+            return std::make_pair(*found, false);
+        }
+        return std::make_pair(emplace(hash, key, value), true);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapInline<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == 0)
+        {
+            return 0;
+        }
+
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            Node *first = slot.next;
+            if (first)
+            {
+                // pull the first chain entry inline
+                slot.tag = first->tag();
+                slot.k = std::move(first->k());
+                slot.v = std::move(first->v());
+                slot.next = first->next();
+                delete first;
+                _numOverflow--;
+            }
+            else
+            {
+                slot = Slot();
+            }
+            _numElements--;
+            return 1;
+        }
+
+        auto node = slot.next;
+        Node *prev = nullptr;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                if (prev)
+                {
+                    prev->set_next(node->next());
+                }
+                else
+                {
+                    slot.next = node->next();
+                }
+                delete node;
+                _numOverflow--;
+                _numElements--;
+                return 1;
+            }
+            prev = node;
+            node = node->next();
+        }
+        return 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    Value HashMapInline<Key, Value, Hash, KeyEqual>::find(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return slot.v;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return node->v();
+            }
+            node = node->next();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            exsit = true;
+            value = slot.v;
+            return;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                exsit = true;
+                value = node->v();
+                return;
+            }
+            node = node->next();
+        }
+        exsit = false;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapInline<Key, Value, Hash, KeyEqual>::count(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return 1;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return 1;
+            }
+            node = node->next();
+        }
+        return 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    Value &HashMapInline<Key, Value, Hash, KeyEqual>::operator[](const Key &key)
+    {
+        size_t hash = _hash(key);
+        Value *found = search(key, hash);
+        if (found)
+        {
+            return *found;
+        }
+        return emplace(hash, key, Value());
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapInline<Key, Value, Hash, KeyEqual>::next_capacity()
+    {
+        return 2 * _capacity;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::rehash(size_t capacity)
+    {
+        if (_capacity == capacity)
+            return;
+        rebuild(capacity);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::check_chain(size_t chain)
+    {
+        // at most one re-seed per doubling of the element count, a hash that
+        // collides whatever the seed cannot turn every insert into a rebuild
+        if (_maxChain == 0 || chain < _maxChain || _numElements < 2 * _reseedAt)
+            return;
+        if (ReseedHash(_hash))
+        {
+            _reseeds++;
+            _reseedAt = _numElements;
+            rebuild(_capacity);
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::place(SlotVector &slots, size_t mask, Key &key, Value &value)
+    {
+        size_t hash = _hash(key);
+        Slot &slot = slots[hash & mask];
+        if (slot.tag == 0)
+        {
+            slot.tag = Tag(hash);
+            slot.k = std::move(key);
+            slot.v = std::move(value);
+        }
+        else
+        {
+            slot.next = new Node(Tag(hash), std::move(key), std::move(value), slot.next);
+            _numOverflow++;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::place(SlotVector &slots, size_t mask, Node *node)
+    {
+        size_t hash = _hash(node->k());
+        Slot &slot = slots[hash & mask];
+        if (slot.tag == 0)
+        {
+            slot.tag = Tag(hash);
+            slot.k = std::move(node->k());
+            slot.v = std::move(node->v());
+            delete node;
+            _numOverflow--;
+        }
+        else
+        {
+            // a re-seed changes the tag too
+            node->set_tag(Tag(hash));
+            node->set_next(slot.next);
+            slot.next = node;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::rebuild(size_t capacity)
+    {
+        size_t new_index = (_lastest == 0 ? 1 : 0);
+        size_t new_mask = capacity - 1;
+        SlotVector &from = _slots[_lastest];
+        SlotVector &to = _slots[new_index];
+
+        to.resize(capacity);
+
+        // move inline entries, relink chain nodes or pull them inline
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            Slot &slot = from[id];
+            if (slot.tag == 0)
+                continue;
+            Node *node = slot.next;
+            place(to, new_mask, slot.k, slot.v);
+            while (node)
+            {
+                Node *next = node->next();
+                place(to, new_mask, node);
+                node = next;
+            }
+            slot = Slot();
+        }
+        _lastest = new_index;
+        _mask = new_mask;
+        _capacity = capacity;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapInline<Key, Value, Hash, KeyEqual>::clear()
+    {
+        if (_numElements == 0)
+            return;
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            Slot &slot = _slots[_lastest][id];
+            auto node = slot.next;
+            while (node)
+            {
+                Node *curr = node;
+                node = node->next();
+                delete curr;
+            }
+            slot = Slot();
+        }
+        _numElements = 0;
+        _numOverflow = 0;
+    }
+} // namespace sunflower
+#endif // HASHMAPINLINE_H
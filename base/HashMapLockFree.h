@@ -0,0 +1,310 @@
+#ifndef HASHMAPLOCKFREE_H
+#define HASHMAPLOCKFREE_H
+
+#include "HashTableLockFree.h"
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+namespace sunflower
+{
+    /**
+     * Lock-free map of integral keys to integral values on a
+     * HashTableLockFree (see there for probing, tombstones and migration).
+     * The value word is the slot state: absent, moved or the value,
+     * so every update is a single CAS and fetch_add() serves as a counter.
+     * For 64 bit types INT64_MIN and INT64_MIN + 1 (as unsigned 2^63 and
+     * 2^63 + 1) are the sentinels, such keys and values are rejected.
+     */
+    template <class Key, class Value>
+    class HashMapLockFree : public Noncopyable
+    {
+        static_assert(std::is_integral<Key>::value && !std::is_same<Key, bool>::value, "HashMapLockFree needs an integral key");
+        static_assert(std::is_integral<Value>::value && !std::is_same<Value, bool>::value, "HashMapLockFree needs an integral value");
+
+    public:
+        explicit HashMapLockFree(size_t power = 20, unsigned memFlags = MEM_DEFAULT) : _table(power, memFlags) {}
+        ~HashMapLockFree() {}
+
+        // Capacity, exact once writers are quiet
+        bool empty() const noexcept { return size() == 0; }
+        size_t size() const noexcept { return _table.size(); }
+
+        // Modifiers
+        // the value already there and false if key exists
+        std::pair<Value, bool> insert(const Key &key, const Value &value);
+        // true if key was inserted, false if assigned
+        bool insert_or_assign(const Key &key, const Value &value);
+        // adds delta, an absent key counts as 0, returns the previous value
+        // and true, or false and nothing added if key is a sentinel or the
+        // sum would be one
+        std::pair<Value, bool> fetch_add(const Key &key, const Value &delta);
+        // desired if key holds expected, else expected gets the current value
+        bool compare_exchange(const Key &key, Value &expected, const Value &desired);
+        size_t erase(const Key &key);
+        // not safe against concurrent operations
+        void clear() { _table.clear(); }
+
+        // Lookup
+        // Value() if absent
+        Value find(const Key &key);
+        void find(const Key &key, Value &value, bool &exsit);
+        size_t count(const Key &key);
+        // one epoch guard for the batch, returns the number of hits
+        size_t find_batch(const Key *keys, size_t n, Value *values, bool *exsit);
+
+        size_t bucket_count() const { return _table.bucket_count(); }
+        // tables copied so far
+        size_t migration_count() const { return _table.migration_count(); }
+
+    private:
+        using KeyImage = typename std::make_unsigned<Key>::type;
+        using ValueImage = typename std::make_unsigned<Value>::type;
+
+        using Core = HashTableLockFree<uint64_t>;
+        using Table = typename Core::Table;
+        using Slot = typename Core::Slot;
+
+        static const uint64_t kMovedKey = Core::kMovedKey;
+        static const uint64_t kAbsent = Core::kAbsent;
+        static const uint64_t kMoved = Core::kMoved;
+
+        // slot words, < 2 for the reserved keys and values
+        static uint64_t EncodeKey(const Key &key) { return (uint64_t)(KeyImage)key ^ (1ULL << 63); }
+        static uint64_t EncodeValue(const Value &value) { return (uint64_t)(ValueImage)value ^ (1ULL << 63); }
+        static Value DecodeValue(uint64_t word) { return (Value)(ValueImage)(word ^ (1ULL << 63)); }
+        // value word of key, kAbsent if absent
+        uint64_t load(uint64_t word);
+
+    private:
+        Core _table;
+    };
+
+    template <class Key, class Value>
+    std::pair<Value, bool> HashMapLockFree<Key, Value>::insert(const Key &key, const Value &value)
+    {
+        uint64_t word = EncodeKey(key);
+        uint64_t v = EncodeValue(value);
+        if (word <= kMovedKey || v <= kMoved)
+            return std::make_pair(Value(), false);
+
+        typename Core::Guard guard(_table);
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.claim(t, word, h);
+            uint64_t current = kAbsent;
+            if (slot->state.compare_exchange_strong(current, v, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                _table.add_size(1);
+                return std::make_pair(value, true);
+            }
+            if (current != kMoved)
+                return std::make_pair(DecodeValue(current), false);
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    bool HashMapLockFree<Key, Value>::insert_or_assign(const Key &key, const Value &value)
+    {
+        uint64_t word = EncodeKey(key);
+        uint64_t v = EncodeValue(value);
+        if (word <= kMovedKey || v <= kMoved)
+            return false;
+
+        typename Core::Guard guard(_table);
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.claim(t, word, h);
+            uint64_t current = slot->state.load(std::memory_order_acquire);
+            while (current != kMoved)
+            {
+                if (slot->state.compare_exchange_weak(current, v, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    if (current == kAbsent)
+                    {
+                        _table.add_size(1);
+                        return true;
+                    }
+                    return false;
+                }
+            }
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    std::pair<Value, bool> HashMapLockFree<Key, Value>::fetch_add(const Key &key, const Value &delta)
+    {
+        uint64_t word = EncodeKey(key);
+        if (word <= kMovedKey)
+            return std::make_pair(Value(), false);
+
+        typename Core::Guard guard(_table);
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.claim(t, word, h);
+            uint64_t current = slot->state.load(std::memory_order_acquire);
+            while (current != kMoved)
+            {
+                Value old = current == kAbsent ? Value() : DecodeValue(current);
+                // unsigned wraparound, no signed overflow
+                uint64_t v = EncodeValue((Value)(ValueImage)((ValueImage)old + (ValueImage)delta));
+                if (v <= kMoved)
+                    return std::make_pair(old, false);
+                if (slot->state.compare_exchange_weak(current, v, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    if (current == kAbsent)
+                    {
+                        _table.add_size(1);
+                    }
+                    return std::make_pair(old, true);
+                }
+            }
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    bool HashMapLockFree<Key, Value>::compare_exchange(const Key &key, Value &expected, const Value &desired)
+    {
+        uint64_t word = EncodeKey(key);
+        uint64_t v = EncodeValue(desired);
+        if (word <= kMovedKey || v <= kMoved || EncodeValue(expected) <= kMoved)
+            return false;
+
+        typename Core::Guard guard(_table);
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.lookup(t, word, h);
+            if (slot == nullptr)
+                return false;
+            uint64_t current = EncodeValue(expected);
+            if (slot->state.compare_exchange_strong(current, v, std::memory_order_acq_rel, std::memory_order_acquire))
+                return true;
+            if (current == kAbsent)
+                return false;
+            if (current != kMoved)
+            {
+                expected = DecodeValue(current);
+                return false;
+            }
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    size_t HashMapLockFree<Key, Value>::erase(const Key &key)
+    {
+        uint64_t word = EncodeKey(key);
+        if (word <= kMovedKey)
+            return 0;
+
+        typename Core::Guard guard(_table);
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.lookup(t, word, h);
+            if (slot == nullptr)
+                return 0;
+            uint64_t current = slot->state.load(std::memory_order_acquire);
+            while (current != kMoved)
+            {
+                if (current == kAbsent)
+                    return 0;
+                if (slot->state.compare_exchange_weak(current, kAbsent, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    _table.add_size(-1);
+                    return 1;
+                }
+            }
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    uint64_t HashMapLockFree<Key, Value>::load(uint64_t word)
+    {
+        Table *t = _table.current();
+        size_t h = _table.hash(word);
+        for (;;)
+        {
+            Slot *slot = _table.lookup(t, word, h);
+            if (slot == nullptr)
+                return kAbsent;
+            uint64_t current = slot->state.load(std::memory_order_acquire);
+            if (current != kMoved)
+                return current;
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key, class Value>
+    Value HashMapLockFree<Key, Value>::find(const Key &key)
+    {
+        Value value = Value();
+        bool exsit = false;
+        find(key, value, exsit);
+        return value;
+    }
+
+    template <class Key, class Value>
+    void HashMapLockFree<Key, Value>::find(const Key &key, Value &value, bool &exsit)
+    {
+        uint64_t word = EncodeKey(key);
+        exsit = false;
+        if (word <= kMovedKey)
+            return;
+
+        typename Core::Guard guard(_table);
+        uint64_t current = load(word);
+        if (current != kAbsent)
+        {
+            exsit = true;
+            value = DecodeValue(current);
+        }
+    }
+
+    template <class Key, class Value>
+    size_t HashMapLockFree<Key, Value>::count(const Key &key)
+    {
+        bool exsit = false;
+        Value value;
+        find(key, value, exsit);
+        return exsit ? 1 : 0;
+    }
+
+    template <class Key, class Value>
+    size_t HashMapLockFree<Key, Value>::find_batch(const Key *keys, size_t n, Value *values, bool *exsit)
+    {
+        typename Core::Guard guard(_table);
+        size_t hits = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + Core::kPrefetch < n)
+            {
+                _table.prefetch(_table.current(), EncodeKey(keys[i + Core::kPrefetch]));
+            }
+            uint64_t word = EncodeKey(keys[i]);
+            uint64_t current = word > kMovedKey ? load(word) : kAbsent;
+            exsit[i] = current != kAbsent;
+            if (exsit[i])
+            {
+                values[i] = DecodeValue(current);
+                hits++;
+            }
+        }
+        return hits;
+    }
+
+} // namespace sunflower
+#endif // HASHMAPLOCKFREE_H
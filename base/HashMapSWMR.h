@@ -0,0 +1,400 @@
+#ifndef HASHMAPSWMR_H
+#define HASHMAPSWMR_H
+
+#include "EpochDomain.h"
+#include "Hash.h"
+#include "MmapAllocator.h"
+#include "Noncopyable.h"
+#include <atomic>
+#include <math.h>
+#include <new>
+#include <stdint.h>
+#include <utility>
+
+namespace sunflower
+{
+    /**
+     * HashMap for one writer and any number of lock-free readers.
+     * The writer publishes nodes and bucket arrays with release stores and
+     * never changes a published node's key or value: assign links in a copy,
+     * erase unlinks, both retire the old node through an EpochDomain.
+     * Rehash fills the second bucket array with copies of the nodes while
+     * readers keep walking the first, swaps the arrays and retires the old
+     * one with its nodes, so nodes keep the layout of HashMap and the map
+     * briefly holds every node twice.
+     * Readers do no RMW, a lookup is the chain walk of HashMap plus an epoch
+     * guard; a Reader holds one guard over many lookups and caches the
+     * bucket array, so they cost what HashMap lookups cost.
+     * Writer calls must not overlap, one thread or serialized by the caller.
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashMapSWMR : public Noncopyable
+    {
+    public:
+        class Node
+        {
+        public:
+            Node(const Key &key, const Value &value) : _k(key), _v(value) {}
+            const Key &k() const { return _k; }
+            const Value &v() const { return _v; }
+            Node *next() const { return _next.load(std::memory_order_acquire); }
+            void set_next(Node *next) { _next.store(next, std::memory_order_release); }
+
+        private:
+            Key _k;
+            Value _v;
+            std::atomic<Node *> _next{nullptr};
+        };
+
+    private:
+        struct Table;
+
+        // bucket array as last seen by a reader
+        struct View
+        {
+            const Table *table = nullptr;
+            const std::atomic<Node *> *heads = nullptr;
+            size_t mask = 0;
+        };
+
+    public:
+        /**
+         * Epoch guard held across lookups, keep it short-lived: it holds back
+         * every node and bucket array the writer retires meanwhile
+         */
+        class Reader : public Noncopyable
+        {
+        public:
+            explicit Reader(const HashMapSWMR &map) : _guard(map._domain), _map(map) {}
+
+            void find(const Key &key, Value &value, bool &exsit) const { _map.find_in(_view, key, value, exsit); }
+            size_t count(const Key &key) const { return _map.search(_view, key) ? 1 : 0; }
+
+        private:
+            EpochDomain::Guard _guard;
+            const HashMapSWMR &_map;
+            mutable View _view;
+        };
+
+        explicit HashMapSWMR(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
+        ~HashMapSWMR();
+
+        // Capacity
+        bool empty() const noexcept { return size() == 0; }
+        size_t size() const noexcept { return _numElements.load(std::memory_order_relaxed); }
+
+        // Modifiers, writer thread only
+        std::pair<Value, bool> insert(const Key &key, const Value &value);
+        // true if inserted, false if assigned
+        bool insert_or_assign(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void rehash(size_t capacity);
+        void clear();
+
+        // Lookup, any thread; each call pays a guard fence, loops go through reader()
+        Value find(const Key &key) const;
+        void find(const Key &key, Value &value, bool &exsit) const;
+        size_t count(const Key &key) const;
+        Reader reader() const { return Reader(*this); }
+
+        // Bucket interface
+        size_t bucket_count() const;
+        size_t bucket(const Key &key) const;
+
+        // Memory backing of the bucket array
+        MemoryInfo memory_info() const;
+
+    private:
+        struct Table
+        {
+            Table(size_t capacity, unsigned memFlags)
+                : capacity(capacity), mask(capacity - 1), alloc(memFlags)
+            {
+                heads = alloc.allocate(capacity);
+                for (size_t i = 0; i < capacity; i++)
+                {
+                    new (&heads[i]) std::atomic<Node *>(nullptr);
+                }
+            }
+            ~Table()
+            {
+                if (ownsNodes)
+                {
+                    for (size_t id = 0; id < capacity; id++)
+                    {
+                        Node *node = heads[id].load(std::memory_order_relaxed);
+                        while (node)
+                        {
+                            Node *next = node->next();
+                            delete node;
+                            node = next;
+                        }
+                    }
+                }
+                alloc.deallocate(heads, capacity);
+            }
+
+            size_t capacity;
+            size_t mask;
+            // set once retired by rehash or clear, the nodes go with it
+            bool ownsNodes = false;
+            MmapAllocator<std::atomic<Node *>> alloc;
+            std::atomic<Node *> *heads = nullptr;
+        };
+
+        const Node *search(View &view, const Key &key) const;
+        void find_in(View &view, const Key &key, Value &value, bool &exsit) const;
+        size_t next_capacity();
+
+    private:
+        mutable EpochDomain _domain;
+        std::atomic<Table *> _table{nullptr};
+        std::atomic<size_t> _numElements{0};
+        unsigned _memFlags = MEM_DEFAULT;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapSWMR<Key, Value, Hash, KeyEqual>::HashMapSWMR(size_t power, unsigned memFlags)
+        : _memFlags(memFlags)
+    {
+        ReseedHash(_hash);
+        _table.store(new Table(pow(2, power), _memFlags), std::memory_order_release);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapSWMR<Key, Value, Hash, KeyEqual>::~HashMapSWMR()
+    {
+        Table *t = _table.load(std::memory_order_acquire);
+        t->ownsNodes = true;
+        delete t;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSWMR<Key, Value, Hash, KeyEqual>::bucket_count() const
+    {
+        EpochDomain::Guard guard(_domain);
+        return _table.load(std::memory_order_acquire)->capacity;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSWMR<Key, Value, Hash, KeyEqual>::bucket(const Key &key) const
+    {
+        EpochDomain::Guard guard(_domain);
+        return _hash(key) & _table.load(std::memory_order_acquire)->mask;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    MemoryInfo HashMapSWMR<Key, Value, Hash, KeyEqual>::memory_info() const
+    {
+        EpochDomain::Guard guard(_domain);
+        return _table.load(std::memory_order_acquire)->alloc.info();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    const typename HashMapSWMR<Key, Value, Hash, KeyEqual>::Node *HashMapSWMR<Key, Value, Hash, KeyEqual>::search(View &view, const Key &key) const
+    {
+        // a predicted compare instead of loads the bucket address waits on
+        const Table *t = _table.load(std::memory_order_acquire);
+        if (t != view.table)
+        {
+            view.table = t;
+            view.heads = t->heads;
+            view.mask = t->mask;
+        }
+        const Node *node = view.heads[_hash(key) & view.mask].load(std::memory_order_acquire);
+
+        while (node)
+        {
+            if (_equal(key, node->k()))
+            {
+                return node;
+            }
+            node = node->next();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSWMR<Key, Value, Hash, KeyEqual>::find_in(View &view, const Key &key, Value &value, bool &exsit) const
+    {
+        const Node *node = search(view, key);
+        exsit = node != nullptr;
+        if (exsit)
+        {
+            value = node->v();
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    Value HashMapSWMR<Key, Value, Hash, KeyEqual>::find(const Key &key) const
+    {
+        EpochDomain::Guard guard(_domain);
+        View view;
+        const Node *node = search(view, key);
+        if (node)
+        {
+            return node->v();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSWMR<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit) const
+    {
+        EpochDomain::Guard guard(_domain);
+        View view;
+        find_in(view, key, value, exsit);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSWMR<Key, Value, Hash, KeyEqual>::count(const Key &key) const
+    {
+        EpochDomain::Guard guard(_domain);
+        View view;
+        return search(view, key) ? 1 : 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    std::pair<Value, bool> HashMapSWMR<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        Table *t = _table.load(std::memory_order_relaxed);
+        std::atomic<Node *> &head = t->heads[_hash(key) & t->mask];
+        Node *first = head.load(std::memory_order_relaxed);
+        Node *node = first;
+
+        while (node)
+        {
+            if (_equal(key, node->k()))
+            {
+                return std::make_pair(node->v(), false);
+            }
+            node = node->next();
+        }
+
+        Node *newNode = new Node(key, value);
+        newNode->set_next(first);
+        // publishes the node's contents too
+        head.store(newNode, std::memory_order_release);
+        size_t n = _numElements.load(std::memory_order_relaxed) + 1;
+        _numElements.store(n, std::memory_order_relaxed);
+
+        if (n >= t->capacity)
+        {
+            rehash(next_capacity());
+        }
+        return std::make_pair(value, true);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool HashMapSWMR<Key, Value, Hash, KeyEqual>::insert_or_assign(const Key &key, const Value &value)
+    {
+        Table *t = _table.load(std::memory_order_relaxed);
+        std::atomic<Node *> &head = t->heads[_hash(key) & t->mask];
+        Node *node = head.load(std::memory_order_relaxed);
+        Node *prev = nullptr;
+
+        while (node)
+        {
+            if (_equal(key, node->k()))
+            {
+                // readers see the old node or the copy, never a torn value
+                Node *copy = new Node(key, value);
+                copy->set_next(node->next());
+                if (prev)
+                {
+                    prev->set_next(copy);
+                }
+                else
+                {
+                    head.store(copy, std::memory_order_release);
+                }
+                _domain.Retire(node);
+                return false;
+            }
+            prev = node;
+            node = node->next();
+        }
+
+        insert(key, value);
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSWMR<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    {
+        Table *t = _table.load(std::memory_order_relaxed);
+        std::atomic<Node *> &head = t->heads[_hash(key) & t->mask];
+        Node *node = head.load(std::memory_order_relaxed);
+        Node *prev = nullptr;
+
+        while (node)
+        {
+            if (_equal(key, node->k()))
+            {
+                // a reader standing on node still finds the rest of the chain
+                Node *next = node->next();
+                if (prev)
+                {
+                    prev->set_next(next);
+                }
+                else
+                {
+                    head.store(next, std::memory_order_release);
+                }
+                _domain.Retire(node);
+                _numElements.store(_numElements.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                return 1;
+            }
+            prev = node;
+            node = node->next();
+        }
+        return 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSWMR<Key, Value, Hash, KeyEqual>::next_capacity()
+    {
+        return 2 * _table.load(std::memory_order_relaxed)->capacity;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSWMR<Key, Value, Hash, KeyEqual>::rehash(size_t capacity)
+    {
+        Table *t = _table.load(std::memory_order_relaxed);
+        if (t->capacity == capacity)
+            return;
+
+        // readers may be anywhere in the old chains, they stay untouched
+        Table *next = new Table(capacity, _memFlags);
+        for (size_t id = 0; id < t->capacity; id++)
+        {
+            Node *node = t->heads[id].load(std::memory_order_relaxed);
+            while (node)
+            {
+                std::atomic<Node *> &head = next->heads[_hash(node->k()) & next->mask];
+                Node *copy = new Node(node->k(), node->v());
+                copy->set_next(head.load(std::memory_order_relaxed));
+                head.store(copy, std::memory_order_relaxed);
+                node = node->next();
+            }
+        }
+        _table.store(next, std::memory_order_release);
+        t->ownsNodes = true;
+        _domain.Retire(t);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSWMR<Key, Value, Hash, KeyEqual>::clear()
+    {
+        if (size() == 0)
+            return;
+        Table *t = _table.load(std::memory_order_relaxed);
+        _table.store(new Table(t->capacity, _memFlags), std::memory_order_release);
+        _numElements.store(0, std::memory_order_relaxed);
+        t->ownsNodes = true;
+        _domain.Retire(t);
+    }
+} // namespace sunflower
+#endif // HASHMAPSWMR_H
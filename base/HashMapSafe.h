@@ -1,7 +1,13 @@
 #ifndef HASHMAPSAFE_H
 #define HASHMAPSAFE_H
 
+#include "ChangeFeed.h"
+#include "EpochDomain.h"
+#include "Hash.h"
+#include "HotKeyDetector.h"
+#include "MmapAllocator.h"
 #include "Noncopyable.h"
+#include <algorithm>
 #include <atomic>
 #include <list>
 #include <math.h>
@@ -10,9 +16,6 @@
 #include <stdint.h>
 #include <string.h>
 #include <vector>
-#ifndef POS_MOD_BASE
-#define POS_MOD_BASE(x) (x & _mask)
-#endif
 namespace sunflower
 {
     template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
@@ -39,7 +42,8 @@ namespace sunflower
             Value _v;
             Node *_next = nullptr;
         };
-        explicit HashMapSafe(size_t power = 20);
+        // buckets share 2^min(power, lockPower) striped mutexes
+        explicit HashMapSafe(size_t power = 20, unsigned memFlags = MEM_DEFAULT, size_t lockPower = 20);
         ~HashMapSafe();
 
         // Capacity
@@ -48,6 +52,8 @@ namespace sunflower
 
         // Modifiers
         std::pair<Value, bool> insert(const Key &key, const Value &value);
+        // true if inserted, false if an existing value was replaced
+        bool insert_or_assign(const Key &key, const Value &value);
         size_t erase(const Key &key);
         void clear();
 
@@ -55,100 +61,282 @@ namespace sunflower
         Value find(const Key &key);
         void find(const Key &key, Value &value, bool &exsit);
         size_t count(const Key &key);
+        // fn(key, value) for every element, one stripe locked at a time,
+        // so not a point in time view while writers run. A re-seed meanwhile
+        // restarts the walk, fn may then see a key twice.
+        template <class Fn>
+        void for_each(Fn fn);
+
+        // Batch, keys are grouped by lock stripe and every stripe is locked once.
+        // Per-key results go to the output arrays, returns the number of hits.
+        size_t insert_batch(const Key *keys, const Value *values, size_t n, bool *inserted);
+        size_t erase_batch(const Key *keys, size_t n, bool *erased);
+        size_t find_batch(const Key *keys, size_t n, Value *values, bool *exsit);
 
         // Bucket interface
         size_t bucket_count() const { return _capacity; }
         size_t bucket(const Key &key) const;
+        size_t stripe_count() const { return _vecMutex.size(); }
+
+        // Seeding, a chain longer than max_chain re-seeds a seedable Hash
+        // (see Hash.h) and rebuilds the table under all stripes, 0 disables it.
+        // Set before the map is shared.
+        void set_max_chain(size_t maxChain) { _maxChain = maxChain; }
+        size_t max_chain() const { return _maxChain; }
+        size_t reseed_count() const { return _reseeds.load(); }
+
+        // Hot key sampling, every operation offers its key to detector which
+        // samples a fraction of them, nullptr switches it off
+        void set_hot_key_detector(HotKeyDetector<Key, Hash, KeyEqual> *detector) { _hotKeys.store(detector, std::memory_order_release); }
+        HotKeyDetector<Key, Hash, KeyEqual> *hot_key_detector() const { return _hotKeys.load(std::memory_order_acquire); }
+
+        // Change data capture, every modification is published to feed
+        // (see ChangeFeed.h), nullptr switches it off. Destroying the map
+        // publishes nothing, the feed may go first
+        void set_change_feed(ChangeFeed<Key, Value> *feed) { _changeFeed.store(feed, std::memory_order_release); }
+        ChangeFeed<Key, Value> *change_feed() const { return _changeFeed.load(std::memory_order_acquire); }
+
+        // Memory backing of the bucket array
+        MemoryInfo memory_info() const { return _bucket.get_allocator().info(); }
 
     private:
-        std::vector<Node *> _bucket;
+        std::mutex &stripe_mutex(size_t id) { return *_vecMutex[id & _lockMask]; }
+        std::unique_lock<std::mutex> lock_bucket(const Key &key, size_t &id);
+        // only a seeded Hash is ever re-seeded, the others hash through
+        // _hash with no guard, no indirection and nothing to re-check
+        const Hash *hasher() const
+        {
+            if constexpr (IsSeededHash<Hash>::value)
+                return _hasher.load(std::memory_order_acquire);
+            else
+                return &_hash;
+        }
+        class HasherGuard : public Noncopyable
+        {
+        public:
+            explicit HasherGuard(const HashMapSafe &map) : _domain(map._domain)
+            {
+                if constexpr (IsSeededHash<Hash>::value)
+                    _domain.Enter();
+            }
+            ~HasherGuard()
+            {
+                if constexpr (IsSeededHash<Hash>::value)
+                    _domain.Leave();
+            }
+
+        private:
+            EpochDomain &_domain;
+        };
+        void check_chain(size_t chain);
+        // single key bodies, the caller holds the stripe lock of id
+        Node *insert_unlocked(size_t id, const Key &key, const Value &value, size_t &chain, bool &inserted);
+        bool erase_unlocked(size_t id, const Key &key);
+        Node *find_unlocked(size_t id, const Key &key);
+        template <class Fn>
+        size_t for_each_stripe(const Key *keys, size_t n, Fn fn);
+        void record_hot(const Key &key)
+        {
+            if (auto detector = _hotKeys.load(std::memory_order_relaxed))
+                detector->record(key);
+        }
+        // under the stripe lock of key
+        void publish(ChangeType type, const Key &key, const Value &value)
+        {
+            if (auto feed = _changeFeed.load(std::memory_order_acquire))
+                feed->publish(type, key, value);
+        }
+
+    private:
+        std::vector<Node *, MmapAllocator<Node *>> _bucket;
         std::vector<std::unique_ptr<std::mutex>> _vecMutex;
         std::atomic<size_t> _numElements;
         size_t _capacity = 0;
         size_t _mask = 0;
+        size_t _lockMask = 0;
+        size_t _maxChain = 32;
+        std::atomic<size_t> _reseedAt{0};
+        std::atomic<size_t> _reseeds{0};
         Hash _hash;
+        // current seeded hasher, replaced on re-seed; a thread hashes outside
+        // the stripe lock inside a guard, so the old one is retired to _domain
+        std::atomic<Hash *> _hasher{nullptr};
+        mutable EpochDomain _domain;
         KeyEqual _equal;
+        std::atomic<HotKeyDetector<Key, Hash, KeyEqual> *> _hotKeys{nullptr};
+        std::atomic<ChangeFeed<Key, Value> *> _changeFeed{nullptr};
     };
     template <class Key, class Value, class Hash, class KeyEqual>
-    HashMapSafe<Key, Value, Hash, KeyEqual>::HashMapSafe(size_t power) : _numElements(0)
+    HashMapSafe<Key, Value, Hash, KeyEqual>::HashMapSafe(size_t power, unsigned memFlags, size_t lockPower)
+        : _bucket(MmapAllocator<Node *>(memFlags)), _numElements(0)
     {
         _capacity = pow(2, power);
         _mask = _capacity - 1;
         _bucket.resize(_capacity);
-        _vecMutex.resize(_capacity);
+        _vecMutex.resize(pow(2, std::min(power, lockPower)));
+        _lockMask = _vecMutex.size() - 1;
 
-        for (uint32_t i = 0; i < _capacity; i++)
+        for (uint32_t i = 0; i < _vecMutex.size(); i++)
         {
             _vecMutex[i] = std::make_unique<std::mutex>();
         }
+
+        if constexpr (IsSeededHash<Hash>::value)
+        {
+            Hash *hash = new Hash(_hash);
+            ReseedHash(*hash);
+            _hasher.store(hash);
+        }
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
     HashMapSafe<Key, Value, Hash, KeyEqual>::~HashMapSafe()
     {
-        clear();
+        // not clear(): tearing the map down publishes no ERASE events,
+        // replicas keep their copy and the feed may already be gone
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            auto node = _bucket[id];
+            while (node)
+            {
+                Node *curr = node;
+                node = node->next();
+                delete curr;
+            }
+        }
+        delete _hasher.load();
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
     size_t HashMapSafe<Key, Value, Hash, KeyEqual>::bucket(const Key &key) const
     {
-        return POS_MOD_BASE(_hash(key));
+        HasherGuard guard(*this);
+        return (*hasher())(key) & _mask;
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
-    std::pair<Value, bool> HashMapSafe<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    std::unique_lock<std::mutex> HashMapSafe<Key, Value, Hash, KeyEqual>::lock_bucket(const Key &key, size_t &id)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
-        auto head = _bucket[id];
-        auto node = head;
-
-        while (node)
+        record_hot(key);
+        if constexpr (!IsSeededHash<Hash>::value)
         {
-            if (_equal(key, node->k()))
+            id = _hash(key) & _mask;
+            return std::unique_lock<std::mutex>(stripe_mutex(id));
+        }
+        // until the hasher is checked under the stripe lock, a re-seed cannot free it
+        EpochDomain::Guard guard(_domain);
+        while (true)
+        {
+            Hash *hash = _hasher.load(std::memory_order_acquire);
+            id = (*hash)(key) & _mask;
+            std::unique_lock<std::mutex> lck(stripe_mutex(id));
+            // a re-seed holds every stripe, so this is stable until unlock
+            if (_hasher.load(std::memory_order_relaxed) == hash)
             {
-                return std::make_pair<Value, bool>(std::move(node->v()), false);
+                return lck;
             }
-            node = node->next();
         }
-
-        Node *newNode = new Node(key, value, head);
-        _bucket[id] = newNode;
-        _numElements++;
-        return std::make_pair<Value, bool>(std::move(newNode->v()), true);
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
-    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    void HashMapSafe<Key, Value, Hash, KeyEqual>::check_chain(size_t chain)
     {
-        size_t id = bucket(key);
-        Node *prev = nullptr;
+        // the table never grows, an overloaded one has long chains whatever the seed
+        if (!IsSeededHash<Hash>::value || _maxChain == 0 || chain < _maxChain + 2 * (_numElements / _capacity))
+            return;
 
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
+        // at most one re-seed per doubling of the element count, a hash that
+        // collides whatever the seed cannot turn every insert into a rebuild;
+        // checked before stopping the world and again once it is stopped
+        if (_numElements < 2 * _reseedAt.load(std::memory_order_relaxed))
+            return;
 
-        auto node = _bucket[id];
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(_vecMutex.size());
+        for (auto &m : _vecMutex)
+        {
+            locks.emplace_back(*m);
+        }
 
-        while (node)
+        if (_numElements < 2 * _reseedAt.load(std::memory_order_relaxed))
+            return;
+
+        Hash *old = _hasher.load();
+        Hash *hash = new Hash(*old);
+        ReseedHash(*hash);
+
+        std::vector<Node *, MmapAllocator<Node *>> fresh(_capacity, nullptr, _bucket.get_allocator());
+        for (size_t id = 0; id < _capacity; id++)
         {
-            if (_equal(key, node->k()))
+            auto node = _bucket[id];
+            while (node)
             {
-                if (prev)
-                {
-                    prev->set_next(node->next());
-                }
-                else
-                {
-                    _bucket[id] = node->next();
-                }
-                delete node;
-                _numElements--;
-                return 1;
+                Node *next = node->next();
+                size_t new_id = (*hash)(node->k()) & _mask;
+                node->set_next(fresh[new_id]);
+                fresh[new_id] = node;
+                node = next;
             }
-            prev = node;
-            node = node->next();
         }
-        return 0;
+        _bucket.swap(fresh);
+        _hasher.store(hash, std::memory_order_release);
+        _reseedAt.store(_numElements, std::memory_order_relaxed);
+        _reseeds++;
+        // shared, so the next Collect of any thread may free it; one pass
+        // advances the epoch once and old is free two epochs on
+        _domain.RetireShared(old, [](void *p)
+                             { delete static_cast<Hash *>(p); });
+        locks.clear();
+        _domain.Collect();
+        _domain.Collect();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    std::pair<Value, bool> HashMapSafe<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        size_t id = 0;
+        size_t chain = 0;
+        bool inserted = false;
+        auto lck = lock_bucket(key, id);
+
+        Node *node = insert_unlocked(id, key, value, chain, inserted);
+        std::pair<Value, bool> ret(node->v(), inserted);
+        lck.unlock();
+
+        if (inserted)
+        {
+            check_chain(chain);
+        }
+        return ret;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool HashMapSafe<Key, Value, Hash, KeyEqual>::insert_or_assign(const Key &key, const Value &value)
+    {
+        size_t id = 0;
+        size_t chain = 0;
+        bool inserted = false;
+        auto lck = lock_bucket(key, id);
+
+        Node *node = insert_unlocked(id, key, value, chain, inserted);
+        if (not inserted)
+        {
+            node->v() = value;
+            publish(ChangeType::UPDATE, key, value);
+            return false;
+        }
+        lck.unlock();
+
+        check_chain(chain);
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    {
+        size_t id = 0;
+        auto lck = lock_bucket(key, id);
+        return erase_unlocked(id, key) ? 1 : 0;
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
@@ -158,12 +346,13 @@ namespace sunflower
             return;
         for (size_t id = 0; id < _capacity; id++)
         {
-            std::lock_guard<std::mutex> lck(*_vecMutex[id]);
+            std::lock_guard<std::mutex> lck(stripe_mutex(id));
             auto node = _bucket[id];
             while (node)
             {
                 Node *curr = node;
                 node = node->next();
+                publish(ChangeType::ERASE, curr->k(), curr->v());
                 delete curr;
             }
             _bucket[id] = nullptr;
@@ -174,61 +363,229 @@ namespace sunflower
     template <class Key, class Value, class Hash, class KeyEqual>
     Value HashMapSafe<Key, Value, Hash, KeyEqual>::find(const Key &key)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
+        size_t id = 0;
+        auto lck = lock_bucket(key, id);
 
-        auto node = _bucket[id];
+        Node *node = find_unlocked(id, key);
+        if (node)
+        {
+            return node->v();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSafe<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit)
+    {
+        size_t id = 0;
+        auto lck = lock_bucket(key, id);
+
+        Node *node = find_unlocked(id, key);
+        exsit = node != nullptr;
+        if (node)
+        {
+            value = node->v();
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::count(const Key &key)
+    {
+        size_t id = 0;
+        auto lck = lock_bucket(key, id);
+        return find_unlocked(id, key) ? 1 : 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Fn>
+    void HashMapSafe<Key, Value, Hash, KeyEqual>::for_each(Fn fn)
+    {
+        // keeps hash from being freed and its address reused by a later hasher
+        HasherGuard guard(*this);
+        const Hash *hash = hasher();
+        size_t stripe = 0;
+        while (stripe <= _lockMask)
+        {
+            std::lock_guard<std::mutex> lck(*_vecMutex[stripe]);
+            if (hasher() != hash)
+            {
+                // keys moved between stripes
+                hash = hasher();
+                stripe = 0;
+                continue;
+            }
+            for (size_t id = stripe; id < _capacity; id += _lockMask + 1)
+            {
+                for (auto node = _bucket[id]; node; node = node->next())
+                {
+                    fn(node->k(), node->v());
+                }
+            }
+            stripe++;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    typename HashMapSafe<Key, Value, Hash, KeyEqual>::Node *HashMapSafe<Key, Value, Hash, KeyEqual>::insert_unlocked(size_t id, const Key &key, const Value &value, size_t &chain, bool &inserted)
+    {
+        auto head = _bucket[id];
+        auto node = head;
+        size_t length = 0;
 
         while (node)
         {
             if (_equal(key, node->k()))
             {
-                return node->v();
+                inserted = false;
+                return node;
             }
             node = node->next();
+            length++;
         }
-        return nullptr;
+        chain = std::max(chain, length);
+
+        _bucket[id] = new Node(key, value, head);
+        _numElements++;
+        publish(ChangeType::INSERT, key, value);
+        inserted = true;
+        return _bucket[id];
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
-    void HashMapSafe<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit)
+    bool HashMapSafe<Key, Value, Hash, KeyEqual>::erase_unlocked(size_t id, const Key &key)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
         auto node = _bucket[id];
+        Node *prev = nullptr;
 
         while (node)
         {
             if (_equal(key, node->k()))
             {
-                exsit = true;
-                // auto node->v
-                value = node->v();
-                return;
+                if (prev)
+                {
+                    prev->set_next(node->next());
+                }
+                else
+                {
+                    _bucket[id] = node->next();
+                }
+                publish(ChangeType::ERASE, node->k(), node->v());
+                delete node;
+                _numElements--;
+                return true;
             }
+            prev = node;
             node = node->next();
         }
-        exsit = false;
+        return false;
     }
 
     template <class Key, class Value, class Hash, class KeyEqual>
-    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::count(const Key &key)
+    typename HashMapSafe<Key, Value, Hash, KeyEqual>::Node *HashMapSafe<Key, Value, Hash, KeyEqual>::find_unlocked(size_t id, const Key &key)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
         auto node = _bucket[id];
 
         while (node)
         {
             if (_equal(key, node->k()))
             {
-                return 1;
+                return node;
             }
             node = node->next();
         }
-        return 0;
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Fn>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::for_each_stripe(const Key *keys, size_t n, Fn fn)
+    {
+        // (bucket id, key index), reused across batches of this thread
+        static thread_local std::vector<std::pair<size_t, size_t>> order;
+        static thread_local std::vector<size_t> hashes;
+        HasherGuard guard(*this);
+        const Hash *hash = nullptr;
+        size_t lockMask = _lockMask;
+        // group keys [from, n) by stripe, keep the batch order inside a stripe for duplicate keys
+        auto group = [&](size_t from)
+        {
+            hash = hasher();
+            if (from == 0)
+            {
+                HashBatch(*hash, keys, n, hashes.data());
+            }
+            for (size_t i = from; i < n; i++)
+            {
+                size_t index = from == 0 ? i : order[i].second;
+                order[i] = std::make_pair((from == 0 ? hashes[i] : (*hash)(keys[index])) & _mask, index);
+            }
+            std::sort(order.begin() + from, order.end(), [lockMask](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b)
+                      {
+                          size_t sa = a.first & lockMask, sb = b.first & lockMask;
+                          return sa < sb || (sa == sb && a.second < b.second);
+                      });
+        };
+        for (size_t i = 0; i < n; i++)
+        {
+            record_hot(keys[i]);
+        }
+        order.resize(n);
+        hashes.resize(n);
+        group(0);
+
+        size_t hits = 0;
+        size_t i = 0;
+        while (i < n)
+        {
+            size_t stripe = order[i].first & _lockMask;
+            std::unique_lock<std::mutex> lck(*_vecMutex[stripe]);
+            if (hasher() != hash)
+            {
+                // re-seeded meanwhile
+                lck.unlock();
+                group(i);
+                continue;
+            }
+            for (; i < n && (order[i].first & _lockMask) == stripe; i++)
+            {
+                hits += fn(order[i].first, order[i].second);
+            }
+        }
+        return hits;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::insert_batch(const Key *keys, const Value *values, size_t n, bool *inserted)
+    {
+        size_t chain = 0;
+        size_t hits = for_each_stripe(keys, n, [&](size_t id, size_t i)
+                                      {
+                                          insert_unlocked(id, keys[i], values[i], chain, inserted[i]);
+                                          return inserted[i];
+                                      });
+        check_chain(chain);
+        return hits;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::erase_batch(const Key *keys, size_t n, bool *erased)
+    {
+        return for_each_stripe(keys, n, [&](size_t id, size_t i)
+                               { return erased[i] = erase_unlocked(id, keys[i]); });
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSafe<Key, Value, Hash, KeyEqual>::find_batch(const Key *keys, size_t n, Value *values, bool *exsit)
+    {
+        return for_each_stripe(keys, n, [&](size_t id, size_t i)
+                               {
+                                   Node *node = find_unlocked(id, keys[i]);
+                                   if (node)
+                                   {
+                                       values[i] = node->v();
+                                   }
+                                   return exsit[i] = node != nullptr;
+                               });
     }
 } // namespace sunflower
 #endif // HASHMAPSAFE_H
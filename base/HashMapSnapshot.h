@@ -0,0 +1,496 @@
+#ifndef HASHMAPSNAPSHOT_H
+#define HASHMAPSNAPSHOT_H
+
+#include "EpochDomain.h"
+#include "Hash.h"
+#include "Noncopyable.h"
+#include <atomic>
+#include <math.h>
+#include <mutex>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Read-mostly map built from immutable versions.
+     * Readers load the current version with one atomic load inside an epoch
+     * guard and never lock. Writers serialize on a mutex, copy only the
+     * buckets they touch, share the others with the previous version by
+     * reference count and publish the new version atomically. Replaced
+     * versions are freed by the epoch domain once their readers are gone:
+     * the writer collects right after publishing, and a reader that saw a
+     * version replaced while it held it collects when it lets go.
+     * Every write copies the bucket pointer array, batch changes with update().
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashMapSnapshot : public Noncopyable
+    {
+    public:
+        using value_type = std::pair<Key, Value>;
+
+    private:
+        struct Bucket
+        {
+            std::atomic<size_t> refs{1};
+            std::vector<value_type> items;
+        };
+
+        struct Version
+        {
+            uint64_t seq = 0;
+            size_t capacity = 0;
+            size_t mask = 0;
+            size_t numElements = 0;
+            std::vector<Bucket *> buckets;
+        };
+
+        // Epoch guard on the current version, the reader that drops the
+        // last pin on a replaced version frees it
+        class Pin : public Noncopyable
+        {
+        public:
+            explicit Pin(const HashMapSnapshot &map) : _map(map)
+            {
+                _map._domain.Enter();
+                _version = _map._current.load(std::memory_order_acquire);
+            }
+
+            ~Pin()
+            {
+                _map._domain.Leave();
+                if (_map._current.load(std::memory_order_relaxed) != _version)
+                {
+                    _map.reclaim();
+                }
+            }
+
+            const Version *version() const { return _version; }
+
+        private:
+            const HashMapSnapshot &_map;
+            const Version *_version;
+        };
+
+    public:
+        /**
+         * Pinned version for several consistent reads, holds an epoch guard
+         * so keep it short-lived
+         */
+        class Snapshot : public Noncopyable
+        {
+        public:
+            Snapshot(const HashMapSnapshot &map) : _pin(map), _map(map), _version(_pin.version()) {}
+
+            bool empty() const noexcept { return _version->numElements == 0; }
+            size_t size() const noexcept { return _version->numElements; }
+            uint64_t version() const { return _version->seq; }
+            void find(const Key &key, Value &value, bool &exsit) const { _map.find_in(_version, key, value, exsit); }
+            size_t count(const Key &key) const;
+            template <class Fn>
+            void for_each(Fn fn) const;
+
+        private:
+            Pin _pin;
+            const HashMapSnapshot &_map;
+            const Version *_version;
+        };
+
+        /**
+         * Pending changes of one update(), applied to the private copy of
+         * the next version
+         */
+        class Builder : public Noncopyable
+        {
+        public:
+            bool insert(const Key &key, const Value &value) { return _map.put(_next, key, value, false); }
+            bool insert_or_assign(const Key &key, const Value &value) { return _map.put(_next, key, value, true); }
+            size_t erase(const Key &key) { return _map.remove(_next, key); }
+            void clear() { _map.reset(_next); }
+            size_t size() const { return _next->numElements; }
+
+        private:
+            friend class HashMapSnapshot;
+            Builder(HashMapSnapshot &map, Version *next) : _map(map), _next(next) {}
+
+            HashMapSnapshot &_map;
+            Version *_next;
+        };
+
+        explicit HashMapSnapshot(size_t power = 10);
+        ~HashMapSnapshot();
+
+        // Capacity
+        bool empty() const noexcept { return size() == 0; }
+        size_t size() const noexcept;
+        uint64_t version() const;
+
+        // Modifiers, each one publishes a version
+        bool insert(const Key &key, const Value &value);
+        bool insert_or_assign(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void clear();
+        // fn(Builder &) batches any number of changes into one version
+        template <class Fn>
+        void update(Fn fn);
+
+        // Lookup, wait-free
+        void find(const Key &key, Value &value, bool &exsit) const;
+        size_t count(const Key &key) const;
+        Snapshot snapshot() const { return Snapshot(*this); }
+
+        // Bucket interface
+        size_t bucket_count() const;
+        size_t bucket(const Key &key) const;
+
+    private:
+        const Bucket *lookup(const Version *version, const Key &key, size_t &index) const;
+        void find_in(const Version *version, const Key &key, Value &value, bool &exsit) const;
+        Bucket *own(Version *next, size_t id);
+        bool put(Version *next, const Key &key, const Value &value, bool assign);
+        size_t remove(Version *next, const Key &key);
+        void reset(Version *next);
+        void grow(Version *next);
+        Version *copy_version(const Version *version);
+        void publish(Version *next);
+        void reclaim() const;
+        static void unref(Bucket *bucket);
+        static void free_version(void *ptr);
+
+    private:
+        mutable EpochDomain _domain;
+        std::atomic<Version *> _current{nullptr};
+        std::mutex _writeMutex = {};
+        // buckets already copied for the version under construction
+        std::vector<bool> _owned;
+        bool _changed = false;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapSnapshot<Key, Value, Hash, KeyEqual>::HashMapSnapshot(size_t power)
+    {
+        ReseedHash(_hash);
+        Version *version = new Version;
+        version->capacity = pow(2, power);
+        version->mask = version->capacity - 1;
+        version->buckets.resize(version->capacity, nullptr);
+        _current.store(version);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    HashMapSnapshot<Key, Value, Hash, KeyEqual>::~HashMapSnapshot()
+    {
+        free_version(_current.load());
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::size() const noexcept
+    {
+        Pin pin(*this);
+        return pin.version()->numElements;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    uint64_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::version() const
+    {
+        Pin pin(*this);
+        return pin.version()->seq;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::bucket_count() const
+    {
+        Pin pin(*this);
+        return pin.version()->capacity;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::bucket(const Key &key) const
+    {
+        Pin pin(*this);
+        return _hash(key) & pin.version()->mask;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    const typename HashMapSnapshot<Key, Value, Hash, KeyEqual>::Bucket *
+    HashMapSnapshot<Key, Value, Hash, KeyEqual>::lookup(const Version *version, const Key &key, size_t &index) const
+    {
+        const Bucket *bucket = version->buckets[_hash(key) & version->mask];
+        if (bucket == nullptr)
+        {
+            return nullptr;
+        }
+        for (index = 0; index < bucket->items.size(); index++)
+        {
+            if (_equal(key, bucket->items[index].first))
+            {
+                return bucket;
+            }
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::find_in(const Version *version, const Key &key, Value &value, bool &exsit) const
+    {
+        size_t index = 0;
+        const Bucket *bucket = lookup(version, key, index);
+        exsit = bucket != nullptr;
+        if (exsit)
+        {
+            value = bucket->items[index].second;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit) const
+    {
+        Pin pin(*this);
+        find_in(pin.version(), key, value, exsit);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::count(const Key &key) const
+    {
+        Pin pin(*this);
+        size_t index = 0;
+        return lookup(pin.version(), key, index) ? 1 : 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::Snapshot::count(const Key &key) const
+    {
+        size_t index = 0;
+        return _map.lookup(_version, key, index) ? 1 : 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Fn>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::Snapshot::for_each(Fn fn) const
+    {
+        for (const Bucket *bucket : _version->buckets)
+        {
+            if (bucket == nullptr)
+                continue;
+            for (const value_type &item : bucket->items)
+            {
+                fn(item.first, item.second);
+            }
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    typename HashMapSnapshot<Key, Value, Hash, KeyEqual>::Version *
+    HashMapSnapshot<Key, Value, Hash, KeyEqual>::copy_version(const Version *version)
+    {
+        // shares every bucket, own() copies one before it is changed
+        Version *next = new Version;
+        next->seq = version->seq + 1;
+        next->capacity = version->capacity;
+        next->mask = version->mask;
+        next->numElements = version->numElements;
+        next->buckets = version->buckets;
+        for (Bucket *bucket : next->buckets)
+        {
+            if (bucket)
+                bucket->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        _owned.assign(next->capacity, false);
+        _changed = false;
+        return next;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    typename HashMapSnapshot<Key, Value, Hash, KeyEqual>::Bucket *
+    HashMapSnapshot<Key, Value, Hash, KeyEqual>::own(Version *next, size_t id)
+    {
+        Bucket *bucket = next->buckets[id];
+        if (_owned[id])
+        {
+            return bucket;
+        }
+        Bucket *copy = new Bucket;
+        if (bucket)
+        {
+            copy->items = bucket->items;
+            unref(bucket);
+        }
+        next->buckets[id] = copy;
+        _owned[id] = true;
+        _changed = true;
+        return copy;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool HashMapSnapshot<Key, Value, Hash, KeyEqual>::put(Version *next, const Key &key, const Value &value, bool assign)
+    {
+        size_t index = 0;
+        size_t id = _hash(key) & next->mask;
+        if (lookup(next, key, index))
+        {
+            if (assign)
+            {
+                own(next, id)->items[index].second = value;
+            }
+            return false;
+        }
+
+        own(next, id)->items.emplace_back(key, value);
+        next->numElements++;
+        if (next->numElements > next->capacity)
+        {
+            grow(next);
+        }
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::remove(Version *next, const Key &key)
+    {
+        size_t index = 0;
+        size_t id = _hash(key) & next->mask;
+        if (lookup(next, key, index) == nullptr)
+        {
+            return 0;
+        }
+        auto &items = own(next, id)->items;
+        items[index] = std::move(items.back());
+        items.pop_back();
+        next->numElements--;
+        return 1;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::reset(Version *next)
+    {
+        for (Bucket *&bucket : next->buckets)
+        {
+            if (bucket)
+                unref(bucket);
+            bucket = nullptr;
+        }
+        _owned.assign(next->capacity, false);
+        _changed = true;
+        next->numElements = 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::grow(Version *next)
+    {
+        // nothing can be shared across a resize, every bucket is rebuilt
+        std::vector<Bucket *> old;
+        old.swap(next->buckets);
+        next->capacity *= 2;
+        next->mask = next->capacity - 1;
+        next->buckets.assign(next->capacity, nullptr);
+        for (Bucket *bucket : old)
+        {
+            if (bucket == nullptr)
+                continue;
+            for (const value_type &item : bucket->items)
+            {
+                Bucket *&dst = next->buckets[_hash(item.first) & next->mask];
+                if (dst == nullptr)
+                    dst = new Bucket;
+                dst->items.push_back(item);
+            }
+            unref(bucket);
+        }
+        _owned.assign(next->capacity, true);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::publish(Version *next)
+    {
+        Version *prev = _current.exchange(next, std::memory_order_acq_rel);
+        // shared, so whichever reader lets go of prev last can free it
+        _domain.RetireShared(prev, free_version);
+        reclaim();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::reclaim() const
+    {
+        // a version retired at epoch e is freed at e+2, each pass advances one
+        _domain.Collect();
+        _domain.Collect();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::unref(Bucket *bucket)
+    {
+        if (bucket->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete bucket;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::free_version(void *ptr)
+    {
+        Version *version = static_cast<Version *>(ptr);
+        for (Bucket *bucket : version->buckets)
+        {
+            if (bucket)
+                unref(bucket);
+        }
+        delete version;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    template <class Fn>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::update(Fn fn)
+    {
+        std::lock_guard<std::mutex> lck(_writeMutex);
+        Version *next = copy_version(_current.load(std::memory_order_relaxed));
+        Builder builder(*this, next);
+        fn(builder);
+        if (_changed)
+        {
+            publish(next);
+        }
+        else
+        {
+            // never visible to readers, no version bump for a no-op
+            free_version(next);
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool HashMapSnapshot<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        bool inserted = false;
+        update([&](Builder &builder)
+               { inserted = builder.insert(key, value); });
+        return inserted;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool HashMapSnapshot<Key, Value, Hash, KeyEqual>::insert_or_assign(const Key &key, const Value &value)
+    {
+        bool inserted = false;
+        update([&](Builder &builder)
+               { inserted = builder.insert_or_assign(key, value); });
+        return inserted;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t HashMapSnapshot<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    {
+        size_t erased = 0;
+        update([&](Builder &builder)
+               { erased = builder.erase(key); });
+        return erased;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void HashMapSnapshot<Key, Value, Hash, KeyEqual>::clear()
+    {
+        update([](Builder &builder)
+               { builder.clear(); });
+    }
+} // namespace sunflower
+#endif // HASHMAPSNAPSHOT_H
@@ -1,6 +1,7 @@
 #ifndef HASHSET_H
 #define HASHSET_H
 
+#include "MmapAllocator.h"
 #include "Noncopyable.h"
 #include <atomic>
 #include <list>
@@ -10,9 +11,6 @@
 #include <stdint.h>
 #include <string.h>
 #include <vector>
-#ifndef POS_MOD_BASE
-#define POS_MOD_BASE(x) (x & _mask)
-#endif
 namespace sunflower
 {
     template <class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
@@ -32,7 +30,7 @@ namespace sunflower
             Key _k;
             Node *_next = nullptr;
         };
-        explicit HashSet(size_t power = 20);
+        explicit HashSet(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
         ~HashSet() { clear(); }
 
         // Capacity
@@ -54,12 +52,17 @@ namespace sunflower
         size_t bucket_count() const { return _capacity; }
         size_t bucket(const Key &key) const;
 
+        // Memory backing of the bucket array
+        MemoryInfo memory_info() const { return _bucket[_lastest].get_allocator().info(); }
+
     private:
+        using BucketVector = std::vector<Node *, MmapAllocator<Node *>>;
+
         size_t next_capacity();
 
     private:
         // lastest bucket and old bucket for rehash
-        std::vector<Node *> _bucket[2];
+        BucketVector _bucket[2];
         size_t _numElements = 0;
         size_t _capacity = 0;
         size_t _mask = 0;
@@ -68,8 +71,11 @@ namespace sunflower
         KeyEqual _equal;
     };
     template <class Key, class Hash, class KeyEqual>
-    HashSet<Key, Hash, KeyEqual>::HashSet(size_t power)
+    HashSet<Key, Hash, KeyEqual>::HashSet(size_t power, unsigned memFlags)
     {
+        MmapAllocator<Node *> alloc(memFlags);
+        _bucket[0] = BucketVector(alloc);
+        _bucket[1] = BucketVector(alloc);
         _capacity = pow(2, power);
         _mask = _capacity - 1;
         _bucket[_lastest].resize(_capacity);
@@ -78,7 +84,7 @@ namespace sunflower
     template <class Key, class Hash, class KeyEqual>
     size_t HashSet<Key, Hash, KeyEqual>::bucket(const Key &key) const
     {
-        return POS_MOD_BASE(_hash(key));
+        return _hash(key) & _mask;
     }
 
     template <class Key, class Hash, class KeyEqual>
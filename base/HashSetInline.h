@@ -0,0 +1,375 @@
+#ifndef HASHSETINLINE_H
+#define HASHSETINLINE_H
+
+#include "MmapAllocator.h"
+#include "Noncopyable.h"
+#include <math.h>
+#include <memory>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * HashSet with the first key of every bucket stored inline in the bucket
+     * array next to a 32 bit hash tag, collisions overflow to a node chain.
+     * See HashMapInline.h. Key must be default constructible.
+     */
+    template <class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HashSetInline : public Noncopyable
+    {
+    public:
+        class Node
+        {
+        public:
+            Node(uint32_t tag, const Key &key, Node *next) : _tag(tag), _k(key), _next(next) {}
+            void set_next(Node *next) { _next = next; }
+            uint32_t tag() const { return _tag; }
+            Key &k() { return _k; }
+            Node *next() const { return _next; }
+
+        private:
+            uint32_t _tag;
+            Key _k;
+            Node *_next = nullptr;
+        };
+
+        // bucket array element, tag 0 marks an empty slot
+        struct Slot
+        {
+            uint32_t tag = 0;
+            Key k = Key();
+            Node *next = nullptr;
+        };
+
+        explicit HashSetInline(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
+        ~HashSetInline() { clear(); }
+
+        // Capacity
+        bool empty() const noexcept { return _numElements == 0; }
+        size_t size() const noexcept { return _numElements; }
+
+        // Modifiers
+        std::pair<Key, bool> insert(const Key &key);
+        size_t erase(const Key &key);
+        void rehash(size_t capacity);
+        void clear();
+
+        // Lookup
+        Key find(const Key &key);
+        void find(const Key &key, bool &exsit);
+        size_t count(const Key &key);
+
+        // Bucket interface
+        size_t bucket_count() const { return _capacity; }
+        size_t bucket(const Key &key) const;
+        // keys stored in chain nodes instead of inline
+        size_t overflow_count() const { return _numOverflow; }
+
+        // Memory backing of the slot array
+        MemoryInfo memory_info() const { return _slots[_lastest].get_allocator().info(); }
+
+    private:
+        using SlotVector = std::vector<Slot, MmapAllocator<Slot>>;
+
+        static uint32_t Tag(size_t hash) { return (uint32_t)(hash ^ (hash >> 32)) | 1; }
+
+        // stored key equal to key, nullptr if absent
+        Key *search(const Key &key, size_t hash);
+        size_t next_capacity();
+
+    private:
+        // lastest slots and old slots for rehash
+        SlotVector _slots[2];
+        size_t _numElements = 0;
+        size_t _numOverflow = 0;
+        size_t _capacity = 0;
+        size_t _mask = 0;
+        size_t _lastest = 0;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class Hash, class KeyEqual>
+    HashSetInline<Key, Hash, KeyEqual>::HashSetInline(size_t power, unsigned memFlags)
+    {
+        MmapAllocator<Slot> alloc(memFlags);
+        _slots[0] = SlotVector(alloc);
+        _slots[1] = SlotVector(alloc);
+        _capacity = pow(2, power);
+        _mask = _capacity - 1;
+        _slots[_lastest].resize(_capacity);
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetInline<Key, Hash, KeyEqual>::bucket(const Key &key) const
+    {
+        return _hash(key) & _mask;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    Key *HashSetInline<Key, Hash, KeyEqual>::search(const Key &key, size_t hash)
+    {
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return &slot.k;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return &node->k();
+            }
+            node = node->next();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    std::pair<Key, bool> HashSetInline<Key, Hash, KeyEqual>::insert(const Key &key)
+    {
+        size_t hash = _hash(key);
+        Key *found = search(key, hash);
+        if (found)
+        {
+            return std::make_pair(*found, false);
+        }
+
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == 0)
+        {
+            slot.tag = tag;
+            slot.k = key;
+        }
+        else
+        {
+            slot.next = new Node(tag, key, slot.next);
+            _numOverflow++;
+        }
+        _numElements++;
+
+        if (_numElements >= _capacity)
+        {
+            rehash(next_capacity());
+        }
+        return std::make_pair(key, true);
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetInline<Key, Hash, KeyEqual>::erase(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == 0)
+        {
+            return 0;
+        }
+
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            Node *first = slot.next;
+            if (first)
+            {
+                // pull the first chain key inline
+                slot.tag = first->tag();
+                slot.k = std::move(first->k());
+                slot.next = first->next();
+                delete first;
+                _numOverflow--;
+            }
+            else
+            {
+                slot = Slot();
+            }
+            _numElements--;
+            return 1;
+        }
+
+        auto node = slot.next;
+        Node *prev = nullptr;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                if (prev)
+                {
+                    prev->set_next(node->next());
+                }
+                else
+                {
+                    slot.next = node->next();
+                }
+                delete node;
+                _numOverflow--;
+                _numElements--;
+                return 1;
+            }
+            prev = node;
+            node = node->next();
+        }
+        return 0;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    Key HashSetInline<Key, Hash, KeyEqual>::find(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return slot.k;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return node->k();
+            }
+            node = node->next();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HashSetInline<Key, Hash, KeyEqual>::find(const Key &key, bool &exsit)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            exsit = true;
+            return;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                exsit = true;
+                return;
+            }
+            node = node->next();
+        }
+        exsit = false;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetInline<Key, Hash, KeyEqual>::count(const Key &key)
+    {
+        size_t hash = _hash(key);
+        uint32_t tag = Tag(hash);
+        Slot &slot = _slots[_lastest][hash & _mask];
+        if (slot.tag == tag && _equal(key, slot.k))
+        {
+            return 1;
+        }
+
+        auto node = slot.next;
+        while (node)
+        {
+            if (node->tag() == tag && _equal(key, node->k()))
+            {
+                return 1;
+            }
+            node = node->next();
+        }
+        return 0;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetInline<Key, Hash, KeyEqual>::next_capacity()
+    {
+        return 2 * _capacity;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HashSetInline<Key, Hash, KeyEqual>::rehash(size_t capacity)
+    {
+        if (_capacity == capacity)
+            return;
+
+        size_t new_index = (_lastest == 0 ? 1 : 0);
+        size_t new_mask = capacity - 1;
+        SlotVector &to = _slots[new_index];
+
+        to.resize(capacity);
+
+        // move inline keys, relink chain nodes or pull them inline
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            Slot &slot = _slots[_lastest][id];
+            if (slot.tag == 0)
+                continue;
+
+            Slot &first = to[_hash(slot.k) & new_mask];
+            if (first.tag == 0)
+            {
+                first.tag = slot.tag;
+                first.k = std::move(slot.k);
+            }
+            else
+            {
+                first.next = new Node(slot.tag, std::move(slot.k), first.next);
+                _numOverflow++;
+            }
+
+            Node *node = slot.next;
+            while (node)
+            {
+                Node *next = node->next();
+                Slot &target = to[_hash(node->k()) & new_mask];
+                if (target.tag == 0)
+                {
+                    target.tag = node->tag();
+                    target.k = std::move(node->k());
+                    delete node;
+                    _numOverflow--;
+                }
+                else
+                {
+                    node->set_next(target.next);
+                    target.next = node;
+                }
+                node = next;
+            }
+            slot = Slot();
+        }
+        _lastest = new_index;
+        _mask = new_mask;
+        _capacity = capacity;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HashSetInline<Key, Hash, KeyEqual>::clear()
+    {
+        if (_numElements == 0)
+            return;
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            Slot &slot = _slots[_lastest][id];
+            auto node = slot.next;
+            while (node)
+            {
+                Node *curr = node;
+                node = node->next();
+                delete curr;
+            }
+            slot = Slot();
+        }
+        _numElements = 0;
+        _numOverflow = 0;
+    }
+} // namespace sunflower
+#endif // HASHSETINLINE_H
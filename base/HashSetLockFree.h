@@ -0,0 +1,208 @@
+#ifndef HASHSETLOCKFREE_H
+#define HASHSETLOCKFREE_H
+
+#include "HashTableLockFree.h"
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+namespace sunflower
+{
+    /**
+     * Lock-free set of integral keys on a HashTableLockFree (see there for
+     * probing, tombstones and migration), the slot state is present or
+     * absent, so insert and erase are a single CAS.
+     * For 64 bit keys INT64_MIN and INT64_MIN + 1 (as unsigned 2^63 and
+     * 2^63 + 1) are the sentinels and rejected.
+     */
+    template <class Key>
+    class HashSetLockFree : public Noncopyable
+    {
+        static_assert(std::is_integral<Key>::value && !std::is_same<Key, bool>::value, "HashSetLockFree needs an integral key");
+
+    public:
+        explicit HashSetLockFree(size_t power = 20, unsigned memFlags = MEM_DEFAULT) : _table(power, memFlags) {}
+        ~HashSetLockFree() {}
+
+        // Capacity, exact once writers are quiet
+        bool empty() const noexcept { return size() == 0; }
+        size_t size() const noexcept { return _table.size(); }
+
+        // Modifiers
+        std::pair<Key, bool> insert(const Key &key);
+        size_t erase(const Key &key);
+        // not safe against concurrent operations
+        void clear() { _table.clear(); }
+
+        // Lookup
+        void find(const Key &key, bool &exsit);
+        size_t count(const Key &key);
+
+        // Batch, one epoch guard for the whole batch and the slots of later
+        // keys prefetched. Per-key results go to the output array, returns
+        // the number of hits.
+        size_t insert_batch(const Key *keys, size_t n, bool *inserted);
+        size_t erase_batch(const Key *keys, size_t n, bool *erased);
+        size_t find_batch(const Key *keys, size_t n, bool *exsit);
+
+        size_t bucket_count() const { return _table.bucket_count(); }
+        // tables copied so far
+        size_t migration_count() const { return _table.migration_count(); }
+
+    private:
+        using Image = typename std::make_unsigned<Key>::type;
+
+        using Core = HashTableLockFree<uint32_t>;
+        using Table = typename Core::Table;
+        using Slot = typename Core::Slot;
+
+        static const uint64_t kMovedKey = Core::kMovedKey;
+        static const uint32_t kAbsent = Core::kAbsent;
+        static const uint32_t kMoved = Core::kMoved;
+        static const uint32_t kPresent = 2;
+
+        // key as slot word, < 2 for the reserved keys
+        static uint64_t Encode(const Key &key) { return (uint64_t)(Image)key ^ (1ULL << 63); }
+
+        bool insert_word(Table *t, uint64_t word, size_t h);
+        bool erase_word(Table *t, uint64_t word, size_t h);
+        bool find_word(Table *t, uint64_t word, size_t h);
+        template <class Fn>
+        size_t run_batch(const Key *keys, size_t n, bool *out, Fn fn);
+
+    private:
+        Core _table;
+    };
+
+    template <class Key>
+    bool HashSetLockFree<Key>::insert_word(Table *t, uint64_t word, size_t h)
+    {
+        for (;;)
+        {
+            Slot *slot = _table.claim(t, word, h);
+            uint32_t state = kAbsent;
+            if (slot->state.compare_exchange_strong(state, kPresent, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                _table.add_size(1);
+                return true;
+            }
+            if (state == kPresent)
+                return false;
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key>
+    bool HashSetLockFree<Key>::erase_word(Table *t, uint64_t word, size_t h)
+    {
+        for (;;)
+        {
+            Slot *slot = _table.lookup(t, word, h);
+            if (slot == nullptr)
+                return false;
+            uint32_t state = kPresent;
+            if (slot->state.compare_exchange_strong(state, kAbsent, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                _table.add_size(-1);
+                return true;
+            }
+            if (state == kAbsent)
+                return false;
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key>
+    bool HashSetLockFree<Key>::find_word(Table *t, uint64_t word, size_t h)
+    {
+        for (;;)
+        {
+            Slot *slot = _table.lookup(t, word, h);
+            if (slot == nullptr)
+                return false;
+            uint32_t state = slot->state.load(std::memory_order_acquire);
+            if (state != kMoved)
+                return state == kPresent;
+            t = _table.migrate(t);
+        }
+    }
+
+    template <class Key>
+    std::pair<Key, bool> HashSetLockFree<Key>::insert(const Key &key)
+    {
+        uint64_t word = Encode(key);
+        if (word <= kMovedKey)
+            return std::make_pair(key, false);
+        typename Core::Guard guard(_table);
+        return std::make_pair(key, insert_word(_table.current(), word, _table.hash(word)));
+    }
+
+    template <class Key>
+    size_t HashSetLockFree<Key>::erase(const Key &key)
+    {
+        uint64_t word = Encode(key);
+        if (word <= kMovedKey)
+            return 0;
+        typename Core::Guard guard(_table);
+        return erase_word(_table.current(), word, _table.hash(word)) ? 1 : 0;
+    }
+
+    template <class Key>
+    void HashSetLockFree<Key>::find(const Key &key, bool &exsit)
+    {
+        exsit = count(key) > 0;
+    }
+
+    template <class Key>
+    size_t HashSetLockFree<Key>::count(const Key &key)
+    {
+        uint64_t word = Encode(key);
+        if (word <= kMovedKey)
+            return 0;
+        typename Core::Guard guard(_table);
+        return find_word(_table.current(), word, _table.hash(word)) ? 1 : 0;
+    }
+
+    template <class Key>
+    template <class Fn>
+    size_t HashSetLockFree<Key>::run_batch(const Key *keys, size_t n, bool *out, Fn fn)
+    {
+        typename Core::Guard guard(_table);
+        size_t hits = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            Table *t = _table.current();
+            if (i + Core::kPrefetch < n)
+            {
+                _table.prefetch(t, Encode(keys[i + Core::kPrefetch]));
+            }
+            uint64_t word = Encode(keys[i]);
+            out[i] = word > kMovedKey && fn(t, word, _table.hash(word));
+            hits += out[i];
+        }
+        return hits;
+    }
+
+    template <class Key>
+    size_t HashSetLockFree<Key>::insert_batch(const Key *keys, size_t n, bool *inserted)
+    {
+        return run_batch(keys, n, inserted, [this](Table *t, uint64_t word, size_t h)
+                         { return insert_word(t, word, h); });
+    }
+
+    template <class Key>
+    size_t HashSetLockFree<Key>::erase_batch(const Key *keys, size_t n, bool *erased)
+    {
+        return run_batch(keys, n, erased, [this](Table *t, uint64_t word, size_t h)
+                         { return erase_word(t, word, h); });
+    }
+
+    template <class Key>
+    size_t HashSetLockFree<Key>::find_batch(const Key *keys, size_t n, bool *exsit)
+    {
+        return run_batch(keys, n, exsit, [this](Table *t, uint64_t word, size_t h)
+                         { return find_word(t, word, h); });
+    }
+
+} // namespace sunflower
+#endif // HASHSETLOCKFREE_H
@@ -1,7 +1,10 @@
 #ifndef HASHSETSAFE_H
 #define HASHSETSAFE_H
 
+#include "HotKeyDetector.h"
+#include "MmapAllocator.h"
 #include "Noncopyable.h"
+#include <algorithm>
 #include <atomic>
 #include <list>
 #include <math.h>
@@ -10,9 +13,6 @@
 #include <stdint.h>
 #include <string.h>
 #include <vector>
-#ifndef POS_MOD_BASE
-#define POS_MOD_BASE(x) (x & _mask)
-#endif
 namespace sunflower
 {
     template <class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
@@ -33,7 +33,8 @@ namespace sunflower
             Node *_next = nullptr;
         };
 
-        explicit HashSetSafe(size_t power = 20);
+        // buckets share 2^min(power, lockPower) striped mutexes
+        explicit HashSetSafe(size_t power = 20, unsigned memFlags = MEM_DEFAULT, size_t lockPower = 20);
         ~HashSetSafe() { clear(); }
 
         // Capacitynullptr
@@ -50,28 +51,61 @@ namespace sunflower
         void find(const Key &key, bool &exsit);
         size_t count(const Key &key);
 
+        // Batch, keys are grouped by lock stripe and every stripe is locked once.
+        // Per-key results go to the output array, returns the number of hits.
+        size_t insert_batch(const Key *keys, size_t n, bool *inserted);
+        size_t erase_batch(const Key *keys, size_t n, bool *erased);
+        size_t find_batch(const Key *keys, size_t n, bool *exsit);
+
         // Bucket interface
         size_t bucket_count() const { return _capacity; }
         size_t bucket(const Key &key) const;
+        size_t stripe_count() const { return _vecMutex.size(); }
+
+        // Hot key sampling, every operation offers its key to detector which
+        // samples a fraction of them, nullptr switches it off
+        void set_hot_key_detector(HotKeyDetector<Key, Hash, KeyEqual> *detector) { _hotKeys.store(detector, std::memory_order_release); }
+        HotKeyDetector<Key, Hash, KeyEqual> *hot_key_detector() const { return _hotKeys.load(std::memory_order_acquire); }
+
+        // Memory backing of the bucket array
+        MemoryInfo memory_info() const { return _bucket.get_allocator().info(); }
+
+    private:
+        std::mutex &stripe_mutex(size_t id) { return *_vecMutex[id & _lockMask]; }
+        // single key bodies, the caller holds the stripe lock of id
+        Node *insert_unlocked(size_t id, const Key &key, bool &inserted);
+        bool erase_unlocked(size_t id, const Key &key);
+        Node *find_unlocked(size_t id, const Key &key);
+        template <class Fn>
+        size_t for_each_stripe(const Key *keys, size_t n, Fn fn);
+        void record_hot(const Key &key)
+        {
+            if (auto detector = _hotKeys.load(std::memory_order_relaxed))
+                detector->record(key);
+        }
 
     private:
-        std::vector<Node *> _bucket;
+        std::vector<Node *, MmapAllocator<Node *>> _bucket;
         std::vector<std::unique_ptr<std::mutex>> _vecMutex;
         std::atomic<size_t> _numElements;
         size_t _capacity = 0;
         size_t _mask = 0;
+        size_t _lockMask = 0;
         Hash _hash;
         KeyEqual _equal;
+        std::atomic<HotKeyDetector<Key, Hash, KeyEqual> *> _hotKeys{nullptr};
     };
     template <class Key, class Hash, class KeyEqual>
-    HashSetSafe<Key, Hash, KeyEqual>::HashSetSafe(size_t power) : _numElements(0)
+    HashSetSafe<Key, Hash, KeyEqual>::HashSetSafe(size_t power, unsigned memFlags, size_t lockPower)
+        : _bucket(MmapAllocator<Node *>(memFlags)), _numElements(0)
     {
         _capacity = pow(2, power);
         _mask = _capacity - 1;
         _bucket.resize(_capacity);
-        _vecMutex.resize(_capacity);
+        _vecMutex.resize(pow(2, std::min(power, lockPower)));
+        _lockMask = _vecMutex.size() - 1;
 
-        for (uint32_t i = 0; i < _capacity; i++)
+        for (uint32_t i = 0; i < _vecMutex.size(); i++)
         {
             _vecMutex[i] = std::make_unique<std::mutex>();
         }
@@ -80,15 +114,86 @@ namespace sunflower
     template <class Key, class Hash, class KeyEqual>
     size_t HashSetSafe<Key, Hash, KeyEqual>::bucket(const Key &key) const
     {
-        return POS_MOD_BASE(_hash(key));
+        return _hash(key) & _mask;
     }
 
     template <class Key, class Hash, class KeyEqual>
     std::pair<Key, bool> HashSetSafe<Key, Hash, KeyEqual>::insert(const Key &key)
     {
+        record_hot(key);
+        size_t id = bucket(key);
+        std::lock_guard<std::mutex> lck(stripe_mutex(id));
+
+        bool inserted = false;
+        Node *node = insert_unlocked(id, key, inserted);
+        return std::pair<Key, bool>(node->k(), inserted);
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetSafe<Key, Hash, KeyEqual>::erase(const Key &key)
+    {
+        record_hot(key);
         size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
+        std::lock_guard<std::mutex> lck(stripe_mutex(id));
+        return erase_unlocked(id, key) ? 1 : 0;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    Key HashSetSafe<Key, Hash, KeyEqual>::find(const Key &key)
+    {
+        record_hot(key);
+        size_t id = bucket(key);
+        std::lock_guard<std::mutex> lck(stripe_mutex(id));
+
+        Node *node = find_unlocked(id, key);
+        if (node)
+        {
+            return node->k();
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HashSetSafe<Key, Hash, KeyEqual>::find(const Key &key, bool &exsit)
+    {
+        record_hot(key);
+        size_t id = bucket(key);
+        std::lock_guard<std::mutex> lck(stripe_mutex(id));
+        exsit = find_unlocked(id, key) != nullptr;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetSafe<Key, Hash, KeyEqual>::count(const Key &key)
+    {
+        record_hot(key);
+        size_t id = bucket(key);
+        std::lock_guard<std::mutex> lck(stripe_mutex(id));
+        return find_unlocked(id, key) ? 1 : 0;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HashSetSafe<Key, Hash, KeyEqual>::clear()
+    {
+        if (_numElements == 0)
+            return;
+        for (size_t id = 0; id < _capacity; id++)
+        {
+            std::lock_guard<std::mutex> lck(stripe_mutex(id));
+            auto node = _bucket[id];
+            while (node)
+            {
+                Node *curr = node;
+                node = node->next();
+                delete curr;
+            }
+            _bucket[id] = nullptr;
+        }
+        _numElements = 0;
+    }
 
+    template <class Key, class Hash, class KeyEqual>
+    typename HashSetSafe<Key, Hash, KeyEqual>::Node *HashSetSafe<Key, Hash, KeyEqual>::insert_unlocked(size_t id, const Key &key, bool &inserted)
+    {
         auto head = _bucket[id];
         auto node = head;
 
@@ -96,26 +201,23 @@ namespace sunflower
         {
             if (_equal(key, node->k()))
             {
-                return std::make_pair<Key, bool>(std::move(node->k()), false);
+                inserted = false;
+                return node;
             }
             node = node->next();
         }
 
-        Node *newNode = new Node(key, head);
-        _bucket[id] = newNode;
+        _bucket[id] = new Node(key, head);
         _numElements++;
-        return std::make_pair<Key, bool>(std::move(newNode->k()), true);
+        inserted = true;
+        return _bucket[id];
     }
 
     template <class Key, class Hash, class KeyEqual>
-    size_t HashSetSafe<Key, Hash, KeyEqual>::erase(const Key &key)
+    bool HashSetSafe<Key, Hash, KeyEqual>::erase_unlocked(size_t id, const Key &key)
     {
-        size_t id = bucket(key);
-        Node *prev = nullptr;
-
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
         auto node = _bucket[id];
+        Node *prev = nullptr;
 
         while (node)
         {
@@ -131,27 +233,24 @@ namespace sunflower
                 }
                 delete node;
                 _numElements--;
-                return 1;
+                return true;
             }
             prev = node;
             node = node->next();
         }
-        return 0;
+        return false;
     }
 
     template <class Key, class Hash, class KeyEqual>
-    Key HashSetSafe<Key, Hash, KeyEqual>::find(const Key &key)
+    typename HashSetSafe<Key, Hash, KeyEqual>::Node *HashSetSafe<Key, Hash, KeyEqual>::find_unlocked(size_t id, const Key &key)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
         auto node = _bucket[id];
 
         while (node)
         {
             if (_equal(key, node->k()))
             {
-                return node->k();
+                return node;
             }
             node = node->next();
         }
@@ -159,63 +258,64 @@ namespace sunflower
     }
 
     template <class Key, class Hash, class KeyEqual>
-    void HashSetSafe<Key, Hash, KeyEqual>::find(const Key &key, bool &exsit)
+    template <class Fn>
+    size_t HashSetSafe<Key, Hash, KeyEqual>::for_each_stripe(const Key *keys, size_t n, Fn fn)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
-        auto node = _bucket[id];
+        // (bucket id, key index), reused across batches of this thread
+        static thread_local std::vector<std::pair<size_t, size_t>> order;
+        static thread_local std::vector<size_t> hashes;
+        order.resize(n);
+        hashes.resize(n);
+        HashBatch(_hash, keys, n, hashes.data());
+        for (size_t i = 0; i < n; i++)
+        {
+            record_hot(keys[i]);
+            order[i] = std::make_pair(hashes[i] & _mask, i);
+        }
+        // group by stripe, keep the batch order inside a stripe for duplicate keys
+        size_t lockMask = _lockMask;
+        std::sort(order.begin(), order.end(), [lockMask](const std::pair<size_t, size_t> &a, const std::pair<size_t, size_t> &b)
+                  {
+                      size_t sa = a.first & lockMask, sb = b.first & lockMask;
+                      return sa < sb || (sa == sb && a.second < b.second);
+                  });
 
-        while (node)
+        size_t hits = 0;
+        size_t i = 0;
+        while (i < n)
         {
-            if (_equal(key, node->k()))
+            size_t stripe = order[i].first & _lockMask;
+            std::lock_guard<std::mutex> lck(*_vecMutex[stripe]);
+            for (; i < n && (order[i].first & _lockMask) == stripe; i++)
             {
-                exsit = true;
-                return;
+                hits += fn(order[i].first, order[i].second);
             }
-            node = node->next();
         }
-        exsit = false;
+        return hits;
     }
 
     template <class Key, class Hash, class KeyEqual>
-    size_t HashSetSafe<Key, Hash, KeyEqual>::count(const Key &key)
+    size_t HashSetSafe<Key, Hash, KeyEqual>::insert_batch(const Key *keys, size_t n, bool *inserted)
     {
-        size_t id = bucket(key);
-        std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-
-        auto node = _bucket[id];
-
-        while (node)
-        {
-            if (_equal(key, node->k()))
-            {
-                return 1;
-            }
-            node = node->next();
-        }
-        return 0;
+        return for_each_stripe(keys, n, [&](size_t id, size_t i)
+                               {
+                                   insert_unlocked(id, keys[i], inserted[i]);
+                                   return inserted[i];
+                               });
     }
 
     template <class Key, class Hash, class KeyEqual>
-    void HashSetSafe<Key, Hash, KeyEqual>::clear()
+    size_t HashSetSafe<Key, Hash, KeyEqual>::erase_batch(const Key *keys, size_t n, bool *erased)
     {
-        if (_numElements == 0)
-            return;
-        for (size_t id = 0; id < _capacity; id++)
-        {
-            std::lock_guard<std::mutex> lck(*_vecMutex[id]);
-            auto node = _bucket[id];
-            while (node)
-            {
-                Node *curr = node;
-                node = node->next();
-                delete curr;
-            }
-            _bucket[id] = nullptr;
-        }
-        _numElements = 0;
+        return for_each_stripe(keys, n, [&](size_t id, size_t i)
+                               { return erased[i] = erase_unlocked(id, keys[i]); });
     }
 
+    template <class Key, class Hash, class KeyEqual>
+    size_t HashSetSafe<Key, Hash, KeyEqual>::find_batch(const Key *keys, size_t n, bool *exsit)
+    {
+        return for_each_stripe(keys, n, [&](size_t id, size_t i)
+                               { return exsit[i] = find_unlocked(id, keys[i]) != nullptr; });
+    }
 } // namespace sunflower
 #endif // HASHSETSAFE_H
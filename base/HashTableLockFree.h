@@ -0,0 +1,428 @@
+#ifndef HASHTABLELOCKFREE_H
+#define HASHTABLELOCKFREE_H
+
+#include "EpochDomain.h"
+#include "Hash.h"
+#include "MmapAllocator.h"
+#include "Noncopyable.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <thread>
+
+namespace sunflower
+{
+    /**
+     * Open addressing table behind HashSetLockFree and HashMapLockFree,
+     * linear probing over slots of a key word, written once by CAS from
+     * empty, and a State word the container interprets: 0 (absent) and
+     * 1 (moved) are reserved, anything else is copied as is on migration.
+     * Erase turns the state back to absent and leaves the key behind as a
+     * tombstone that only the same key reuses.
+     * At half load a new table is published, every writer that touches the
+     * old one copies 1024 slot chunks of it: a slot's state is frozen to
+     * moved before its key is copied, so a racing writer either lands before
+     * the copy or retries in the new table, and its key turns to moved once
+     * the copy is in place. Once no chunk is left to hand out a thread
+     * copies the unfinished chunks itself instead of waiting for their
+     * owners, it only waits for single slots another thread froze and is
+     * copying right then. Outside that window every operation is lock-free.
+     * Tombstones are dropped by the copy, old tables are freed through an
+     * EpochDomain.
+     * Key words below 2 are the sentinels, the container rejects such keys.
+     */
+    template <class State>
+    class HashTableLockFree : public Noncopyable
+    {
+    public:
+        static const uint64_t kEmptyKey = 0;
+        static const uint64_t kMovedKey = 1;
+        static const State kAbsent = 0;
+        static const State kMoved = 1;
+        static const size_t kStripes = 16;
+        static const size_t kMigrateChunk = 1024;
+        static const size_t kPrefetch = 8;
+
+        struct Slot
+        {
+            std::atomic<uint64_t> key{kEmptyKey};
+            std::atomic<State> state{kAbsent};
+        };
+
+        struct alignas(64) Counter
+        {
+            std::atomic<long> n{0};
+        };
+
+        struct Table
+        {
+            Table(size_t capacity, unsigned memFlags)
+                : capacity(capacity), mask(capacity - 1), chunks((capacity + kMigrateChunk - 1) / kMigrateChunk),
+                  checkEvery(std::max((size_t)1, capacity >> 10)), alloc(memFlags)
+            {
+                slots = alloc.allocate(capacity);
+                for (size_t i = 0; i < capacity; i++)
+                {
+                    new (&slots[i]) Slot();
+                }
+                copied.reset(new std::atomic<bool>[chunks]);
+                for (size_t i = 0; i < chunks; i++)
+                {
+                    copied[i].store(false, std::memory_order_relaxed);
+                }
+            }
+            ~Table() { alloc.deallocate(slots, capacity); }
+
+            size_t capacity;
+            size_t mask;
+            size_t chunks;
+            // claims per stripe between load checks
+            size_t checkEvery;
+            MmapAllocator<Slot> alloc;
+            Slot *slots = nullptr;
+            // key slots taken, tombstones included
+            Counter claimed[kStripes];
+            std::atomic<Table *> next{nullptr};
+            // chunks handed out and chunks copied
+            std::atomic<size_t> cursor{0};
+            std::atomic<size_t> done{0};
+            std::unique_ptr<std::atomic<bool>[]> copied;
+        };
+
+        // Epoch guard for every access below, the thread that leaves it
+        // collects tables retired by migrations meanwhile
+        class Guard : public Noncopyable
+        {
+        public:
+            explicit Guard(HashTableLockFree &table) : _table(table) { _table._domain.Enter(); }
+            ~Guard()
+            {
+                _table._domain.Leave();
+                if (_table._retired.load(std::memory_order_relaxed))
+                {
+                    _table.reclaim();
+                }
+            }
+
+        private:
+            HashTableLockFree &_table;
+        };
+
+        explicit HashTableLockFree(size_t power = 20, unsigned memFlags = MEM_DEFAULT);
+        ~HashTableLockFree() { destroy(); }
+
+        // live keys, exact once writers are quiet
+        size_t size() const noexcept;
+        size_t bucket_count() const;
+        size_t migration_count() const { return _migrations.load(std::memory_order_relaxed); }
+        // not safe against concurrent operations
+        void clear();
+
+        // every access below runs inside a Guard
+        Table *current() const { return _table.load(std::memory_order_acquire); }
+        size_t hash(uint64_t word) const { return Mix64(word ^ _seed); }
+        void prefetch(const Table *t, uint64_t word) const { __builtin_prefetch(&t->slots[hash(word) & t->mask]); }
+        void add_size(long delta) { _sizes[Stripe()].n.fetch_add(delta, std::memory_order_relaxed); }
+
+        // slot of word, nullptr if absent, t follows migrations
+        Slot *lookup(Table *&t, uint64_t word, size_t h);
+        // slot of word, an empty one claimed if absent
+        Slot *claim(Table *&t, uint64_t word, size_t h);
+        // copy chunks of t until none is left, then the ones others have not
+        // finished, returns the new table
+        Table *migrate(Table *t);
+
+    private:
+        static size_t Stripe()
+        {
+            static std::atomic<size_t> s_next{0};
+            static thread_local size_t stripe = s_next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+            return stripe;
+        }
+
+        size_t claimed(Table *t) const;
+        void count_claim(Table *t);
+        // publish the table t migrates to
+        void grow(Table *t);
+        void copy_chunk(Table *t, Table *next, size_t chunk);
+        void move_slot(Slot &slot, Table *next, long &copied);
+        // frees retired tables no guard can see any more
+        void reclaim();
+        void destroy();
+
+    private:
+        mutable EpochDomain _domain;
+        std::atomic<Table *> _table{nullptr};
+        uint64_t _seed = 0;
+        size_t _power = 0;
+        unsigned _memFlags = MEM_DEFAULT;
+        std::atomic<size_t> _migrations{0};
+        // tables retired and not yet freed
+        std::atomic<size_t> _retired{0};
+        // live keys
+        Counter _sizes[kStripes];
+    };
+
+    template <class State>
+    HashTableLockFree<State>::HashTableLockFree(size_t power, unsigned memFlags)
+        : _seed(RandomSeed()), _power(std::max(power, (size_t)4)), _memFlags(memFlags)
+    {
+        _table.store(new Table((size_t)1 << _power, _memFlags), std::memory_order_release);
+    }
+
+    template <class State>
+    size_t HashTableLockFree<State>::size() const noexcept
+    {
+        long n = 0;
+        for (size_t i = 0; i < kStripes; i++)
+        {
+            n += _sizes[i].n.load(std::memory_order_relaxed);
+        }
+        return n > 0 ? n : 0;
+    }
+
+    template <class State>
+    size_t HashTableLockFree<State>::bucket_count() const
+    {
+        EpochDomain::Guard guard(_domain);
+        return _table.load(std::memory_order_acquire)->capacity;
+    }
+
+    template <class State>
+    size_t HashTableLockFree<State>::claimed(Table *t) const
+    {
+        long n = 0;
+        for (size_t i = 0; i < kStripes; i++)
+        {
+            n += t->claimed[i].n.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    template <class State>
+    typename HashTableLockFree<State>::Slot *HashTableLockFree<State>::lookup(Table *&t, uint64_t word, size_t h)
+    {
+        for (;;)
+        {
+            size_t i = h & t->mask;
+            for (size_t probes = 0; probes < t->capacity; probes++)
+            {
+                Slot &slot = t->slots[i];
+                uint64_t k = slot.key.load(std::memory_order_acquire);
+                if (k == word)
+                    return &slot;
+                if (k == kEmptyKey)
+                    return nullptr;
+                if (k == kMovedKey)
+                    break;
+                i = (i + 1) & t->mask;
+            }
+            if (t->next.load(std::memory_order_acquire) == nullptr)
+            {
+                return nullptr;
+            }
+            t = migrate(t);
+        }
+    }
+
+    template <class State>
+    typename HashTableLockFree<State>::Slot *HashTableLockFree<State>::claim(Table *&t, uint64_t word, size_t h)
+    {
+        for (;;)
+        {
+            // no new keys into a table being copied
+            if (t->next.load(std::memory_order_acquire))
+            {
+                t = migrate(t);
+                continue;
+            }
+
+            size_t i = h & t->mask;
+            for (size_t probes = 0; probes < t->capacity; probes++)
+            {
+                Slot &slot = t->slots[i];
+                uint64_t k = slot.key.load(std::memory_order_acquire);
+                if (k == kEmptyKey)
+                {
+                    if (slot.key.compare_exchange_strong(k, word, std::memory_order_acq_rel, std::memory_order_acquire))
+                    {
+                        count_claim(t);
+                        return &slot;
+                    }
+                }
+                if (k == word)
+                    return &slot;
+                if (k == kMovedKey)
+                    break;
+                i = (i + 1) & t->mask;
+            }
+            // full or being copied
+            grow(t);
+            t = migrate(t);
+        }
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::count_claim(Table *t)
+    {
+        size_t n = t->claimed[Stripe()].n.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (n % t->checkEvery == 0 && claimed(t) * 2 >= t->capacity)
+        {
+            // the next writer copies it, the claimed slot is still filled here
+            grow(t);
+        }
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::grow(Table *t)
+    {
+        if (t->next.load(std::memory_order_acquire))
+            return;
+        // doubles unless the table is mostly tombstones
+        size_t capacity = size() * 4 >= t->capacity ? 2 * t->capacity : t->capacity;
+        Table *next = new Table(capacity, _memFlags);
+        Table *expected = nullptr;
+        if (!t->next.compare_exchange_strong(expected, next, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            delete next;
+        }
+    }
+
+    template <class State>
+    typename HashTableLockFree<State>::Table *HashTableLockFree<State>::migrate(Table *t)
+    {
+        Table *next = t->next.load(std::memory_order_acquire);
+        for (;;)
+        {
+            size_t chunk = t->cursor.fetch_add(1, std::memory_order_relaxed);
+            if (chunk >= t->chunks)
+                break;
+            copy_chunk(t, next, chunk);
+        }
+
+        // chunks still held by other threads, copied alongside them
+        for (size_t chunk = 0; chunk < t->chunks && t->done.load(std::memory_order_acquire) < t->chunks; chunk++)
+        {
+            if (!t->copied[chunk].load(std::memory_order_acquire))
+            {
+                copy_chunk(t, next, chunk);
+            }
+        }
+
+        // whoever swings _table retires t, the epoch keeps it alive for
+        // threads still probing it
+        Table *expected = t;
+        if (_table.compare_exchange_strong(expected, next, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            _migrations.fetch_add(1, std::memory_order_relaxed);
+            // shared, so whichever thread leaves its guard last frees it
+            _retired.fetch_add(1, std::memory_order_relaxed);
+            _domain.RetireShared(t, [](void *p)
+                                 { delete static_cast<Table *>(p); });
+        }
+        return next;
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::copy_chunk(Table *t, Table *next, size_t chunk)
+    {
+        long copied = 0;
+        size_t begin = chunk * kMigrateChunk;
+        size_t end = std::min(t->capacity, begin + kMigrateChunk);
+        for (size_t i = begin; i < end; i++)
+        {
+            move_slot(t->slots[i], next, copied);
+        }
+        next->claimed[Stripe()].n.fetch_add(copied, std::memory_order_relaxed);
+
+        // slots frozen by another thread first are in flight there
+        for (size_t i = begin; i < end; i++)
+        {
+            while (t->slots[i].key.load(std::memory_order_acquire) != kMovedKey)
+            {
+                std::this_thread::yield();
+            }
+        }
+        if (!t->copied[chunk].exchange(true, std::memory_order_acq_rel))
+        {
+            t->done.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::move_slot(Slot &slot, Table *next, long &copied)
+    {
+        uint64_t k = kEmptyKey;
+        if (slot.key.compare_exchange_strong(k, kMovedKey, std::memory_order_acq_rel, std::memory_order_acquire))
+            return;
+        if (k == kMovedKey)
+            return;
+
+        // freeze the state, a writer's CAS now fails and retries in next,
+        // the thread that froze it copies it
+        State s = slot.state.exchange(kMoved, std::memory_order_acq_rel);
+        if (s == kMoved)
+            return;
+
+        if (s != kAbsent)
+        {
+            // keys are unique in the old table and nobody else writes the
+            // new one before the copy is done, a free slot is enough
+            size_t i = hash(k) & next->mask;
+            for (;;)
+            {
+                Slot &target = next->slots[i];
+                uint64_t empty = kEmptyKey;
+                if (target.key.compare_exchange_strong(empty, k, std::memory_order_relaxed))
+                {
+                    target.state.store(s, std::memory_order_relaxed);
+                    copied++;
+                    break;
+                }
+                i = (i + 1) & next->mask;
+            }
+        }
+        // the copy is in place, lookups of k now go on in next
+        slot.key.store(kMovedKey, std::memory_order_release);
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::reclaim()
+    {
+        // a table retired at epoch e is freed at e+2, each pass advances one
+        size_t freed = _domain.Collect();
+        freed += _domain.Collect();
+        if (freed)
+        {
+            _retired.fetch_sub(freed, std::memory_order_relaxed);
+        }
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::destroy()
+    {
+        // tables never swung into _table are still chained behind it
+        Table *t = _table.load(std::memory_order_acquire);
+        while (t)
+        {
+            Table *next = t->next.load(std::memory_order_acquire);
+            delete t;
+            t = next;
+        }
+        _table.store(nullptr, std::memory_order_release);
+    }
+
+    template <class State>
+    void HashTableLockFree<State>::clear()
+    {
+        destroy();
+        for (size_t i = 0; i < kStripes; i++)
+        {
+            _sizes[i].n.store(0, std::memory_order_relaxed);
+        }
+        _table.store(new Table((size_t)1 << _power, _memFlags), std::memory_order_release);
+    }
+} // namespace sunflower
+#endif // HASHTABLELOCKFREE_H
@@ -0,0 +1,224 @@
+#ifndef HOTKEYDETECTOR_H
+#define HOTKEYDETECTOR_H
+
+#include "CountMinSketch.h"
+#include "Noncopyable.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Space-Saving top-K: k monitored keys, a new key evicts the smallest
+     * one and inherits its count as error. count - error is a lower bound
+     * of the true count. Not thread safe, k is expected to be small.
+     */
+    template <class Key, class KeyEqual = std::equal_to<Key>>
+    class TopKTracker
+    {
+    public:
+        struct Entry
+        {
+            Key key;
+            uint64_t count;
+            uint64_t error;
+        };
+
+        explicit TopKTracker(size_t k = 16) : _k(std::max(k, (size_t)1)) { _entries.reserve(_k); }
+
+        void add(const Key &key, uint64_t n = 1);
+        // Monitored keys, largest count first
+        std::vector<Entry> top() const;
+        // Count a new key has to beat to get in, 0 while not full
+        uint64_t min_count() const;
+        void decay();
+        void clear() { _entries.clear(); }
+        size_t k() const { return _k; }
+
+    private:
+        size_t _k;
+        std::vector<Entry> _entries;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class KeyEqual>
+    void TopKTracker<Key, KeyEqual>::add(const Key &key, uint64_t n)
+    {
+        size_t least = 0;
+        for (size_t i = 0; i < _entries.size(); i++)
+        {
+            if (_equal(key, _entries[i].key))
+            {
+                _entries[i].count += n;
+                return;
+            }
+            if (_entries[i].count < _entries[least].count)
+            {
+                least = i;
+            }
+        }
+
+        if (_entries.size() < _k)
+        {
+            _entries.push_back(Entry{key, n, 0});
+            return;
+        }
+        Entry &victim = _entries[least];
+        victim.key = key;
+        victim.error = victim.count;
+        victim.count += n;
+    }
+
+    template <class Key, class KeyEqual>
+    std::vector<typename TopKTracker<Key, KeyEqual>::Entry> TopKTracker<Key, KeyEqual>::top() const
+    {
+        std::vector<Entry> sorted = _entries;
+        std::sort(sorted.begin(), sorted.end(), [](const Entry &a, const Entry &b)
+                  { return a.count > b.count; });
+        return sorted;
+    }
+
+    template <class Key, class KeyEqual>
+    uint64_t TopKTracker<Key, KeyEqual>::min_count() const
+    {
+        if (_entries.size() < _k)
+        {
+            return 0;
+        }
+        uint64_t least = UINT64_MAX;
+        for (auto &e : _entries)
+        {
+            least = std::min(least, e.count);
+        }
+        return least;
+    }
+
+    template <class Key, class KeyEqual>
+    void TopKTracker<Key, KeyEqual>::decay()
+    {
+        for (auto &e : _entries)
+        {
+            e.count >>= 1;
+            e.error >>= 1;
+        }
+    }
+
+    /**
+     * Hot key detector for the concurrent containers.
+     * record() samples 1 in 2^sampleShift calls with a thread local generator,
+     * sampled keys go to a count-min sketch and only keys whose estimate
+     * reaches the top-K threshold take the tracker mutex.
+     * Keys are copied into the tracker, pointer keys must outlive it.
+     */
+    template <class Key, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class HotKeyDetector : public Noncopyable
+    {
+    public:
+        struct HotKey
+        {
+            Key key;
+            uint64_t estimate; // sampled hits from the sketch, times sample_rate() for all hits
+        };
+
+        explicit HotKeyDetector(size_t k = 16, size_t sampleShift = 6, size_t widthPower = 12, size_t depth = 4)
+            : _sampleMask(((uint64_t)1 << sampleShift) - 1), _sketch(widthPower, depth), _topk(k) {}
+        ~HotKeyDetector() {}
+
+        void record(const Key &key)
+        {
+            if ((NextRandom() & _sampleMask) == 0)
+            {
+                record_sampled(key);
+            }
+        }
+
+        // Count every call, no sampling
+        void record_sampled(const Key &key);
+
+        // Hottest keys first
+        std::vector<HotKey> top() const;
+        // Halve sketch and tracker, call periodically to follow shifting load
+        void decay();
+        void clear();
+
+        uint64_t sample_rate() const { return _sampleMask + 1; }
+        uint64_t sampled() const { return _sketch.total(); }
+        const CountMinSketch<Key, Hash> &sketch() const { return _sketch; }
+
+    private:
+        // xorshift64, one state per thread
+        static uint64_t NextRandom()
+        {
+            static thread_local uint64_t state = RandomSeed() | 1;
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        }
+
+    private:
+        uint64_t _sampleMask = 0;
+        CountMinSketch<Key, Hash> _sketch;
+        mutable std::mutex _mutex = {};
+        TopKTracker<Key, KeyEqual> _topk;
+        // tracker min_count() cached for the lock free filter
+        std::atomic<uint64_t> _threshold{0};
+    };
+
+    template <class Key, class Hash, class KeyEqual>
+    void HotKeyDetector<Key, Hash, KeyEqual>::record_sampled(const Key &key)
+    {
+        size_t hash = _sketch.hash(key);
+        _sketch.add_hash(hash);
+        uint64_t estimate = _sketch.estimate_hash(hash);
+        if (estimate < _threshold.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lck(_mutex);
+        _topk.add(key);
+        _threshold.store(_topk.min_count(), std::memory_order_relaxed);
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    std::vector<typename HotKeyDetector<Key, Hash, KeyEqual>::HotKey> HotKeyDetector<Key, Hash, KeyEqual>::top() const
+    {
+        std::vector<typename TopKTracker<Key, KeyEqual>::Entry> entries;
+        {
+            std::lock_guard<std::mutex> lck(_mutex);
+            entries = _topk.top();
+        }
+        // the tracker only sees keys past the threshold, rank by the sketch
+        std::vector<HotKey> hot;
+        for (auto &e : entries)
+        {
+            hot.push_back(HotKey{e.key, _sketch.estimate(e.key)});
+        }
+        std::sort(hot.begin(), hot.end(), [](const HotKey &a, const HotKey &b)
+                  { return a.estimate > b.estimate; });
+        return hot;
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HotKeyDetector<Key, Hash, KeyEqual>::decay()
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        _sketch.decay();
+        _topk.decay();
+        _threshold.store(_topk.min_count(), std::memory_order_relaxed);
+    }
+
+    template <class Key, class Hash, class KeyEqual>
+    void HotKeyDetector<Key, Hash, KeyEqual>::clear()
+    {
+        std::lock_guard<std::mutex> lck(_mutex);
+        _sketch.clear();
+        _topk.clear();
+        _threshold.store(0, std::memory_order_relaxed);
+    }
+} // namespace sunflower
+#endif // HOTKEYDETECTOR_H
@@ -0,0 +1,253 @@
+#ifndef MMAPALLOCATOR_H
+#define MMAPALLOCATOR_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+namespace sunflower
+{
+    /**
+     * Allocation policy flags for bucket arrays and queue rings, may be or-ed.
+     * MEM_DEFAULT keeps the plain heap allocation, any other flag switches to mmap.
+     */
+    enum MemoryFlag : unsigned
+    {
+        MEM_DEFAULT = 0,
+        MEM_HUGEPAGE = 1u << 0, // hugetlbfs pages if reserved, else transparent huge pages
+        MEM_POPULATE = 1u << 1, // pre-fault every page at allocation time
+        MEM_LOCK = 1u << 2,     // mlock, never swapped out
+    };
+
+    enum class MemoryBacking : unsigned
+    {
+        NONE = 0,
+        HEAP,   // operator new
+        PAGES,  // mmap with base pages
+        THP,    // mmap + MADV_HUGEPAGE, transparent huge pages enabled
+        HUGETLB // mmap with MAP_HUGETLB
+    };
+
+    // What the kernel actually gave us for the latest allocation
+    struct MemoryInfo
+    {
+        MemoryBacking backing = MemoryBacking::NONE;
+        bool populated = false;
+        bool locked = false;
+        size_t bytes = 0;
+    };
+
+    const size_t kHugePageSize = 2UL << 20;
+
+    inline const char *MemoryBackingName(MemoryBacking backing)
+    {
+        switch (backing)
+        {
+        case MemoryBacking::HEAP:
+            return "heap";
+        case MemoryBacking::PAGES:
+            return "pages";
+        case MemoryBacking::THP:
+            return "thp";
+        case MemoryBacking::HUGETLB:
+            return "hugetlb";
+        default:
+            return "none";
+        }
+    }
+
+    // madvise succeeds even when THP is "never", so read the sysfs switch once
+    inline bool TransparentHugePageEnabled()
+    {
+        static const bool enabled = []
+        {
+            char buf[128] = {};
+            FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+            if (fp == nullptr)
+            {
+                return false;
+            }
+            size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+            fclose(fp);
+            buf[n] = '\0';
+            return strstr(buf, "[never]") == nullptr;
+        }();
+        return enabled;
+    }
+
+    inline size_t MemoryMapSize(size_t bytes, unsigned flags)
+    {
+        size_t align = (flags & MEM_HUGEPAGE) ? kHugePageSize : (size_t)sysconf(_SC_PAGESIZE);
+        return (bytes + align - 1) & ~(align - 1);
+    }
+
+    inline void MemoryPopulate(void *ptr, size_t bytes)
+    {
+        if (madvise(ptr, bytes, MADV_POPULATE_WRITE) == 0)
+        {
+            return;
+        }
+        // kernel older than 5.14, touch every page by hand
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        for (size_t off = 0; off < bytes; off += page)
+        {
+            ((volatile char *)ptr)[off] = 0;
+        }
+    }
+
+    /**
+     * Allocate bytes following flags, fills info with the backing obtained.
+     * Returns nullptr on failure.
+     */
+    inline void *MemoryAlloc(size_t bytes, unsigned flags, MemoryInfo *info)
+    {
+        MemoryInfo got;
+        void *ptr = nullptr;
+
+        if (flags == MEM_DEFAULT)
+        {
+            ptr = ::operator new(bytes, std::nothrow);
+            got.backing = MemoryBacking::HEAP;
+            got.bytes = bytes;
+            if (info)
+                *info = got;
+            return ptr;
+        }
+
+        size_t size = MemoryMapSize(bytes, flags);
+        got.bytes = size;
+
+        if (flags & MEM_HUGEPAGE)
+        {
+            int extra = (flags & MEM_POPULATE) ? MAP_POPULATE : 0;
+            ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | extra, -1, 0);
+            if (ptr != MAP_FAILED)
+            {
+                got.backing = MemoryBacking::HUGETLB;
+                got.populated = (flags & MEM_POPULATE) != 0;
+            }
+            else
+            {
+                // no reserved hugetlbfs pages, map 2M aligned and ask for THP
+                size_t span = size + kHugePageSize;
+                char *raw = (char *)mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (raw == MAP_FAILED)
+                {
+                    return nullptr;
+                }
+                char *aligned = (char *)(((uintptr_t)raw + kHugePageSize - 1) & ~(kHugePageSize - 1));
+                if (aligned > raw)
+                {
+                    munmap(raw, aligned - raw);
+                }
+                if (raw + span > aligned + size)
+                {
+                    munmap(aligned + size, raw + span - (aligned + size));
+                }
+                ptr = aligned;
+                bool thp = madvise(ptr, size, MADV_HUGEPAGE) == 0 && TransparentHugePageEnabled();
+                got.backing = thp ? MemoryBacking::THP : MemoryBacking::PAGES;
+                // populate after madvise, MAP_POPULATE would fault in base pages
+                if (flags & MEM_POPULATE)
+                {
+                    MemoryPopulate(ptr, size);
+                    got.populated = true;
+                }
+            }
+        }
+        else
+        {
+            int extra = (flags & MEM_POPULATE) ? MAP_POPULATE : 0;
+            ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra, -1, 0);
+            if (ptr == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            got.backing = MemoryBacking::PAGES;
+            got.populated = (flags & MEM_POPULATE) != 0;
+        }
+
+        if (flags & MEM_LOCK)
+        {
+            // RLIMIT_MEMLOCK may refuse, the mapping is still usable
+            got.locked = mlock(ptr, size) == 0;
+        }
+
+        if (info)
+            *info = got;
+        return ptr;
+    }
+
+    inline void MemoryFree(void *ptr, size_t bytes, unsigned flags)
+    {
+        if (ptr == nullptr)
+            return;
+        if (flags == MEM_DEFAULT)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        munmap(ptr, MemoryMapSize(bytes, flags));
+    }
+
+    /**
+     * std allocator on top of MemoryAlloc. Copies share one MemoryInfo so a
+     * container can report the backing of its latest allocation.
+     */
+    template <class T>
+    class MmapAllocator
+    {
+    public:
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+
+        template <class U>
+        struct rebind
+        {
+            using other = MmapAllocator<U>;
+        };
+
+        explicit MmapAllocator(unsigned flags = MEM_DEFAULT) : _flags(flags), _info(std::make_shared<MemoryInfo>()) {}
+        template <class U>
+        MmapAllocator(const MmapAllocator<U> &other) noexcept : _flags(other.flags()), _info(other.shared_info()) {}
+
+        T *allocate(size_t n)
+        {
+            void *ptr = MemoryAlloc(n * sizeof(T), _flags, _info.get());
+            if (ptr == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+            return static_cast<T *>(ptr);
+        }
+
+        void deallocate(T *ptr, size_t n) noexcept { MemoryFree(ptr, n * sizeof(T), _flags); }
+
+        unsigned flags() const { return _flags; }
+        MemoryInfo info() const { return *_info; }
+        const std::shared_ptr<MemoryInfo> &shared_info() const { return _info; }
+
+        template <class U>
+        bool operator==(const MmapAllocator<U> &other) const { return _flags == other.flags() && _info == other.shared_info(); }
+        template <class U>
+        bool operator!=(const MmapAllocator<U> &other) const { return !(*this == other); }
+
+    private:
+        unsigned _flags = MEM_DEFAULT;
+        std::shared_ptr<MemoryInfo> _info;
+    };
+} // namespace sunflower
+#endif // MMAPALLOCATOR_H
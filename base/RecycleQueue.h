@@ -8,6 +8,7 @@
 #include <assert.h>
 
 #include "Common.h"
+#include "MmapAllocator.h"
 
 namespace sunflower
 {
@@ -16,7 +17,8 @@ namespace sunflower
     class RecycleQueue
     {
     public:
-        explicit RecycleQueue(uint32_t power = 10)
+        explicit RecycleQueue(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : queue_(MmapAllocator<stType>(memFlags))
         {
             capacity_ = 1 << power;
             mask_ = capacity_ - 1;
@@ -43,6 +45,9 @@ namespace sunflower
 
         size_t size() const { return POS_MOD_BASE(writePos_ - readPos_); }
 
+        // Memory backing of the ring
+        MemoryInfo memoryInfo() const { return queue_.get_allocator().info(); }
+
         bool tryPush(const stType &node) { return push_(node); }
         bool tryPush(stType &&node) { return push_(std::move(node)); }
 
@@ -64,6 +69,40 @@ namespace sunflower
             readPos_ = POS_MOD_BASE(readPos_ + 1);
         }
 
+        // Batches publish the position once and return the number of items
+        // moved; pass std::make_move_iterator to move instead of copy
+        template <typename Iter>
+        size_t tryPushN(Iter first, Iter last)
+        {
+            size_t room = capacity_ - 1 - size();
+            size_t n = 0;
+            for (; first != last && n < room; ++first, n++)
+            {
+                queue_[POS_MOD_BASE(writePos_ + n)] = *first;
+            }
+            writePos_ = POS_MOD_BASE(writePos_ + n);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t tryPopN(OutIter out, size_t max)
+        {
+            size_t n = size();
+            if (n > max)
+            {
+                n = max;
+            }
+            for (size_t i = 0; i < n; i++, ++out)
+            {
+                *out = std::move(queue_[POS_MOD_BASE(readPos_ + i)]);
+            }
+            readPos_ = POS_MOD_BASE(readPos_ + n);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t popAll(OutIter out) { return tryPopN(out, capacity_); }
+
     private:
         template <typename T>
         bool push_(T &&node) //万能引用
@@ -79,7 +118,7 @@ namespace sunflower
         }
 
     private:
-        std::vector<stType> queue_;
+        std::vector<stType, MmapAllocator<stType>> queue_;
         volatile size_t readPos_ = 0;
         volatile size_t writePos_ = 0;
         size_t capacity_ = 0;
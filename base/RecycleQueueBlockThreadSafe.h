@@ -5,9 +5,11 @@
 #include <string.h>
 #include <vector>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
 
 #include "Common.h"
+#include "EventCount.h"
+#include "MmapAllocator.h"
 
 namespace sunflower
 {
@@ -16,7 +18,8 @@ namespace sunflower
     class RecycleQueueBlockThreadSafe
     {
     public:
-        explicit RecycleQueueBlockThreadSafe(uint32_t power = 10)
+        explicit RecycleQueueBlockThreadSafe(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : queue_(MmapAllocator<stType>(memFlags))
         {
             if (power > 32)
             {
@@ -39,14 +42,24 @@ namespace sunflower
         void clear()
         {
             stType node;
-            while (tryPop(&node))
+            while (tryPop(node))
                 ;
         }
 
         size_t size() const
         {
             std::lock_guard<std::mutex> lck(mutex);
-            return POS_MOD_BASE(writePos_ - readPos_);
+            return POS_MOD_BASE(writePos_.load(std::memory_order_relaxed) - readPos_.load(std::memory_order_relaxed));
+        }
+
+        // Memory backing of the ring
+        MemoryInfo memoryInfo() const { return queue_.get_allocator().info(); }
+
+        // How waitPush / waitPop wait, set before the queue is shared
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            policy_ = policy;
+            spins_ = spins;
         }
 
         bool full() const
@@ -72,76 +85,169 @@ namespace sunflower
             return value;
         }
 
+        // Batches take the lock and wake the other side once per run and
+        // return the number of items moved; pass std::make_move_iterator
+        // to move instead of copy
+        template <typename Iter>
+        size_t tryPushN(Iter first, Iter last)
+        {
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> lck(mutex);
+                n = pushNosafe(first, last);
+            }
+            notify(ev_empty, n);
+            return n;
+        }
+
+        // Blocks until every item is in, one lock and wakeup per run that fits
+        template <typename Iter>
+        void waitPushN(Iter first, Iter last)
+        {
+            while (first != last)
+            {
+                size_t n = 0;
+                {
+                    std::lock_guard<std::mutex> lck(mutex);
+                    n = pushNosafe(first, last);
+                }
+                notify(ev_empty, n);
+                if (first != last)
+                {
+                    ev_full.Await([this]
+                                  { return !fullNosafe(); },
+                                  policy_, spins_);
+                }
+            }
+        }
+
+        template <typename OutIter>
+        size_t tryPopN(OutIter out, size_t max)
+        {
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> lck(mutex);
+                size_t readPos = readPos_.load(std::memory_order_relaxed);
+                size_t writePos = writePos_.load(std::memory_order_relaxed);
+                for (; n < max && readPos != writePos; n++, ++out)
+                {
+                    *out = std::move(queue_[readPos]);
+                    readPos = POS_MOD_BASE(readPos + 1);
+                }
+                readPos_.store(readPos, std::memory_order_relaxed);
+            }
+            notify(ev_full, n);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t popAll(OutIter out) { return tryPopN(out, capacity_); }
+
     private:
+        // advances first past the items pushed
+        template <typename Iter>
+        size_t pushNosafe(Iter &first, Iter last)
+        {
+            size_t n = 0;
+            size_t writePos = writePos_.load(std::memory_order_relaxed);
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            for (; first != last && POS_MOD_BASE(writePos + 1) != readPos; ++first, n++)
+            {
+                queue_[writePos] = *first;
+                writePos = POS_MOD_BASE(writePos + 1);
+            }
+            writePos_.store(writePos, std::memory_order_relaxed);
+            return n;
+        }
+
+        static void notify(EventCount &ev, size_t n)
+        {
+            if (n == 1)
+            {
+                ev.NotifyOne();
+            }
+            else if (n > 1)
+            {
+                ev.NotifyAll();
+            }
+        }
+
+        // without the lock these are hints, waiters recheck under it
         bool fullNosafe() const
         {
-            return POS_MOD_BASE(writePos_ + 1) == readPos_;
+            return POS_MOD_BASE(writePos_.load(std::memory_order_relaxed) + 1) == readPos_.load(std::memory_order_relaxed);
         }
         bool emptyNosafe() const
         {
-            return writePos_ == readPos_;
+            return writePos_.load(std::memory_order_relaxed) == readPos_.load(std::memory_order_relaxed);
         }
 
         template <typename T>
         bool push_(T &&node, bool block) //万能引用
         {
+            for (;;)
             {
-                std::unique_lock<std::mutex> lck(mutex);
-
-                if (!block)
                 {
-                    if (fullNosafe())
-                    { //full
-                        return false;
+                    std::lock_guard<std::mutex> lck(mutex);
+                    if (!fullNosafe())
+                    {
+                        size_t writePos = writePos_.load(std::memory_order_relaxed);
+                        queue_[writePos] = std::forward<T>(node);
+                        writePos_.store(POS_MOD_BASE(writePos + 1), std::memory_order_relaxed);
+                        break;
                     }
                 }
-                else
-                {
-                    cv_full.wait(lck, [this]
-                                 { return !(POS_MOD_BASE(writePos_ + 1) == readPos_); });
+                if (!block)
+                { //full
+                    return false;
                 }
-
-                queue_[writePos_] = std::forward<T>(node);
-                writePos_ = POS_MOD_BASE(writePos_ + 1);
+                ev_full.Await([this]
+                              { return !fullNosafe(); },
+                              policy_, spins_);
             }
-            cv_empty.notify_one();
+            ev_empty.NotifyOne();
             return true;
         }
 
         bool pop_(stType &node, bool block)
         {
+            for (;;)
             {
-                std::unique_lock<std::mutex> lck(mutex);
-
-                if (!block)
                 {
-                    if (emptyNosafe())
-                    { //empty
-                        return false;
+                    std::lock_guard<std::mutex> lck(mutex);
+                    if (!emptyNosafe())
+                    {
+                        size_t readPos = readPos_.load(std::memory_order_relaxed);
+                        node = std::move(queue_[readPos]);
+                        readPos_.store(POS_MOD_BASE(readPos + 1), std::memory_order_relaxed);
+                        break;
                     }
                 }
-                else
-                {
-                    cv_empty.wait(lck, [this]
-                                  { return !(writePos_ == readPos_); });
+                if (!block)
+                { //empty
+                    return false;
                 }
-                node = std::move(queue_[readPos_]);
-                readPos_ = POS_MOD_BASE(readPos_ + 1);
+                ev_empty.Await([this]
+                               { return !emptyNosafe(); },
+                               policy_, spins_);
             }
-            cv_full.notify_one();
+            ev_full.NotifyOne();
             return true;
         }
 
     private:
-        std::vector<stType> queue_;
-        size_t readPos_ = 0;
-        size_t writePos_ = 0;
+        std::vector<stType, MmapAllocator<stType>> queue_;
+        // written under the mutex, read without it by waiters
+        std::atomic<size_t> readPos_{0};
+        std::atomic<size_t> writePos_{0};
         uint32_t capacity_ = 0;
         uint32_t mask_ = 0;
 
         mutable std::mutex mutex = {};
-        std::condition_variable cv_empty = {};
-        std::condition_variable cv_full = {};
+        EventCount ev_empty;
+        EventCount ev_full;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
     };
 } //namespace sunflower
 #endif // RECYCLEQUEUE_BLOCK_THREADSAFE_H
@@ -6,10 +6,11 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
-#include <condition_variable>
 #include <memory>
 
 #include "Common.h"
+#include "EventCount.h"
+#include "MmapAllocator.h"
 
 namespace sunflower
 {
@@ -18,7 +19,8 @@ namespace sunflower
     class RecycleQueueBlockThreadSafeTwo
     {
     public:
-        explicit RecycleQueueBlockThreadSafeTwo(uint32_t power = 10) : readPos_(0), writePos_(0), used_(0)
+        explicit RecycleQueueBlockThreadSafeTwo(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : queue_(MmapAllocator<stType>(memFlags)), readPos_(0), writePos_(0), used_(0)
         {
             if (power > 32)
             {
@@ -40,7 +42,7 @@ namespace sunflower
 
         void clear()
         {
-            std::shared_ptr<stType> node = std::make_shared<stType>();
+            stType node;
             while (tryPop(node))
                 ;
         }
@@ -50,6 +52,16 @@ namespace sunflower
             return used_.load();
         }
 
+        // Memory backing of the ring
+        MemoryInfo memoryInfo() const { return queue_.get_allocator().info(); }
+
+        // How waitPush / waitPop wait, set before the queue is shared
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            policy_ = policy;
+            spins_ = spins;
+        }
+
         bool tryPush(const stType &node) { return tryPushTail(node); }
         bool tryPush(stType &&node) { return tryPushTail(std::move(node)); }
         void waitPush(const stType &node) { waitPushTail(node); }
@@ -62,6 +74,67 @@ namespace sunflower
             return value;
         }
 
+        // Batches take each side's lock, publish used_ and wake the other
+        // side once per run and return the number of items moved; pass
+        // std::make_move_iterator to move instead of copy
+        template <typename Iter>
+        size_t tryPushN(Iter first, Iter last)
+        {
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> lck(mutexRead);
+                n = pushNosafe(first, last);
+            }
+            notify(evEmpty, n);
+            return n;
+        }
+
+        // Blocks until every item is in, one lock and wakeup per run that fits
+        template <typename Iter>
+        void waitPushN(Iter first, Iter last)
+        {
+            while (first != last)
+            {
+                size_t n = 0;
+                {
+                    std::lock_guard<std::mutex> lck(mutexRead);
+                    n = pushNosafe(first, last);
+                }
+                notify(evEmpty, n);
+                if (first != last)
+                {
+                    evFull.Await([this]
+                                 { return !full(); },
+                                 policy_, spins_);
+                }
+            }
+        }
+
+        template <typename OutIter>
+        size_t tryPopN(OutIter out, size_t max)
+        {
+            size_t n = 0;
+            {
+                std::lock_guard<std::mutex> lck(mutexWrite);
+                n = used_.load();
+                if (n > max)
+                {
+                    n = max;
+                }
+                for (size_t i = 0; i < n; i++, ++out)
+                {
+                    *out = std::move(queue_[readPos_]);
+                    readPos_ = POS_MOD_BASE(readPos_ + 1);
+                }
+                used_ -= n;
+            }
+            notify(evFull, n);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t popAll(OutIter out) { return tryPopN(out, capacity_); }
+
         bool full() const
         {
             return used_.load() == capacity_;
@@ -72,21 +145,45 @@ namespace sunflower
         }
 
     private:
+        // advances first past the items pushed, caller holds mutexRead
+        template <typename Iter>
+        size_t pushNosafe(Iter &first, Iter last)
+        {
+            size_t room = capacity_ - used_.load();
+            size_t n = 0;
+            for (; first != last && n < room; ++first, n++)
+            {
+                queue_[writePos_] = *first;
+                writePos_ = POS_MOD_BASE(writePos_ + 1);
+            }
+            used_ += n;
+            return n;
+        }
+
+        static void notify(EventCount &ev, size_t n)
+        {
+            if (n == 1)
+            {
+                ev.NotifyOne();
+            }
+            else if (n > 1)
+            {
+                ev.NotifyAll();
+            }
+        }
+
         template <typename T>
         void waitPushTail(T &&node)
         {
+            while (!tryPushTail(std::forward<T>(node)))
             {
-                std::unique_lock<std::mutex> lck(mutexRead);
-                cvFull.wait(lck, [this]
-                            { return !full(); });
-
-                queue_[writePos_] = std::forward<T>(node);
-                writePos_ = POS_MOD_BASE(writePos_ + 1);
-                used_++;
+                evFull.Await([this]
+                             { return !full(); },
+                             policy_, spins_);
             }
-            cvEmpty.notify_one();
         }
 
+        // moves from node only on success
         template <typename T>
         bool tryPushTail(T &&node)
         {
@@ -102,7 +199,7 @@ namespace sunflower
                 writePos_ = POS_MOD_BASE(writePos_ + 1);
                 used_++;
             }
-            cvEmpty.notify_one();
+            evEmpty.NotifyOne();
             return true;
         }
 
@@ -119,26 +216,22 @@ namespace sunflower
                 readPos_ = POS_MOD_BASE(readPos_ + 1);
                 used_--;
             }
-            cvFull.notify_one();
+            evFull.NotifyOne();
             return true;
         }
 
         void waitPopHead(stType &node)
         {
+            while (!tryPopHead(node))
             {
-                std::unique_lock<std::mutex> lck(mutexWrite);
-                cvEmpty.wait(lck, [this]
-                             { return !empty(); });
-
-                node = std::move(queue_[readPos_]);
-                readPos_ = POS_MOD_BASE(readPos_ + 1);
-                used_--;
+                evEmpty.Await([this]
+                              { return !empty(); },
+                              policy_, spins_);
             }
-            cvFull.notify_one();
         }
 
     private:
-        std::vector<stType> queue_;
+        std::vector<stType, MmapAllocator<stType>> queue_;
         size_t readPos_;
         size_t writePos_;
         uint32_t capacity_ = 0;
@@ -147,8 +240,10 @@ namespace sunflower
 
         std::mutex mutexRead = {};
         std::mutex mutexWrite = {};
-        std::condition_variable cvEmpty = {};
-        std::condition_variable cvFull = {};
+        EventCount evEmpty;
+        EventCount evFull;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
     };
 } //namespace sunflower
 #endif // RECYCLEQUEUE_BLOCK_THREADSAFE_H
@@ -0,0 +1,218 @@
+#ifndef RECYCLEQUEUE_MPMC_H
+#define RECYCLEQUEUE_MPMC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+#include "Common.h"
+#include "EventCount.h"
+#include "MmapAllocator.h"
+
+namespace sunflower
+{
+    /**
+     * Bounded lock-free ring for any number of producers and consumers.
+     * Every slot carries a sequence number: pos when free for the push
+     * claiming pos, pos + 1 once filled for the pop claiming pos, so a
+     * push or pop is one CAS on its own position and no shared counter.
+     * waitPush / waitPop wait on an EventCount by the WaitPolicy, the other
+     * side only makes a syscall when somebody sleeps.
+     */
+    template <typename stType>
+    class RecycleQueueMPMC
+    {
+    public:
+        explicit RecycleQueueMPMC(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : alloc_(memFlags)
+        {
+            if (power > 32)
+            {
+                power = 32;
+            }
+            capacity_ = (size_t)1 << power;
+            mask_ = capacity_ - 1;
+            slots_ = alloc_.allocate(capacity_);
+            for (size_t i = 0; i < capacity_; i++)
+            {
+                new (&slots_[i]) Slot(i);
+            }
+        }
+
+        RecycleQueueMPMC(const RecycleQueueMPMC &other) = delete;
+        RecycleQueueMPMC(RecycleQueueMPMC &&other) = delete;
+        RecycleQueueMPMC &operator=(const RecycleQueueMPMC &other) = delete;
+        RecycleQueueMPMC &operator=(RecycleQueueMPMC &&other) = delete;
+
+        ~RecycleQueueMPMC()
+        {
+            for (size_t i = 0; i < capacity_; i++)
+            {
+                slots_[i].~Slot();
+            }
+            alloc_.deallocate(slots_, capacity_);
+        }
+
+        void clear()
+        {
+            stType node;
+            while (tryPop(node))
+                ;
+        }
+
+        // Approximate while pushes or pops run
+        size_t size() const
+        {
+            size_t readPos = dequeuePos_.load();
+            size_t writePos = enqueuePos_.load();
+            return (intptr_t)(writePos - readPos) > 0 ? writePos - readPos : 0;
+        }
+
+        // Memory backing of the ring
+        MemoryInfo memoryInfo() const { return alloc_.info(); }
+
+        // How waitPush / waitPop wait, set before the queue is shared
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            policy_ = policy;
+            spins_ = spins;
+        }
+
+        bool full() const
+        {
+            size_t writePos = enqueuePos_.load();
+            return (intptr_t)(writePos - dequeuePos_.load()) >= (intptr_t)capacity_;
+        }
+        bool empty() const
+        {
+            size_t readPos = dequeuePos_.load();
+            return (intptr_t)(enqueuePos_.load() - readPos) <= 0;
+        }
+
+        bool tryPush(const stType &node) { return push_(node, false); }
+        bool tryPush(stType &&node) { return push_(std::move(node), false); }
+        void waitPush(const stType &node) { push_(node, true); }
+        void waitPush(stType &&node) { push_(std::move(node), true); }
+        bool tryPop(stType &node) { return pop_(node, false); }
+        stType waitPop()
+        {
+            stType value{};
+            pop_(value, true);
+            return value;
+        }
+
+    private:
+        struct Slot
+        {
+            explicit Slot(size_t pos) : seq(pos) {}
+            std::atomic<size_t> seq;
+            stType value{};
+        };
+
+        template <typename T>
+        bool enqueue_(T &&node)
+        {
+            size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = slots_[POS_MOD_BASE(pos)];
+                intptr_t dif = (intptr_t)(slot.seq.load(std::memory_order_acquire) - pos);
+                if (dif == 0)
+                {
+                    if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        slot.value = std::forward<T>(node);
+                        slot.seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (dif < 0)
+                {
+                    // slot still holds the value from one lap ago
+                    return false;
+                }
+                else
+                {
+                    pos = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool dequeue_(stType &node)
+        {
+            size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Slot &slot = slots_[POS_MOD_BASE(pos)];
+                intptr_t dif = (intptr_t)(slot.seq.load(std::memory_order_acquire) - (pos + 1));
+                if (dif == 0)
+                {
+                    if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        node = std::move(slot.value);
+                        slot.seq.store(pos + capacity_, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (dif < 0)
+                {
+                    // not filled yet
+                    return false;
+                }
+                else
+                {
+                    pos = dequeuePos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        template <typename T>
+        bool push_(T &&node, bool wait)
+        {
+            while (!enqueue_(std::forward<T>(node)))
+            {
+                if (not wait)
+                {
+                    return false;
+                }
+                evFull.Await([this]
+                             { return !full(); },
+                             policy_, spins_);
+            }
+            evEmpty.NotifyOne();
+            return true;
+        }
+
+        bool pop_(stType &node, bool wait)
+        {
+            while (!dequeue_(node))
+            {
+                if (not wait)
+                {
+                    return false;
+                }
+                evEmpty.Await([this]
+                              { return !empty(); },
+                              policy_, spins_);
+            }
+            evFull.NotifyOne();
+            return true;
+        }
+
+    private:
+        MmapAllocator<Slot> alloc_;
+        Slot *slots_ = nullptr;
+        size_t capacity_ = 0;
+        size_t mask_ = 0;
+
+        alignas(64) std::atomic<size_t> enqueuePos_{0};
+        alignas(64) std::atomic<size_t> dequeuePos_{0};
+
+        alignas(64) EventCount evEmpty;
+        EventCount evFull;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
+    };
+} //namespace sunflower
+#endif //RECYCLEQUEUE_MPMC_H
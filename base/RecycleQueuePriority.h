@@ -0,0 +1,189 @@
+#ifndef RECYCLEQUEUE_PRIORITY_H
+#define RECYCLEQUEUE_PRIORITY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Common.h"
+#include "EventCount.h"
+#include "RecycleQueueMPMC.h"
+
+namespace sunflower
+{
+    /**
+     * Bounded priority queue for any number of producers and consumers:
+     * a fixed set of up to 64 levels, 0 the most urgent, each a
+     * RecycleQueueMPMC of 2^power slots, and a bitmap of levels that may
+     * hold items. A pop takes the lowest set bit and pops that ring, so it
+     * costs a load and a find-first-set on top of a plain ring pop; FIFO
+     * holds within a level, lower levels wait while higher ones have items.
+     * A bit is set by the push that finds it clear and cleared by the pop
+     * that finds its ring empty, which sets it again if a push slipped in.
+     * waitPush waits on its level's ring, waitPop on an EventCount of the
+     * bitmap, both by the WaitPolicy.
+     */
+    template <typename stType>
+    class RecycleQueuePriority
+    {
+    public:
+        static const uint32_t kMaxLevels = 64;
+
+        explicit RecycleQueuePriority(uint32_t levels = 8, uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+        {
+            if (levels == 0)
+            {
+                levels = 1;
+            }
+            if (levels > kMaxLevels)
+            {
+                levels = kMaxLevels;
+            }
+            levels_.resize(levels);
+            for (auto &e : levels_)
+            {
+                e.reset(new RecycleQueueMPMC<stType>(power, memFlags));
+            }
+        }
+
+        RecycleQueuePriority(const RecycleQueuePriority &other) = delete;
+        RecycleQueuePriority(RecycleQueuePriority &&other) = delete;
+        RecycleQueuePriority &operator=(const RecycleQueuePriority &other) = delete;
+        RecycleQueuePriority &operator=(RecycleQueuePriority &&other) = delete;
+
+        ~RecycleQueuePriority()
+        {
+        }
+
+        void clear()
+        {
+            stType node;
+            while (tryPop(node))
+                ;
+        }
+
+        uint32_t levels() const { return levels_.size(); }
+
+        // Approximate while pushes or pops run
+        size_t size() const
+        {
+            size_t num = 0;
+            for (auto &e : levels_)
+            {
+                num += e->size();
+            }
+            return num;
+        }
+        size_t size(uint32_t level) const { return levels_[clamp(level)]->size(); }
+
+        bool full(uint32_t level) const { return levels_[clamp(level)]->full(); }
+        bool empty() const
+        {
+            for (auto &e : levels_)
+            {
+                if (not e->empty())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // How waitPush / waitPop wait, set before the queue is shared
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            for (auto &e : levels_)
+            {
+                e->setWaitPolicy(policy, spins);
+            }
+            policy_ = policy;
+            spins_ = spins;
+        }
+
+        // level past the last one goes to the last one
+        bool tryPush(const stType &node, uint32_t level) { return push_(node, level, false); }
+        bool tryPush(stType &&node, uint32_t level) { return push_(std::move(node), level, false); }
+        void waitPush(const stType &node, uint32_t level) { push_(node, level, true); }
+        void waitPush(stType &&node, uint32_t level) { push_(std::move(node), level, true); }
+
+        bool tryPop(stType &node) { return pop_(node, false); }
+        stType waitPop()
+        {
+            stType value{};
+            pop_(value, true);
+            return value;
+        }
+
+    private:
+        uint32_t clamp(uint32_t level) const { return level < levels_.size() ? level : levels_.size() - 1; }
+
+        template <typename T>
+        bool push_(T &&node, uint32_t level, bool wait)
+        {
+            level = clamp(level);
+            if (wait)
+            {
+                levels_[level]->waitPush(std::forward<T>(node));
+            }
+            else if (not levels_[level]->tryPush(std::forward<T>(node)))
+            {
+                return false;
+            }
+            uint64_t bit = (uint64_t)1 << level;
+            if (not(nonEmpty_.load() & bit))
+            {
+                nonEmpty_.fetch_or(bit);
+            }
+            evEmpty.NotifyOne();
+            return true;
+        }
+
+        bool dequeue_(stType &node)
+        {
+            uint64_t bits = nonEmpty_.load();
+            while (bits)
+            {
+                uint32_t level = __builtin_ctzll(bits);
+                if (levels_[level]->tryPop(node))
+                {
+                    return true;
+                }
+                uint64_t bit = (uint64_t)1 << level;
+                nonEmpty_.fetch_and(~bit);
+                // a push between the failed pop and the clear saw the bit still set
+                if (not levels_[level]->empty())
+                {
+                    nonEmpty_.fetch_or(bit);
+                }
+                bits = nonEmpty_.load() & ~(bit | (bit - 1));
+            }
+            return false;
+        }
+
+        bool pop_(stType &node, bool wait)
+        {
+            while (!dequeue_(node))
+            {
+                if (not wait)
+                {
+                    return false;
+                }
+                evEmpty.Await([this]
+                              { return nonEmpty_.load() != 0; },
+                              policy_, spins_);
+            }
+            return true;
+        }
+
+    private:
+        std::vector<std::unique_ptr<RecycleQueueMPMC<stType>>> levels_;
+
+        alignas(64) std::atomic<uint64_t> nonEmpty_{0};
+
+        alignas(64) EventCount evEmpty;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
+    };
+} //namespace sunflower
+#endif //RECYCLEQUEUE_PRIORITY_H
@@ -7,24 +7,35 @@
 #include <memory>
 
 #include "Common.h"
+#include "MmapAllocator.h"
+#include "RecycleQueueSPSC.h"
 
 namespace sunflower
 {
-
+    /**
+     * Zero-copy ring for one producer and one consumer thread: 2^power
+     * objects are allocated once, only pointers to them travel.
+     * The producer takes a free object with acquire(), fills it in place
+     * and hands it over with tryPush(); the consumer takes it with tryPop(),
+     * reads it in place and gives it back with recycle(), which returns it
+     * to the producer through a second ring. Steady state neither copies
+     * nor allocates; objects keep their contents (and capacity) across
+     * laps, so the producer overwrites rather than rebuilds them.
+     * acquire / tryPush are producer calls, tryPop / recycle consumer calls.
+     */
     template <typename stType>
     class RecycleQueuePtr
     {
     public:
-        explicit RecycleQueuePtr(uint32_t power = 10)
+        explicit RecycleQueuePtr(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : pool_(MmapAllocator<stType>(memFlags)), queue_(power, memFlags), free_(power, memFlags)
         {
-            capacity_ = 1 << power;
-            mask_ = capacity_ - 1;
-            queue_ = (stType **)new char[sizeof(stType) * capacity_];
-            if (queue_ == nullptr)
+            capacity_ = (size_t)1 << power;
+            pool_.resize(capacity_);
+            for (auto &node : pool_)
             {
-                return -1;
+                free_.tryPush(&node);
             }
-            memset(queue_.0, sizeof(stType) * capacity_);
         }
 
         RecycleQueuePtr(const RecycleQueuePtr &other) = delete;
@@ -36,59 +47,48 @@ namespace sunflower
         {
         }
 
+        // Not while either side runs, objects held by the consumer stay out
         void clear()
         {
             stType *node = nullptr;
             while (tryPop(node))
-                ;
+            {
+                recycle(node);
+            }
         }
 
-        bool full() const { return POS_MOD_BASE(writePos_ + 1) == readPos_; }
-        bool empty() const { return writePos_ == readPos_; }
+        // no free object left, every one is queued or held by the consumer
+        bool full() const { return free_.size() == 0; }
+        bool empty() const { return queue_.empty(); }
 
-        size_t size() const { return POS_MOD_BASE(writePos_ - readPos_); }
+        size_t size() const { return queue_.size(); }
+        size_t capacity() const { return capacity_; }
 
-        bool tryPush(const stType *node)
-        {
-            if (full())
-            {
-                return false;
-            }
+        // Memory backing of the object pool
+        MemoryInfo memoryInfo() const { return pool_.get_allocator().info(); }
 
-            queue_[writePos_] = node;
-            writePos_ = POS_MOD_BASE(writePos_ + 1);
-            return true;
-        }
-        bool tryPop(stType *node)
+        // A free object to fill, nullptr if all are in flight
+        stType *acquire()
         {
-            if (empty())
-            {
-                return false;
-            }
-            if (node)
-            {
-                *node = std::move(queue_[readPos_]);
-            }
-            readPos_ = POS_MOD_BASE(readPos_ + 1);
-            return true;
-        }
-        std::shared_ptr<stType> tryPop()
-        {
-            if (empty())
-            {
-                return std::shared_ptr<stType>();
-            }
-            std::shared_ptr<stType> node = std::make_shared<stType>(std::move(queue_[readPos_]));
-            readPos_ = POS_MOD_BASE(readPos_ + 1);
+            stType *node = nullptr;
+            free_.tryPop(node);
             return node;
         }
 
+        // node must come from acquire()
+        bool tryPush(stType *node) { return queue_.tryPush(node); }
+
+        bool tryPop(stType *&node) { return queue_.tryPop(node); }
+
+        // node must come from tryPop(), it may not be touched afterwards
+        void recycle(stType *node) { free_.tryPush(node); }
+
     private:
-        stType **queue_ = nullptr;
-        volatile size_t readPos_ = 0;
-        volatile size_t writePos_ = 0;
-        uint32_t capacity_ = 0;
-        uint32_t mask_ = 0;
+        std::vector<stType, MmapAllocator<stType>> pool_;
+        RecycleQueueSPSC<stType *> queue_;
+        // consumed objects on their way back to the producer
+        RecycleQueueSPSC<stType *> free_;
+        size_t capacity_ = 0;
     };
 } //namespace sunflower
 #endif //RECYCLEQUEUEPTR_H
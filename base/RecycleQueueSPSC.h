@@ -0,0 +1,195 @@
+#ifndef RECYCLEQUEUE_SPSC_H
+#define RECYCLEQUEUE_SPSC_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <assert.h>
+
+#include "Common.h"
+#include "MmapAllocator.h"
+
+namespace sunflower
+{
+    /**
+     * Lock-free ring for exactly one producer and one consumer thread.
+     * Positions are free-running atomics published with release and read
+     * with acquire, each on its own cache line next to the owner's cached
+     * copy of the other side's position, so a push or pop only touches the
+     * other line when the ring looks full or empty from the cache.
+     * tryPush / full are producer calls, tryPop / top / pop / empty are
+     * consumer calls, likewise their N / All batches; size may be called
+     * from anywhere, clear from neither while the other side runs.
+     */
+    template <typename stType>
+    class RecycleQueueSPSC
+    {
+    public:
+        explicit RecycleQueueSPSC(uint32_t power = 10, unsigned memFlags = MEM_DEFAULT)
+            : queue_(MmapAllocator<stType>(memFlags))
+        {
+            capacity_ = (size_t)1 << power;
+            mask_ = capacity_ - 1;
+            queue_.resize(capacity_);
+        }
+
+        RecycleQueueSPSC(const RecycleQueueSPSC &other) = delete;
+        RecycleQueueSPSC(RecycleQueueSPSC &&other) = delete;
+        RecycleQueueSPSC &operator=(const RecycleQueueSPSC &other) = delete;
+        RecycleQueueSPSC &operator=(RecycleQueueSPSC &&other) = delete;
+
+        ~RecycleQueueSPSC()
+        {
+        }
+
+        void clear()
+        {
+            writePos_.store(0, std::memory_order_relaxed);
+            readPos_.store(0, std::memory_order_relaxed);
+            cachedReadPos_ = 0;
+            cachedWritePos_ = 0;
+        }
+
+        bool full() const
+        {
+            size_t writePos = writePos_.load(std::memory_order_relaxed);
+            if (writePos - cachedReadPos_ < capacity_)
+            {
+                return false;
+            }
+            cachedReadPos_ = readPos_.load(std::memory_order_acquire);
+            return writePos - cachedReadPos_ == capacity_;
+        }
+
+        bool empty() const
+        {
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            if (readPos != cachedWritePos_)
+            {
+                return false;
+            }
+            cachedWritePos_ = writePos_.load(std::memory_order_acquire);
+            return readPos == cachedWritePos_;
+        }
+
+        size_t size() const
+        {
+            size_t readPos = readPos_.load(std::memory_order_acquire);
+            return writePos_.load(std::memory_order_acquire) - readPos;
+        }
+
+        // Memory backing of the ring
+        MemoryInfo memoryInfo() const { return queue_.get_allocator().info(); }
+
+        bool tryPush(const stType &node) { return push_(node); }
+        bool tryPush(stType &&node) { return push_(std::move(node)); }
+
+        bool tryPop(stType &node)
+        {
+            if (empty())
+            {
+                return false;
+            }
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            node = std::move(queue_[POS_MOD_BASE(readPos)]);
+            readPos_.store(readPos + 1, std::memory_order_release);
+            return true;
+        }
+
+        stType &top()
+        {
+            assert(LIKELY(not empty()));
+            return queue_[POS_MOD_BASE(readPos_.load(std::memory_order_relaxed))];
+        }
+
+        const stType &top() const
+        {
+            assert(LIKELY(not empty()));
+            return queue_[POS_MOD_BASE(readPos_.load(std::memory_order_relaxed))];
+        }
+
+        void pop()
+        {
+            assert(LIKELY(not empty()));
+            readPos_.store(readPos_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Batches publish the position once and return the number of items
+        // moved; pass std::make_move_iterator to move instead of copy
+        template <typename Iter>
+        size_t tryPushN(Iter first, Iter last)
+        {
+            size_t writePos = writePos_.load(std::memory_order_relaxed);
+            size_t n = 0;
+            for (; first != last; ++first, n++)
+            {
+                if (writePos + n - cachedReadPos_ == capacity_)
+                {
+                    cachedReadPos_ = readPos_.load(std::memory_order_acquire);
+                    if (writePos + n - cachedReadPos_ == capacity_)
+                    {
+                        break;
+                    }
+                }
+                queue_[POS_MOD_BASE(writePos + n)] = *first;
+            }
+            writePos_.store(writePos + n, std::memory_order_release);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t tryPopN(OutIter out, size_t max)
+        {
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            if (cachedWritePos_ - readPos < max)
+            {
+                cachedWritePos_ = writePos_.load(std::memory_order_acquire);
+            }
+            size_t n = cachedWritePos_ - readPos;
+            if (n > max)
+            {
+                n = max;
+            }
+            for (size_t i = 0; i < n; i++, ++out)
+            {
+                *out = std::move(queue_[POS_MOD_BASE(readPos + i)]);
+            }
+            readPos_.store(readPos + n, std::memory_order_release);
+            return n;
+        }
+
+        template <typename OutIter>
+        size_t popAll(OutIter out) { return tryPopN(out, capacity_); }
+
+    private:
+        template <typename T>
+        bool push_(T &&node)
+        {
+            if (full())
+            {
+                return false;
+            }
+
+            size_t writePos = writePos_.load(std::memory_order_relaxed);
+            queue_[POS_MOD_BASE(writePos)] = std::forward<T>(node);
+            writePos_.store(writePos + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        std::vector<stType, MmapAllocator<stType>> queue_;
+        size_t capacity_ = 0;
+        size_t mask_ = 0;
+
+        // producer line
+        alignas(64) std::atomic<size_t> writePos_{0};
+        mutable size_t cachedReadPos_ = 0;
+
+        // consumer line
+        alignas(64) std::atomic<size_t> readPos_{0};
+        mutable size_t cachedWritePos_ = 0;
+    };
+} //namespace sunflower
+#endif //RECYCLEQUEUE_SPSC_H
@@ -0,0 +1,76 @@
+#include "RecycleQueueShm.h"
+#include <iostream>
+#include <new>
+
+namespace sunflower
+{
+    size_t RecycleQueueShm::layout(uint32_t power, Header *header)
+    {
+        header->capacity = (uint64_t)1 << power;
+        header->mask = header->capacity - 1;
+        header->dataOffset = (sizeof(Header) + 63) & ~(size_t)63;
+        return header->dataOffset + header->capacity;
+    }
+
+    bool RecycleQueueShm::create(const std::string &name, uint32_t power)
+    {
+        Header shape;
+        if (power < 5 || power > 32 || not segment_.Create(name, layout(power, &shape)))
+        {
+            return false;
+        }
+        return init(power);
+    }
+
+    bool RecycleQueueShm::createAnonymous(uint32_t power)
+    {
+        Header shape;
+        if (power < 5 || power > 32 || not segment_.CreateAnonymous("RecycleQueueShm", layout(power, &shape)))
+        {
+            return false;
+        }
+        return init(power);
+    }
+
+    bool RecycleQueueShm::init(uint32_t power)
+    {
+        // the segment is zero filled: every record empty
+        header_ = new (segment_.Addr()) Header;
+        layout(power, header_);
+        data_ = segment_.Addr() + header_->dataOffset;
+        header_->magic = kMagic;
+        header_->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    bool RecycleQueueShm::attach(const std::string &name)
+    {
+        // the old mapping is gone whether the new one succeeds or not
+        header_ = nullptr;
+        data_ = nullptr;
+        return segment_.Attach(name) && validate();
+    }
+
+    bool RecycleQueueShm::attachFd(int fd)
+    {
+        header_ = nullptr;
+        data_ = nullptr;
+        return segment_.AttachFd(fd) && validate();
+    }
+
+    bool RecycleQueueShm::validate()
+    {
+        Header *header = (Header *)segment_.Addr();
+        if (segment_.Size() < sizeof(Header) || header->ready.load(std::memory_order_acquire) != 1 ||
+            header->magic != kMagic || header->capacity > ((uint64_t)1 << 32) || header->mask != header->capacity - 1 ||
+            header->dataOffset + header->capacity > segment_.Size())
+        {
+            std::cerr << "RecycleQueueShm: segment is not a queue" << std::endl;
+            segment_.Close();
+            return false;
+        }
+        header_ = header;
+        data_ = segment_.Addr() + header_->dataOffset;
+        return true;
+    }
+} // namespace sunflower
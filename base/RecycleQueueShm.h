@@ -0,0 +1,236 @@
+#ifndef RECYCLEQUEUE_SHM_H
+#define RECYCLEQUEUE_SHM_H
+
+#include "EventCount.h"
+#include "Noncopyable.h"
+#include "ShmSegment.h"
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace sunflower
+{
+    /**
+     * Ring of variable length records living in one shared memory segment,
+     * for producers in any number of threads and processes and a single
+     * consumer. The segment header holds the byte positions and two
+     * process-shared EventCounts, so a push or pop is a CAS or a store on a
+     * position with no syscall unless the other side sleeps.
+     * A producer reserves a record with one CAS on the write position,
+     * fills it in place and commits it; the consumer reads records in place,
+     * zeroes them and publishes the read position once per batch. Records
+     * never wrap, the tail of the ring is skipped with a padding record, so
+     * a record is at most maxRecord() = capacity / 2 - 8 bytes.
+     * A producer that dies between reserve() and commit() stalls the
+     * consumer at its record.
+     */
+    class RecycleQueueShm : public Noncopyable
+    {
+    public:
+        RecycleQueueShm() {}
+        ~RecycleQueueShm() {}
+
+        // 2^power bytes of records, power in [5, 32] so a padding span fits
+        // Record::len, attachFd takes ownership of fd
+        bool create(const std::string &name, uint32_t power);
+        bool createAnonymous(uint32_t power);
+        bool attach(const std::string &name);
+        bool attachFd(int fd);
+        int fd() const { return segment_.Fd(); }
+
+        size_t capacity() const { return header_->capacity; }
+        size_t maxRecord() const { return header_->capacity / 2 - sizeof(Record); }
+
+        // Bytes reserved by producers and not yet consumed
+        size_t size() const
+        {
+            uint64_t readPos = header_->readPos.load(std::memory_order_acquire);
+            return header_->writePos.load(std::memory_order_acquire) - readPos;
+        }
+        bool empty() const { return size() == 0; }
+
+        // How waitPush / waitPop wait, per process
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            policy_ = policy;
+            spins_ = spins;
+        }
+
+        // Room for len bytes to fill in place, nullptr if full or too long
+        char *reserve(uint32_t len)
+        {
+            if (len > maxRecord())
+            {
+                return nullptr;
+            }
+            uint64_t need = span(len);
+            uint64_t pos = header_->writePos.load(std::memory_order_relaxed);
+            uint64_t pad;
+            do
+            {
+                uint64_t room = header_->capacity - (pos & header_->mask);
+                pad = room < need ? room : 0;
+                // pairs with the consumer zeroing records before it moves readPos
+                if (pos + pad + need - header_->readPos.load(std::memory_order_acquire) > header_->capacity)
+                {
+                    return nullptr;
+                }
+            } while (not header_->writePos.compare_exchange_weak(pos, pos + pad + need, std::memory_order_relaxed));
+
+            if (pad)
+            {
+                Record *padding = record(pos);
+                padding->len = pad;
+                padding->state.store(kPadding, std::memory_order_release);
+            }
+            Record *rec = record(pos + pad);
+            rec->len = len;
+            return (char *)(rec + 1);
+        }
+
+        // data must come from reserve(), hands the record to the consumer
+        void commit(char *data)
+        {
+            Record *rec = (Record *)data - 1;
+            rec->state.store(kCommitted, std::memory_order_release);
+            header_->evData.NotifyOne();
+        }
+
+        bool tryPush(const void *data, uint32_t len)
+        {
+            char *rec = reserve(len);
+            if (not rec)
+            {
+                return false;
+            }
+            memcpy(rec, data, len);
+            commit(rec);
+            return true;
+        }
+
+        // false only if len exceeds maxRecord()
+        bool waitPush(const void *data, uint32_t len)
+        {
+            if (len > maxRecord())
+            {
+                return false;
+            }
+            char *rec;
+            for (;;)
+            {
+                uint64_t readPos = header_->readPos.load(std::memory_order_acquire);
+                if ((rec = reserve(len)) != nullptr)
+                {
+                    break;
+                }
+                header_->evSpace.Await([this, readPos]
+                                       { return header_->readPos.load(std::memory_order_acquire) != readPos; },
+                                       policy_, spins_);
+            }
+            memcpy(rec, data, len);
+            commit(rec);
+            return true;
+        }
+
+        // Consumer: handler(const char *data, uint32_t len) sees up to max
+        // committed records in place, returns the number handled
+        template <typename Handler>
+        size_t read(Handler handler, size_t max = SIZE_MAX)
+        {
+            uint64_t start = header_->readPos.load(std::memory_order_relaxed);
+            uint64_t readPos = start;
+            size_t n = 0;
+            while (n < max)
+            {
+                Record *rec = record(readPos);
+                uint32_t state = rec->state.load(std::memory_order_acquire);
+                if (state == kEmpty)
+                {
+                    break;
+                }
+                uint64_t bytes = rec->len;
+                if (state == kCommitted)
+                {
+                    handler((const char *)(rec + 1), rec->len);
+                    bytes = span(rec->len);
+                    n++;
+                }
+                // any offset may hold a header next lap
+                memset((void *)rec, 0, bytes);
+                readPos += bytes;
+            }
+            if (readPos != start)
+            {
+                header_->readPos.store(readPos, std::memory_order_release);
+                header_->evSpace.NotifyAll();
+            }
+            return n;
+        }
+
+        bool tryPop(std::string &data)
+        {
+            return read([&data](const char *rec, uint32_t len)
+                        { data.assign(rec, len); },
+                        1) == 1;
+        }
+
+        void waitPop(std::string &data)
+        {
+            while (not tryPop(data))
+            {
+                header_->evData.Await([this]
+                                      { return headReady(); },
+                                      policy_, spins_);
+            }
+        }
+
+    private:
+        static const uint64_t kMagic = 0x53464c5253485131ULL; // "SFLRSHQ1"
+        static const uint32_t kEmpty = 0;
+        static const uint32_t kCommitted = 1;
+        static const uint32_t kPadding = 2;
+
+        struct Record
+        {
+            std::atomic<uint32_t> state;
+            uint32_t len; // payload bytes, whole span for padding
+        };
+
+        struct Header
+        {
+            uint64_t magic;
+            uint64_t capacity;
+            uint64_t mask;
+            uint64_t dataOffset;
+            std::atomic<uint32_t> ready;
+
+            alignas(64) std::atomic<uint64_t> writePos{0};
+            alignas(64) std::atomic<uint64_t> readPos{0};
+            alignas(64) EventCount evData{true};
+            EventCount evSpace{true};
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared positions must be lock free");
+
+        static uint64_t span(uint64_t len) { return (sizeof(Record) + len + 7) & ~(uint64_t)7; }
+        Record *record(uint64_t pos) const { return (Record *)(data_ + (pos & header_->mask)); }
+        bool headReady() const
+        {
+            return record(header_->readPos.load(std::memory_order_relaxed))->state.load(std::memory_order_acquire) != kEmpty;
+        }
+
+        static size_t layout(uint32_t power, Header *header);
+        bool init(uint32_t power);
+        bool validate();
+
+    private:
+        ShmSegment segment_;
+        Header *header_ = nullptr;
+        char *data_ = nullptr;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
+    };
+} // namespace sunflower
+
+#endif // RECYCLEQUEUE_SHM_H
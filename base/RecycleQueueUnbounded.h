@@ -0,0 +1,438 @@
+#ifndef RECYCLEQUEUE_UNBOUNDED_H
+#define RECYCLEQUEUE_UNBOUNDED_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <assert.h>
+
+#include "Common.h"
+#include "EpochDomain.h"
+#include "EventCount.h"
+#include "RecycleQueueSPSC.h"
+
+namespace sunflower
+{
+    /**
+     * Unbounded ring for one producer and one consumer thread: a chain of
+     * 2^segmentPower item segments, the producer links a new one when the
+     * tail segment is used up, the consumer unlinks the head segment when
+     * it is drained and hands it back to the producer through a ring of
+     * 2^poolPower spares, so memory grows during bursts and is reused, not
+     * reallocated, afterwards. Spares beyond the ring are freed.
+     * A push never fails, otherwise the calls and their threads are those
+     * of RecycleQueueSPSC.
+     */
+    template <typename stType>
+    class RecycleQueueUnboundedSPSC
+    {
+    public:
+        explicit RecycleQueueUnboundedSPSC(uint32_t segmentPower = 10, uint32_t poolPower = 2)
+            : free_(poolPower)
+        {
+            segSize_ = (size_t)1 << segmentPower;
+            mask_ = segSize_ - 1;
+            tail_ = head_ = new Segment(segSize_);
+        }
+
+        RecycleQueueUnboundedSPSC(const RecycleQueueUnboundedSPSC &other) = delete;
+        RecycleQueueUnboundedSPSC(RecycleQueueUnboundedSPSC &&other) = delete;
+        RecycleQueueUnboundedSPSC &operator=(const RecycleQueueUnboundedSPSC &other) = delete;
+        RecycleQueueUnboundedSPSC &operator=(RecycleQueueUnboundedSPSC &&other) = delete;
+
+        ~RecycleQueueUnboundedSPSC()
+        {
+            while (head_)
+            {
+                Segment *next = head_->next.load(std::memory_order_relaxed);
+                delete head_;
+                head_ = next;
+            }
+            Segment *spare = nullptr;
+            while (free_.tryPop(spare))
+            {
+                delete spare;
+            }
+        }
+
+        void clear()
+        {
+            while (not empty())
+            {
+                pop();
+            }
+        }
+
+        bool full() const { return false; }
+        bool empty() const
+        {
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            if (readPos != cachedWritePos_)
+            {
+                return false;
+            }
+            cachedWritePos_ = writePos_.load(std::memory_order_acquire);
+            return readPos == cachedWritePos_;
+        }
+
+        size_t size() const
+        {
+            size_t readPos = readPos_.load(std::memory_order_acquire);
+            return writePos_.load(std::memory_order_acquire) - readPos;
+        }
+
+        bool tryPush(const stType &node) { return push_(node); }
+        bool tryPush(stType &&node) { return push_(std::move(node)); }
+
+        bool tryPop(stType &node)
+        {
+            if (empty())
+            {
+                return false;
+            }
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            node = std::move(readSlot(readPos));
+            readPos_.store(readPos + 1, std::memory_order_release);
+            return true;
+        }
+
+        stType &top()
+        {
+            assert(LIKELY(not empty()));
+            return readSlot(readPos_.load(std::memory_order_relaxed));
+        }
+
+        void pop()
+        {
+            assert(LIKELY(not empty()));
+            size_t readPos = readPos_.load(std::memory_order_relaxed);
+            readSlot(readPos);
+            readPos_.store(readPos + 1, std::memory_order_release);
+        }
+
+    private:
+        struct Segment
+        {
+            explicit Segment(size_t n) : items(new stType[n]) {}
+            std::unique_ptr<stType[]> items;
+            std::atomic<Segment *> next{nullptr};
+        };
+
+        template <typename T>
+        bool push_(T &&node)
+        {
+            size_t writePos = writePos_.load(std::memory_order_relaxed);
+            if (UNLIKELY(writePos - tailBase_ == segSize_))
+            {
+                Segment *seg = nullptr;
+                if (not free_.tryPop(seg))
+                {
+                    seg = new Segment(segSize_);
+                }
+                seg->next.store(nullptr, std::memory_order_relaxed);
+                // published together with the item by writePos_
+                tail_->next.store(seg, std::memory_order_relaxed);
+                tail_ = seg;
+                tailBase_ = writePos;
+            }
+            tail_->items[writePos & mask_] = std::forward<T>(node);
+            writePos_.store(writePos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // steps onto the next segment when readPos is its first item
+        stType &readSlot(size_t readPos)
+        {
+            if (UNLIKELY(readPos - headBase_ == segSize_))
+            {
+                Segment *drained = head_;
+                head_ = drained->next.load(std::memory_order_relaxed);
+                headBase_ = readPos;
+                if (not free_.tryPush(drained))
+                {
+                    delete drained;
+                }
+            }
+            return head_->items[readPos & mask_];
+        }
+
+    private:
+        size_t segSize_ = 0;
+        size_t mask_ = 0;
+        // drained segments on their way back to the producer
+        RecycleQueueSPSC<Segment *> free_;
+
+        // producer line
+        alignas(64) std::atomic<size_t> writePos_{0};
+        Segment *tail_ = nullptr;
+        size_t tailBase_ = 0;
+
+        // consumer line
+        alignas(64) std::atomic<size_t> readPos_{0};
+        Segment *head_ = nullptr;
+        size_t headBase_ = 0;
+        mutable size_t cachedWritePos_ = 0;
+    };
+
+    /**
+     * Unbounded queue for any number of producers and consumers: a chain of
+     * 2^segmentPower slot segments. A push takes a ticket with one fetch_add
+     * and never fails, a pop claims the ticket of a filled slot with one CAS
+     * like RecycleQueueMPMC. The consumer that takes a segment's last slot
+     * unlinks it and retires it through an EpochDomain, after the grace
+     * period it joins a pool of up to poolSegments spares for the next
+     * burst. Every push and pop holds an epoch guard.
+     * waitPop waits on an EventCount by the WaitPolicy.
+     */
+    template <typename stType>
+    class RecycleQueueUnboundedMPMC
+    {
+    public:
+        explicit RecycleQueueUnboundedMPMC(uint32_t segmentPower = 10, uint32_t poolSegments = 4)
+            : poolSegments_(poolSegments)
+        {
+            segSize_ = (size_t)1 << segmentPower;
+            Segment *seg = new Segment(this, segSize_);
+            head_.store(seg, std::memory_order_relaxed);
+            tail_.store(seg, std::memory_order_relaxed);
+        }
+
+        RecycleQueueUnboundedMPMC(const RecycleQueueUnboundedMPMC &other) = delete;
+        RecycleQueueUnboundedMPMC(RecycleQueueUnboundedMPMC &&other) = delete;
+        RecycleQueueUnboundedMPMC &operator=(const RecycleQueueUnboundedMPMC &other) = delete;
+        RecycleQueueUnboundedMPMC &operator=(RecycleQueueUnboundedMPMC &&other) = delete;
+
+        // retired segments go back to pool_ when domain_ dies, before pool_ does
+        ~RecycleQueueUnboundedMPMC()
+        {
+            Segment *seg = head_.load(std::memory_order_relaxed);
+            while (seg)
+            {
+                Segment *next = seg->next.load(std::memory_order_relaxed);
+                delete seg;
+                seg = next;
+            }
+        }
+
+        void clear()
+        {
+            stType node;
+            while (tryPop(node))
+                ;
+        }
+
+        // Approximate while pushes or pops run
+        size_t size() const
+        {
+            size_t readPos = dequeuePos_.load();
+            size_t writePos = enqueuePos_.load();
+            return (intptr_t)(writePos - readPos) > 0 ? writePos - readPos : 0;
+        }
+
+        bool full() const { return false; }
+        bool empty() const
+        {
+            size_t readPos = dequeuePos_.load();
+            return (intptr_t)(enqueuePos_.load() - readPos) <= 0;
+        }
+
+        // How waitPop waits, set before the queue is shared
+        void setWaitPolicy(WaitPolicy policy, uint32_t spins = EventCount::kDefaultSpins)
+        {
+            policy_ = policy;
+            spins_ = spins;
+        }
+
+        bool tryPush(const stType &node) { return push_(node); }
+        bool tryPush(stType &&node) { return push_(std::move(node)); }
+        void waitPush(const stType &node) { push_(node); }
+        void waitPush(stType &&node) { push_(std::move(node)); }
+        bool tryPop(stType &node) { return pop_(node, false); }
+        stType waitPop()
+        {
+            stType value{};
+            pop_(value, true);
+            return value;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<bool> ready{false};
+            stType value{};
+        };
+
+        struct Segment
+        {
+            Segment(RecycleQueueUnboundedMPMC *owner, size_t n) : owner(owner), slots(new Slot[n]) {}
+            RecycleQueueUnboundedMPMC *owner;
+            size_t base = 0;
+            std::atomic<Segment *> next{nullptr};
+            std::unique_ptr<Slot[]> slots;
+        };
+
+        Segment *newSegment(size_t base)
+        {
+            Segment *seg = nullptr;
+            {
+                std::lock_guard<std::mutex> lck(poolMutex_);
+                if (not pool_.empty())
+                {
+                    seg = pool_.back().release();
+                    pool_.pop_back();
+                }
+            }
+            if (not seg)
+            {
+                seg = new Segment(this, segSize_);
+            }
+            seg->base = base;
+            return seg;
+        }
+
+        void recycleSegment(Segment *seg)
+        {
+            for (size_t i = 0; i < segSize_; i++)
+            {
+                seg->slots[i].ready.store(false, std::memory_order_relaxed);
+            }
+            seg->next.store(nullptr, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lck(poolMutex_);
+            if (pool_.size() < poolSegments_)
+            {
+                pool_.emplace_back(seg);
+                return;
+            }
+            delete seg;
+        }
+
+        static void RecycleRetired(void *ptr)
+        {
+            Segment *seg = static_cast<Segment *>(ptr);
+            seg->owner->recycleSegment(seg);
+        }
+
+        // the segment after seg, linked by whoever needs it first
+        Segment *nextSegment(Segment *seg)
+        {
+            Segment *next = seg->next.load(std::memory_order_acquire);
+            if (next)
+            {
+                return next;
+            }
+            Segment *fresh = newSegment(seg->base + segSize_);
+            if (seg->next.compare_exchange_strong(next, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                return fresh;
+            }
+            recycleSegment(fresh);
+            return next;
+        }
+
+        template <typename T>
+        bool push_(T &&node)
+        {
+            {
+                EpochDomain::Guard guard(domain_);
+                // loaded before the ticket, so it never starts past the ticket's segment
+                Segment *seg = tail_.load(std::memory_order_acquire);
+                size_t pos = enqueuePos_.fetch_add(1, std::memory_order_seq_cst);
+                while (pos - seg->base >= segSize_)
+                {
+                    Segment *next = nextSegment(seg);
+                    Segment *expected = seg;
+                    tail_.compare_exchange_strong(expected, next, std::memory_order_release, std::memory_order_relaxed);
+                    seg = next;
+                }
+                Slot &slot = seg->slots[pos - seg->base];
+                slot.value = std::forward<T>(node);
+                slot.ready.store(true, std::memory_order_release);
+            }
+            evEmpty.NotifyOne();
+            return true;
+        }
+
+        // false if the slot at the head is not filled yet
+        bool dequeue_(stType &node)
+        {
+            Segment *drained = nullptr;
+            {
+                EpochDomain::Guard guard(domain_);
+                for (;;)
+                {
+                    Segment *seg = head_.load(std::memory_order_acquire);
+                    size_t pos = dequeuePos_.load(std::memory_order_acquire);
+                    while (pos - seg->base >= segSize_)
+                    {
+                        seg = seg->next.load(std::memory_order_acquire);
+                        if (not seg)
+                        {
+                            return false;
+                        }
+                    }
+                    Slot &slot = seg->slots[pos - seg->base];
+                    if (not slot.ready.load(std::memory_order_acquire))
+                    {
+                        return false;
+                    }
+                    if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                    {
+                        node = std::move(slot.value);
+                        if (pos - seg->base == segSize_ - 1)
+                        {
+                            // last slot: only this thread moves head_ off seg
+                            Segment *next = nextSegment(seg);
+                            head_.store(next, std::memory_order_release);
+                            Segment *expected = seg;
+                            tail_.compare_exchange_strong(expected, next, std::memory_order_release, std::memory_order_relaxed);
+                            domain_.Retire(seg, RecycleRetired);
+                            drained = seg;
+                        }
+                        break;
+                    }
+                }
+            }
+            if (drained)
+            {
+                domain_.Collect();
+            }
+            return true;
+        }
+
+        bool pop_(stType &node, bool wait)
+        {
+            while (!dequeue_(node))
+            {
+                if (not wait)
+                {
+                    return false;
+                }
+                evEmpty.Await([this]
+                              { return !empty(); },
+                              policy_, spins_);
+            }
+            return true;
+        }
+
+    private:
+        size_t segSize_ = 0;
+        size_t poolSegments_ = 0;
+        std::mutex poolMutex_ = {};
+        std::vector<std::unique_ptr<Segment>> pool_;
+
+        alignas(64) std::atomic<size_t> enqueuePos_{0};
+        std::atomic<Segment *> tail_{nullptr};
+        alignas(64) std::atomic<size_t> dequeuePos_{0};
+        std::atomic<Segment *> head_{nullptr};
+
+        alignas(64) EventCount evEmpty;
+        WaitPolicy policy_ = WaitPolicy::SPIN_THEN_PARK;
+        uint32_t spins_ = EventCount::kDefaultSpins;
+        // last member: destroyed first, while pool_ can still take its segments
+        mutable EpochDomain domain_;
+    };
+} //namespace sunflower
+#endif //RECYCLEQUEUE_UNBOUNDED_H
@@ -0,0 +1,639 @@
+#include "RoaringSet.h"
+#include <algorithm>
+#include <iterator>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace sunflower
+{
+    namespace
+    {
+        using Container = RoaringSet::Container;
+        const uint32_t kArrayMax = RoaringSet::kArrayMax;
+        const uint32_t kBitmapWords = RoaringSet::kBitmapWords;
+
+        enum BitmapOp
+        {
+            OP_AND,
+            OP_OR,
+            OP_ANDNOT
+        };
+
+        // dst = a op b over words, dst may be a or nullptr for count only.
+        // Returns the popcount of the result.
+        size_t BitmapApplyScalar(BitmapOp op, uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t words)
+        {
+            size_t card = 0;
+            for (size_t i = 0; i < words; i++)
+            {
+                uint64_t r = op == OP_AND ? a[i] & b[i] : op == OP_OR ? a[i] | b[i] : a[i] & ~b[i];
+                if (dst)
+                    dst[i] = r;
+                card += __builtin_popcountll(r);
+            }
+            return card;
+        }
+
+#if defined(__x86_64__)
+        // Mula's nibble lookup popcount, four 64 bit lane sums
+        __attribute__((target("avx2"))) inline __m256i Popcount256(__m256i v)
+        {
+            const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            __m256i lo = _mm256_and_si256(v, nibble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+            __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+            return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+        }
+
+        __attribute__((target("avx2"))) size_t BitmapApplyAvx2(BitmapOp op, uint64_t *dst, const uint64_t *a, const uint64_t *b, size_t words)
+        {
+            __m256i total = _mm256_setzero_si256();
+            for (size_t i = 0; i < words; i += 4)
+            {
+                __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+                __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+                __m256i r = op == OP_AND ? _mm256_and_si256(va, vb) : op == OP_OR ? _mm256_or_si256(va, vb)
+                                                                                  : _mm256_andnot_si256(vb, va);
+                if (dst)
+                    _mm256_storeu_si256((__m256i *)(dst + i), r);
+                total = _mm256_add_epi64(total, Popcount256(r));
+            }
+            return (size_t)_mm256_extract_epi64(total, 0) + (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) + (size_t)_mm256_extract_epi64(total, 3);
+        }
+#endif
+
+        size_t BitmapApply(BitmapOp op, uint64_t *dst, const uint64_t *a, const uint64_t *b)
+        {
+#if defined(__x86_64__)
+            static const bool avx2 = __builtin_cpu_supports("avx2");
+            if (avx2)
+                return BitmapApplyAvx2(op, dst, a, b, kBitmapWords);
+#endif
+            return BitmapApplyScalar(op, dst, a, b, kBitmapWords);
+        }
+
+        bool TestBit(const Container &c, uint16_t low) { return (c.bits[low >> 6] >> (low & 63)) & 1; }
+
+        bool Contains(const Container &c, uint16_t low)
+        {
+            if (c.type == RoaringSet::ARRAY)
+            {
+                return std::binary_search(c.data.begin(), c.data.end(), low);
+            }
+            if (c.type == RoaringSet::BITMAP)
+            {
+                return TestBit(c, low);
+            }
+            // last run starting at or before low
+            size_t lo = 0, hi = c.data.size() / 2;
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (c.data[mid * 2] <= low)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return lo > 0 && low <= (uint32_t)c.data[(lo - 1) * 2] + c.data[(lo - 1) * 2 + 1];
+        }
+
+        void ToBitmap(Container &c)
+        {
+            std::vector<uint64_t> bits(kBitmapWords, 0);
+            if (c.type == RoaringSet::ARRAY)
+            {
+                for (uint16_t low : c.data)
+                    bits[low >> 6] |= 1ULL << (low & 63);
+            }
+            else if (c.type == RoaringSet::RUN)
+            {
+                for (size_t r = 0; r < c.data.size(); r += 2)
+                {
+                    uint32_t end = (uint32_t)c.data[r] + c.data[r + 1];
+                    for (uint32_t v = c.data[r]; v <= end; v++)
+                        bits[v >> 6] |= 1ULL << (v & 63);
+                }
+            }
+            else
+            {
+                return;
+            }
+            c.bits.swap(bits);
+            std::vector<uint16_t>().swap(c.data);
+            c.type = RoaringSet::BITMAP;
+        }
+
+        void ToArray(Container &c)
+        {
+            std::vector<uint16_t> data;
+            data.reserve(c.card);
+            if (c.type == RoaringSet::BITMAP)
+            {
+                for (uint32_t w = 0; w < kBitmapWords; w++)
+                {
+                    uint64_t word = c.bits[w];
+                    while (word)
+                    {
+                        data.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+            else if (c.type == RoaringSet::RUN)
+            {
+                for (size_t r = 0; r < c.data.size(); r += 2)
+                {
+                    uint32_t end = (uint32_t)c.data[r] + c.data[r + 1];
+                    for (uint32_t v = c.data[r]; v <= end; v++)
+                        data.push_back((uint16_t)v);
+                }
+            }
+            else
+            {
+                return;
+            }
+            c.data.swap(data);
+            std::vector<uint64_t>().swap(c.bits);
+            c.type = RoaringSet::ARRAY;
+        }
+
+        // array or bitmap by cardinality, runs are only made by optimize()
+        void Normalize(Container &c)
+        {
+            if (c.type == RoaringSet::RUN)
+            {
+                if (c.card <= kArrayMax)
+                    ToArray(c);
+                else
+                    ToBitmap(c);
+            }
+            else if (c.type == RoaringSet::ARRAY && c.card > kArrayMax)
+            {
+                ToBitmap(c);
+            }
+            else if (c.type == RoaringSet::BITMAP && c.card <= kArrayMax)
+            {
+                ToArray(c);
+            }
+        }
+
+        bool Add(Container &c, uint16_t low)
+        {
+            if (c.type == RoaringSet::RUN)
+            {
+                if (Contains(c, low))
+                    return false;
+                Normalize(c);
+            }
+            if (c.type == RoaringSet::ARRAY)
+            {
+                auto it = std::lower_bound(c.data.begin(), c.data.end(), low);
+                if (it != c.data.end() && *it == low)
+                    return false;
+                c.data.insert(it, low);
+                c.card++;
+                Normalize(c);
+                return true;
+            }
+            uint64_t &word = c.bits[low >> 6];
+            uint64_t bit = 1ULL << (low & 63);
+            if (word & bit)
+                return false;
+            word |= bit;
+            c.card++;
+            return true;
+        }
+
+        bool Remove(Container &c, uint16_t low)
+        {
+            if (c.type == RoaringSet::RUN)
+            {
+                if (not Contains(c, low))
+                    return false;
+                Normalize(c);
+            }
+            if (c.type == RoaringSet::ARRAY)
+            {
+                auto it = std::lower_bound(c.data.begin(), c.data.end(), low);
+                if (it == c.data.end() || *it != low)
+                    return false;
+                c.data.erase(it);
+                c.card--;
+                return true;
+            }
+            uint64_t &word = c.bits[low >> 6];
+            uint64_t bit = 1ULL << (low & 63);
+            if (not(word & bit))
+                return false;
+            word &= ~bit;
+            c.card--;
+            Normalize(c);
+            return true;
+        }
+
+        bool RunOptimize(Container &c)
+        {
+            if (c.type == RoaringSet::RUN)
+                return true;
+            std::vector<uint16_t> runs;
+            auto emit = [&](uint32_t start, uint32_t end)
+            {
+                runs.push_back((uint16_t)start);
+                runs.push_back((uint16_t)(end - start));
+            };
+            bool open = false;
+            uint32_t start = 0, prev = 0;
+            auto push = [&](uint32_t v)
+            {
+                if (open && v == prev + 1)
+                {
+                    prev = v;
+                    return;
+                }
+                if (open)
+                    emit(start, prev);
+                open = true;
+                start = prev = v;
+            };
+            if (c.type == RoaringSet::ARRAY)
+            {
+                for (uint16_t low : c.data)
+                    push(low);
+            }
+            else
+            {
+                for (uint32_t w = 0; w < kBitmapWords; w++)
+                {
+                    uint64_t word = c.bits[w];
+                    while (word)
+                    {
+                        push(w * 64 + __builtin_ctzll(word));
+                        word &= word - 1;
+                    }
+                }
+            }
+            if (open)
+                emit(start, prev);
+
+            size_t current = c.type == RoaringSet::ARRAY ? c.card * sizeof(uint16_t) : kBitmapWords * sizeof(uint64_t);
+            if (runs.size() * sizeof(uint16_t) >= current)
+                return false;
+            c.data.swap(runs);
+            c.data.shrink_to_fit();
+            std::vector<uint64_t>().swap(c.bits);
+            c.type = RoaringSet::RUN;
+            return true;
+        }
+
+        // run operands are expanded into a scratch copy
+        const Container &Expanded(const Container &c, Container &scratch)
+        {
+            if (c.type != RoaringSet::RUN)
+                return c;
+            scratch = c;
+            Normalize(scratch);
+            return scratch;
+        }
+
+        Container And(const Container &x, const Container &y)
+        {
+            Container sa, sb;
+            const Container &a = Expanded(x, sa);
+            const Container &b = Expanded(y, sb);
+            Container r;
+            if (a.type == RoaringSet::BITMAP && b.type == RoaringSet::BITMAP)
+            {
+                r.type = RoaringSet::BITMAP;
+                r.bits.resize(kBitmapWords);
+                r.card = BitmapApply(OP_AND, r.bits.data(), a.bits.data(), b.bits.data());
+                Normalize(r);
+            }
+            else if (a.type == RoaringSet::ARRAY && b.type == RoaringSet::ARRAY)
+            {
+                std::set_intersection(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(r.data));
+                r.card = r.data.size();
+            }
+            else
+            {
+                const Container &arr = a.type == RoaringSet::ARRAY ? a : b;
+                const Container &bmp = a.type == RoaringSet::ARRAY ? b : a;
+                for (uint16_t low : arr.data)
+                {
+                    if (TestBit(bmp, low))
+                        r.data.push_back(low);
+                }
+                r.card = r.data.size();
+            }
+            return r;
+        }
+
+        size_t AndCount(const Container &x, const Container &y)
+        {
+            Container sa, sb;
+            const Container &a = Expanded(x, sa);
+            const Container &b = Expanded(y, sb);
+            if (a.type == RoaringSet::BITMAP && b.type == RoaringSet::BITMAP)
+            {
+                return BitmapApply(OP_AND, nullptr, a.bits.data(), b.bits.data());
+            }
+            size_t n = 0;
+            if (a.type == RoaringSet::ARRAY && b.type == RoaringSet::ARRAY)
+            {
+                size_t i = 0, j = 0;
+                while (i < a.data.size() && j < b.data.size())
+                {
+                    if (a.data[i] < b.data[j])
+                        i++;
+                    else if (b.data[j] < a.data[i])
+                        j++;
+                    else
+                        n++, i++, j++;
+                }
+                return n;
+            }
+            const Container &arr = a.type == RoaringSet::ARRAY ? a : b;
+            const Container &bmp = a.type == RoaringSet::ARRAY ? b : a;
+            for (uint16_t low : arr.data)
+                n += TestBit(bmp, low);
+            return n;
+        }
+
+        Container Or(const Container &x, const Container &y)
+        {
+            Container sa, sb;
+            const Container &a = Expanded(x, sa);
+            const Container &b = Expanded(y, sb);
+            Container r;
+            if (a.type == RoaringSet::BITMAP && b.type == RoaringSet::BITMAP)
+            {
+                r.type = RoaringSet::BITMAP;
+                r.bits.resize(kBitmapWords);
+                r.card = BitmapApply(OP_OR, r.bits.data(), a.bits.data(), b.bits.data());
+            }
+            else if (a.type == RoaringSet::ARRAY && b.type == RoaringSet::ARRAY)
+            {
+                std::set_union(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(r.data));
+                r.card = r.data.size();
+                Normalize(r);
+            }
+            else
+            {
+                const Container &arr = a.type == RoaringSet::ARRAY ? a : b;
+                r = a.type == RoaringSet::ARRAY ? b : a;
+                for (uint16_t low : arr.data)
+                {
+                    uint64_t bit = 1ULL << (low & 63);
+                    r.card += (r.bits[low >> 6] & bit) == 0;
+                    r.bits[low >> 6] |= bit;
+                }
+            }
+            return r;
+        }
+
+        Container AndNot(const Container &x, const Container &y)
+        {
+            Container sa, sb;
+            const Container &a = Expanded(x, sa);
+            const Container &b = Expanded(y, sb);
+            Container r;
+            if (a.type == RoaringSet::BITMAP && b.type == RoaringSet::BITMAP)
+            {
+                r.type = RoaringSet::BITMAP;
+                r.bits.resize(kBitmapWords);
+                r.card = BitmapApply(OP_ANDNOT, r.bits.data(), a.bits.data(), b.bits.data());
+                Normalize(r);
+            }
+            else if (a.type == RoaringSet::ARRAY && b.type == RoaringSet::ARRAY)
+            {
+                std::set_difference(a.data.begin(), a.data.end(), b.data.begin(), b.data.end(), std::back_inserter(r.data));
+                r.card = r.data.size();
+            }
+            else if (a.type == RoaringSet::ARRAY)
+            {
+                for (uint16_t low : a.data)
+                {
+                    if (not TestBit(b, low))
+                        r.data.push_back(low);
+                }
+                r.card = r.data.size();
+            }
+            else
+            {
+                r = a;
+                for (uint16_t low : b.data)
+                {
+                    uint64_t bit = 1ULL << (low & 63);
+                    r.card -= (r.bits[low >> 6] & bit) != 0;
+                    r.bits[low >> 6] &= ~bit;
+                }
+                Normalize(r);
+            }
+            return r;
+        }
+    } // namespace
+
+    long RoaringSet::find_chunk(uint16_t high) const
+    {
+        auto it = std::lower_bound(_keys.begin(), _keys.end(), high);
+        long pos = it - _keys.begin();
+        if (it != _keys.end() && *it == high)
+            return pos;
+        return -pos - 1;
+    }
+
+    size_t RoaringSet::memory_bytes() const
+    {
+        size_t bytes = _keys.capacity() * sizeof(uint16_t) + _containers.capacity() * sizeof(Container);
+        for (auto &c : _containers)
+        {
+            bytes += c.data.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+    bool RoaringSet::insert(uint32_t value)
+    {
+        uint16_t high = value >> 16;
+        long pos = find_chunk(high);
+        if (pos < 0)
+        {
+            pos = -pos - 1;
+            _keys.insert(_keys.begin() + pos, high);
+            _containers.insert(_containers.begin() + pos, Container());
+        }
+        if (Add(_containers[pos], (uint16_t)value))
+        {
+            _numElements++;
+            return true;
+        }
+        return false;
+    }
+
+    size_t RoaringSet::erase(uint32_t value)
+    {
+        long pos = find_chunk(value >> 16);
+        if (pos < 0 || not Remove(_containers[pos], (uint16_t)value))
+            return 0;
+        if (_containers[pos].card == 0)
+        {
+            _keys.erase(_keys.begin() + pos);
+            _containers.erase(_containers.begin() + pos);
+        }
+        _numElements--;
+        return 1;
+    }
+
+    void RoaringSet::clear()
+    {
+        _keys.clear();
+        _containers.clear();
+        _numElements = 0;
+    }
+
+    size_t RoaringSet::optimize()
+    {
+        size_t runs = 0;
+        for (auto &c : _containers)
+        {
+            runs += RunOptimize(c);
+            c.data.shrink_to_fit();
+        }
+        _keys.shrink_to_fit();
+        _containers.shrink_to_fit();
+        return runs;
+    }
+
+    size_t RoaringSet::count(uint32_t value) const
+    {
+        long pos = find_chunk(value >> 16);
+        return pos >= 0 && Contains(_containers[pos], (uint16_t)value) ? 1 : 0;
+    }
+
+    std::vector<uint32_t> RoaringSet::to_vector() const
+    {
+        std::vector<uint32_t> values;
+        values.reserve(_numElements);
+        for_each([&](uint32_t v)
+                 { values.push_back(v); });
+        return values;
+    }
+
+    void RoaringSet::unite(const RoaringSet &other)
+    {
+        std::vector<uint16_t> keys;
+        std::vector<Container> containers;
+        keys.reserve(_keys.size() + other._keys.size());
+        containers.reserve(_keys.size() + other._keys.size());
+        size_t i = 0, j = 0;
+        _numElements = 0;
+        while (i < _keys.size() || j < other._keys.size())
+        {
+            if (j == other._keys.size() || (i < _keys.size() && _keys[i] < other._keys[j]))
+            {
+                keys.push_back(_keys[i]);
+                containers.push_back(std::move(_containers[i++]));
+            }
+            else if (i == _keys.size() || other._keys[j] < _keys[i])
+            {
+                keys.push_back(other._keys[j]);
+                containers.push_back(other._containers[j++]);
+            }
+            else
+            {
+                keys.push_back(_keys[i]);
+                containers.push_back(Or(_containers[i++], other._containers[j++]));
+            }
+            _numElements += containers.back().card;
+        }
+        _keys.swap(keys);
+        _containers.swap(containers);
+    }
+
+    void RoaringSet::intersect(const RoaringSet &other)
+    {
+        size_t i = 0, j = 0, out = 0;
+        _numElements = 0;
+        while (i < _keys.size() && j < other._keys.size())
+        {
+            if (_keys[i] < other._keys[j])
+            {
+                i++;
+            }
+            else if (other._keys[j] < _keys[i])
+            {
+                j++;
+            }
+            else
+            {
+                Container r = And(_containers[i], other._containers[j]);
+                if (r.card)
+                {
+                    _numElements += r.card;
+                    _keys[out] = _keys[i];
+                    _containers[out++] = std::move(r);
+                }
+                i++, j++;
+            }
+        }
+        _keys.resize(out);
+        _containers.resize(out);
+    }
+
+    void RoaringSet::subtract(const RoaringSet &other)
+    {
+        size_t i = 0, j = 0, out = 0;
+        _numElements = 0;
+        while (i < _keys.size())
+        {
+            while (j < other._keys.size() && other._keys[j] < _keys[i])
+                j++;
+            Container r;
+            if (j < other._keys.size() && other._keys[j] == _keys[i])
+                r = AndNot(_containers[i], other._containers[j]);
+            else
+                r = std::move(_containers[i]);
+            if (r.card)
+            {
+                _numElements += r.card;
+                _keys[out] = _keys[i];
+                _containers[out++] = std::move(r);
+            }
+            i++;
+        }
+        _keys.resize(out);
+        _containers.resize(out);
+    }
+
+    size_t RoaringSet::intersection_size(const RoaringSet &other) const
+    {
+        size_t i = 0, j = 0, n = 0;
+        while (i < _keys.size() && j < other._keys.size())
+        {
+            if (_keys[i] < other._keys[j])
+                i++;
+            else if (other._keys[j] < _keys[i])
+                j++;
+            else
+                n += AndCount(_containers[i++], other._containers[j++]);
+        }
+        return n;
+    }
+
+    bool RoaringSet::operator==(const RoaringSet &other) const
+    {
+        if (_numElements != other._numElements || _keys != other._keys)
+            return false;
+        for (size_t i = 0; i < _keys.size(); i++)
+        {
+            const Container &a = _containers[i];
+            const Container &b = other._containers[i];
+            if (a.card != b.card || AndCount(a, b) != a.card)
+                return false;
+        }
+        return true;
+    }
+} // namespace sunflower
@@ -0,0 +1,123 @@
+#ifndef ROARINGSET_H
+#define ROARINGSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace sunflower
+{
+    /**
+     * Compressed set of uint32_t, roaring bitmap layout.
+     * Values are split by their high 16 bits into chunks of 65536, a chunk
+     * is a sorted uint16_t array up to 4096 values and a 8KB bitmap above.
+     * optimize() turns chunks made of long runs into run containers.
+     * About 2 bytes per value for sparse chunks, 1 bit for dense ones,
+     * against ~32 bytes per value for HashSet<uint32_t>.
+     * Bitmap and, or, andnot and their cardinality use AVX2 when the CPU has it.
+     * Not thread safe.
+     */
+    class RoaringSet
+    {
+    public:
+        RoaringSet() {}
+
+        // Capacity
+        bool empty() const noexcept { return _numElements == 0; }
+        size_t size() const noexcept { return _numElements; }
+        // Heap bytes held by the containers
+        size_t memory_bytes() const;
+
+        // Modifiers
+        bool insert(uint32_t value);
+        size_t erase(uint32_t value);
+        void clear();
+        // Convert chunks to run containers where that is smaller, after bulk loads
+        size_t optimize();
+
+        // Lookup
+        size_t count(uint32_t value) const;
+        template <class Fn>
+        void for_each(Fn fn) const;
+        std::vector<uint32_t> to_vector() const;
+
+        // Set algebra, in place
+        void unite(const RoaringSet &other);
+        void intersect(const RoaringSet &other);
+        void subtract(const RoaringSet &other);
+        // Result cardinality without building the result
+        size_t intersection_size(const RoaringSet &other) const;
+        size_t union_size(const RoaringSet &other) const { return size() + other.size() - intersection_size(other); }
+
+        bool operator==(const RoaringSet &other) const;
+        bool operator!=(const RoaringSet &other) const { return !(*this == other); }
+
+    public:
+        static const uint32_t kArrayMax = 4096;
+        static const uint32_t kBitmapWords = 1024;
+
+        enum ContainerType : uint8_t
+        {
+            ARRAY = 0,
+            BITMAP,
+            RUN
+        };
+
+        struct Container
+        {
+            ContainerType type = ARRAY;
+            uint32_t card = 0;
+            // ARRAY: sorted values, RUN: (start, length - 1) pairs
+            std::vector<uint16_t> data;
+            // BITMAP: kBitmapWords words
+            std::vector<uint64_t> bits;
+        };
+
+    private:
+        // index of chunk high, or -(insertion point) - 1
+        long find_chunk(uint16_t high) const;
+
+    private:
+        std::vector<uint16_t> _keys;
+        std::vector<Container> _containers;
+        size_t _numElements = 0;
+    };
+
+    template <class Fn>
+    void RoaringSet::for_each(Fn fn) const
+    {
+        for (size_t i = 0; i < _keys.size(); i++)
+        {
+            uint32_t base = (uint32_t)_keys[i] << 16;
+            const Container &c = _containers[i];
+            if (c.type == ARRAY)
+            {
+                for (uint16_t low : c.data)
+                    fn(base | low);
+            }
+            else if (c.type == BITMAP)
+            {
+                for (uint32_t w = 0; w < kBitmapWords; w++)
+                {
+                    uint64_t word = c.bits[w];
+                    while (word)
+                    {
+                        fn(base | (w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+            else
+            {
+                for (size_t r = 0; r < c.data.size(); r += 2)
+                {
+                    uint32_t start = c.data[r];
+                    uint32_t end = start + c.data[r + 1];
+                    for (uint32_t v = start; v <= end; v++)
+                        fn(base | v);
+                }
+            }
+        }
+    }
+} // namespace sunflower
+#endif // ROARINGSET_H
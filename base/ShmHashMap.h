@@ -0,0 +1,521 @@
+#ifndef SHMHASHMAP_H
+#define SHMHASHMAP_H
+
+#include "Hash.h"
+#include "Noncopyable.h"
+#include "ShmSegment.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <iostream>
+#include <new>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+
+namespace sunflower
+{
+    // Outcome of a ShmHashMap insert / insert_or_assign
+    enum class ShmMapStatus
+    {
+        INSERTED, // new element
+        EXISTS,   // key present, insert left it alone
+        ASSIGNED, // key present, insert_or_assign replaced its value
+        FULL,     // node slab exhausted, nothing stored
+        CORRUPTED // see ShmHashMap::corrupted()
+    };
+
+    /**
+     * Hash map living entirely in one shared memory segment, so several
+     * processes attach to a single copy. Everything inside the segment is
+     * addressed by offset from its base, nodes come from a slab sized at
+     * creation, and buckets share robust process-shared striped mutexes.
+     * Key and Value must be trivially copyable, and Hash must give the same
+     * result in every process (a seedable Hash gets the seed stored in the
+     * segment header).
+     * A process dying inside a stripe leaves the stripe's mutex to the next
+     * locker, which checks the stripe's chains and free list and recounts
+     * it; nodes the dead owner held between the two are lost. If the check
+     * fails the map is flagged corrupted and every later call fails.
+     */
+    template <class Key, class Value, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class ShmHashMap : public Noncopyable
+    {
+        static_assert(std::is_trivially_copyable<Key>::value, "ShmHashMap key must be trivially copyable");
+        static_assert(std::is_trivially_copyable<Value>::value, "ShmHashMap value must be trivially copyable");
+
+    public:
+        ShmHashMap() {}
+        ~ShmHashMap() {}
+
+        // Segment, maxElements bounds the node slab, attach_fd takes ownership of fd
+        bool create(const std::string &name, size_t power, size_t maxElements, size_t lockPower = 10);
+        bool create_anonymous(size_t power, size_t maxElements, size_t lockPower = 10);
+        bool attach(const std::string &name);
+        bool attach_fd(int fd);
+        int fd() const { return _segment.Fd(); }
+        size_t segment_size() const { return _segment.Size(); }
+
+        // Capacity
+        bool empty() const noexcept { return size() == 0; }
+        // sums the stripe counts
+        size_t size() const noexcept
+        {
+            size_t num = 0;
+            for (size_t i = 0; i <= _header->lockMask; i++)
+            {
+                num += _stripes[i].count.load(std::memory_order_relaxed);
+            }
+            return num;
+        }
+        size_t max_size() const noexcept { return _header->maxNodes; }
+
+        // Modifiers, insert returns the stored value with INSERTED or EXISTS
+        std::pair<Value, ShmMapStatus> insert(const Key &key, const Value &value);
+        ShmMapStatus insert_or_assign(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void clear();
+
+        // Lookup
+        void find(const Key &key, Value &value, bool &exsit);
+        size_t count(const Key &key);
+
+        // Bucket interface
+        size_t bucket_count() const { return _header->capacity; }
+        size_t bucket(const Key &key) const { return _hash(key) & _header->mask; }
+
+        // a dead process left a stripe that failed its check
+        bool corrupted() const { return _header->corrupted.load(std::memory_order_relaxed) != 0; }
+
+    private:
+        static const uint64_t kMagic = 0x53464c5253484d32ULL; // "SFLRSHM2"
+
+        struct Header
+        {
+            uint64_t magic;
+            uint32_t keySize;
+            uint32_t valueSize;
+            uint64_t capacity;
+            uint64_t mask;
+            uint64_t lockMask;
+            uint64_t maxNodes;
+            uint64_t seed;
+            uint64_t bucketsOffset;
+            uint64_t stripesOffset;
+            uint64_t nodesOffset;
+            std::atomic<uint64_t> bumpNext;
+            std::atomic<uint32_t> ready;
+            std::atomic<uint32_t> corrupted;
+        };
+
+        struct alignas(64) Stripe
+        {
+            pthread_mutex_t mutex;
+            uint64_t freeHead; // recycled nodes of this stripe
+            std::atomic<uint64_t> count; // elements in this stripe's buckets, written under the mutex
+        };
+
+        struct Node
+        {
+            uint64_t next; // offset from the segment base, 0 is null since the header sits there
+            Key key;
+            Value value;
+        };
+
+        // ok() is false once the map is corrupted, the stripe is locked either way
+        class StripeLock
+        {
+        public:
+            StripeLock(ShmHashMap *map, Stripe *stripe) : _stripe(stripe) { _ok = map->lock(stripe); }
+            ~StripeLock() { pthread_mutex_unlock(&_stripe->mutex); }
+            bool ok() const { return _ok; }
+
+        private:
+            Stripe *_stripe;
+            bool _ok = false;
+        };
+
+        bool lock(Stripe *owner)
+        {
+            if (pthread_mutex_lock(&owner->mutex) == EOWNERDEAD)
+            {
+                recover(owner);
+            }
+            return not corrupted();
+        }
+        void recover(Stripe *owner);
+        bool check_stripe(Stripe *owner);
+        bool valid_node(uint64_t offset) const
+        {
+            return offset >= _header->nodesOffset && offset < _header->nodesOffset + _header->maxNodes * sizeof(Node) &&
+                   (offset - _header->nodesOffset) % sizeof(Node) == 0;
+        }
+
+        bool init(size_t power, size_t maxElements, size_t lockPower);
+        bool validate();
+        static size_t layout(size_t power, size_t maxElements, size_t lockPower, Header *header);
+        Stripe *stripe(size_t id) { return _stripes + (id & _header->lockMask); }
+        Node *node(uint64_t offset) { return (Node *)(_segment.Addr() + offset); }
+        uint64_t alloc_node(Stripe *owner);
+        uint64_t *find_slot(size_t id, const Key &key);
+
+    private:
+        ShmSegment _segment;
+        Header *_header = nullptr;
+        uint64_t *_buckets = nullptr;
+        Stripe *_stripes = nullptr;
+        Hash _hash;
+        KeyEqual _equal;
+    };
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t ShmHashMap<Key, Value, Hash, KeyEqual>::layout(size_t power, size_t maxElements, size_t lockPower, Header *header)
+    {
+        size_t capacity = (size_t)1 << power;
+        size_t locks = (size_t)1 << std::min(power, lockPower);
+        header->capacity = capacity;
+        header->mask = capacity - 1;
+        header->lockMask = locks - 1;
+        header->maxNodes = maxElements;
+        header->bucketsOffset = (sizeof(Header) + 63) & ~(size_t)63;
+        header->stripesOffset = (header->bucketsOffset + capacity * sizeof(uint64_t) + 63) & ~(size_t)63;
+        header->nodesOffset = header->stripesOffset + locks * sizeof(Stripe);
+        return header->nodesOffset + maxElements * sizeof(Node);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::create(const std::string &name, size_t power, size_t maxElements, size_t lockPower)
+    {
+        Header shape;
+        if (not _segment.Create(name, layout(power, maxElements, lockPower, &shape)))
+        {
+            return false;
+        }
+        return init(power, maxElements, lockPower);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::create_anonymous(size_t power, size_t maxElements, size_t lockPower)
+    {
+        Header shape;
+        if (not _segment.CreateAnonymous("ShmHashMap", layout(power, maxElements, lockPower, &shape)))
+        {
+            return false;
+        }
+        return init(power, maxElements, lockPower);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::init(size_t power, size_t maxElements, size_t lockPower)
+    {
+        // the segment is zero filled: empty buckets, empty free lists
+        _header = new (_segment.Addr()) Header;
+        layout(power, maxElements, lockPower, _header);
+        _header->keySize = sizeof(Key);
+        _header->valueSize = sizeof(Value);
+        _header->seed = RandomSeed();
+        SeedHash(_hash, _header->seed);
+        _header->bumpNext.store(0);
+        _header->corrupted.store(0);
+
+        _buckets = (uint64_t *)(_segment.Addr() + _header->bucketsOffset);
+        _stripes = (Stripe *)(_segment.Addr() + _header->stripesOffset);
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        for (size_t i = 0; i <= _header->lockMask; i++)
+        {
+            pthread_mutex_init(&_stripes[i].mutex, &attr);
+            _stripes[i].freeHead = 0;
+            _stripes[i].count.store(0);
+        }
+        pthread_mutexattr_destroy(&attr);
+
+        _header->magic = kMagic;
+        _header->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::attach(const std::string &name)
+    {
+        return _segment.Attach(name) && validate();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::attach_fd(int fd)
+    {
+        return _segment.AttachFd(fd) && validate();
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::validate()
+    {
+        Header *header = (Header *)_segment.Addr();
+        if (_segment.Size() < sizeof(Header) || header->ready.load(std::memory_order_acquire) != 1 ||
+            header->magic != kMagic || header->keySize != sizeof(Key) || header->valueSize != sizeof(Value) ||
+            header->nodesOffset + header->maxNodes * sizeof(Node) > _segment.Size())
+        {
+            std::cerr << "ShmHashMap: segment is not a map of this type" << std::endl;
+            _segment.Close();
+            return false;
+        }
+        _header = header;
+        _buckets = (uint64_t *)(_segment.Addr() + _header->bucketsOffset);
+        _stripes = (Stripe *)(_segment.Addr() + _header->stripesOffset);
+        SeedHash(_hash, _header->seed);
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    uint64_t ShmHashMap<Key, Value, Hash, KeyEqual>::alloc_node(Stripe *owner)
+    {
+        // caller holds owner, recycled nodes of the own stripe first
+        if (owner->freeHead)
+        {
+            uint64_t offset = owner->freeHead;
+            owner->freeHead = node(offset)->next;
+            return offset;
+        }
+
+        uint64_t index = _header->bumpNext.load(std::memory_order_relaxed);
+        while (index < _header->maxNodes)
+        {
+            if (_header->bumpNext.compare_exchange_weak(index, index + 1))
+            {
+                return _header->nodesOffset + index * sizeof(Node);
+            }
+        }
+
+        // slab used up, steal from stripes nobody holds right now
+        for (size_t i = 0; i <= _header->lockMask; i++)
+        {
+            Stripe *other = _stripes + i;
+            if (other == owner || other->freeHead == 0)
+                continue;
+            int err = pthread_mutex_trylock(&other->mutex);
+            if (err == EOWNERDEAD)
+            {
+                recover(other);
+            }
+            else if (err != 0)
+            {
+                continue;
+            }
+            uint64_t offset = corrupted() ? 0 : other->freeHead;
+            if (offset)
+            {
+                other->freeHead = node(offset)->next;
+            }
+            pthread_mutex_unlock(&other->mutex);
+            if (offset)
+            {
+                return offset;
+            }
+        }
+        return 0;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    uint64_t *ShmHashMap<Key, Value, Hash, KeyEqual>::find_slot(size_t id, const Key &key)
+    {
+        // link pointing at the matching node, or at the chain end
+        uint64_t *link = &_buckets[id];
+        while (*link)
+        {
+            Node *curr = node(*link);
+            if (_equal(key, curr->key))
+            {
+                return link;
+            }
+            link = &curr->next;
+        }
+        return link;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void ShmHashMap<Key, Value, Hash, KeyEqual>::recover(Stripe *owner)
+    {
+        if (not check_stripe(owner))
+        {
+            _header->corrupted.store(1);
+        }
+        pthread_mutex_consistent(&owner->mutex);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    bool ShmHashMap<Key, Value, Hash, KeyEqual>::check_stripe(Stripe *owner)
+    {
+        // every link must hit a node of the slab, more links than nodes is a cycle
+        uint64_t budget = _header->maxNodes;
+        uint64_t count = 0;
+        for (size_t id = owner - _stripes; id < _header->capacity; id += _header->lockMask + 1)
+        {
+            for (uint64_t offset = _buckets[id]; offset; offset = node(offset)->next)
+            {
+                if (not valid_node(offset) || budget-- == 0 || bucket(node(offset)->key) != id)
+                {
+                    return false;
+                }
+                count++;
+            }
+        }
+        for (uint64_t offset = owner->freeHead; offset; offset = node(offset)->next)
+        {
+            if (not valid_node(offset) || budget-- == 0)
+            {
+                return false;
+            }
+        }
+        // the dead owner may have died between a link and its count update
+        owner->count.store(count);
+        return true;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    std::pair<Value, ShmMapStatus> ShmHashMap<Key, Value, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        size_t id = bucket(key);
+        Stripe *owner = stripe(id);
+        StripeLock lck(this, owner);
+        if (not lck.ok())
+        {
+            return std::make_pair(value, ShmMapStatus::CORRUPTED);
+        }
+
+        uint64_t *link = find_slot(id, key);
+        if (*link)
+        {
+            return std::make_pair(node(*link)->value, ShmMapStatus::EXISTS);
+        }
+
+        uint64_t offset = alloc_node(owner);
+        if (offset == 0)
+        {
+            return std::make_pair(value, corrupted() ? ShmMapStatus::CORRUPTED : ShmMapStatus::FULL);
+        }
+        Node *newNode = node(offset);
+        newNode->key = key;
+        newNode->value = value;
+        newNode->next = _buckets[id];
+        _buckets[id] = offset;
+        owner->count++;
+        return std::make_pair(value, ShmMapStatus::INSERTED);
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    ShmMapStatus ShmHashMap<Key, Value, Hash, KeyEqual>::insert_or_assign(const Key &key, const Value &value)
+    {
+        size_t id = bucket(key);
+        Stripe *owner = stripe(id);
+        StripeLock lck(this, owner);
+        if (not lck.ok())
+        {
+            return ShmMapStatus::CORRUPTED;
+        }
+
+        uint64_t *link = find_slot(id, key);
+        if (*link)
+        {
+            node(*link)->value = value;
+            return ShmMapStatus::ASSIGNED;
+        }
+
+        uint64_t offset = alloc_node(owner);
+        if (offset == 0)
+        {
+            return corrupted() ? ShmMapStatus::CORRUPTED : ShmMapStatus::FULL;
+        }
+        Node *newNode = node(offset);
+        newNode->key = key;
+        newNode->value = value;
+        newNode->next = _buckets[id];
+        _buckets[id] = offset;
+        owner->count++;
+        return ShmMapStatus::INSERTED;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t ShmHashMap<Key, Value, Hash, KeyEqual>::erase(const Key &key)
+    {
+        size_t id = bucket(key);
+        Stripe *owner = stripe(id);
+        StripeLock lck(this, owner);
+        if (not lck.ok())
+        {
+            return 0;
+        }
+
+        uint64_t *link = find_slot(id, key);
+        if (*link == 0)
+        {
+            return 0;
+        }
+        uint64_t offset = *link;
+        Node *curr = node(offset);
+        *link = curr->next;
+        curr->next = owner->freeHead;
+        owner->freeHead = offset;
+        owner->count--;
+        return 1;
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void ShmHashMap<Key, Value, Hash, KeyEqual>::clear()
+    {
+        for (size_t id = 0; id < _header->capacity; id++)
+        {
+            Stripe *owner = stripe(id);
+            StripeLock lck(this, owner);
+            if (not lck.ok())
+            {
+                return;
+            }
+            while (_buckets[id])
+            {
+                uint64_t offset = _buckets[id];
+                Node *curr = node(offset);
+                _buckets[id] = curr->next;
+                curr->next = owner->freeHead;
+                owner->freeHead = offset;
+                owner->count--;
+            }
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    void ShmHashMap<Key, Value, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit)
+    {
+        size_t id = bucket(key);
+        StripeLock lck(this, stripe(id));
+        if (not lck.ok())
+        {
+            exsit = false;
+            return;
+        }
+
+        uint64_t *link = find_slot(id, key);
+        exsit = *link != 0;
+        if (exsit)
+        {
+            value = node(*link)->value;
+        }
+    }
+
+    template <class Key, class Value, class Hash, class KeyEqual>
+    size_t ShmHashMap<Key, Value, Hash, KeyEqual>::count(const Key &key)
+    {
+        size_t id = bucket(key);
+        StripeLock lck(this, stripe(id));
+        if (not lck.ok())
+        {
+            return 0;
+        }
+        return *find_slot(id, key) ? 1 : 0;
+    }
+} // namespace sunflower
+#endif // SHMHASHMAP_H
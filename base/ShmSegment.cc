@@ -0,0 +1,127 @@
+#include "ShmSegment.h"
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sunflower
+{
+    bool ShmSegment::Create(const std::string &name, size_t size)
+    {
+        Close();
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            std::cerr << "shm_open " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (ftruncate(fd, size) != 0)
+        {
+            std::cerr << "ftruncate " << name << ": " << strerror(errno) << std::endl;
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        if (not Map(fd, size))
+        {
+            shm_unlink(name.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool ShmSegment::Attach(const std::string &name)
+    {
+        Close();
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+        {
+            std::cerr << "shm_open " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        return AttachFd(fd);
+    }
+
+    bool ShmSegment::CreateAnonymous(const std::string &name, size_t size)
+    {
+        Close();
+        int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cerr << "memfd_create " << name << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (ftruncate(fd, size) != 0)
+        {
+            std::cerr << "ftruncate " << name << ": " << strerror(errno) << std::endl;
+            close(fd);
+            return false;
+        }
+        return Map(fd, size);
+    }
+
+    bool ShmSegment::AttachFd(int fd)
+    {
+        if (fd == _fd)
+        {
+            // re-map our own fd: drop the mapping, the fd is ours to close
+            // below on failure or to keep on success
+            Unmap();
+            _fd = -1;
+        }
+        else
+        {
+            Close();
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            std::cerr << "shm segment has no size" << std::endl;
+            close(fd);
+            return false;
+        }
+        return Map(fd, st.st_size);
+    }
+
+    bool ShmSegment::Map(int fd, size_t size)
+    {
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            std::cerr << "mmap shm segment: " << strerror(errno) << std::endl;
+            close(fd);
+            return false;
+        }
+        _fd = fd;
+        _addr = addr;
+        _size = size;
+        return true;
+    }
+
+    void ShmSegment::Unmap()
+    {
+        if (_addr)
+        {
+            munmap(_addr, _size);
+            _addr = nullptr;
+            _size = 0;
+        }
+    }
+
+    void ShmSegment::Close()
+    {
+        Unmap();
+        if (_fd >= 0)
+        {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    bool ShmSegment::Unlink(const std::string &name)
+    {
+        return shm_unlink(name.c_str()) == 0;
+    }
+} // namespace sunflower
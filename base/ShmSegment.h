@@ -0,0 +1,47 @@
+#ifndef SHMSEGMENT_H
+#define SHMSEGMENT_H
+
+#include "Noncopyable.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace sunflower
+{
+    /**
+     * Shared memory segment mapped MAP_SHARED, either a named POSIX object
+     * (shm_open, visible under /dev/shm) or an anonymous memfd whose Fd()
+     * is handed to other processes by fork or over a unix socket.
+     * New segments are zero filled.
+     */
+    class ShmSegment : public Noncopyable
+    {
+    public:
+        ShmSegment() {}
+        ~ShmSegment() { Close(); }
+
+        bool Create(const std::string &name, size_t size);
+        bool Attach(const std::string &name);
+        bool CreateAnonymous(const std::string &name, size_t size);
+        // takes ownership of fd, closed on failure
+        bool AttachFd(int fd);
+        void Close();
+        static bool Unlink(const std::string &name);
+
+        bool IsOpen() const { return _addr != nullptr; }
+        char *Addr() const { return (char *)_addr; }
+        size_t Size() const { return _size; }
+        int Fd() const { return _fd; }
+
+    private:
+        bool Map(int fd, size_t size);
+        void Unmap();
+
+    private:
+        int _fd = -1;
+        void *_addr = nullptr;
+        size_t _size = 0;
+    };
+} // namespace sunflower
+
+#endif // SHMSEGMENT_H
@@ -0,0 +1,448 @@
+#ifndef SKIPLISTMAPSAFE_H
+#define SKIPLISTMAPSAFE_H
+
+#include "EpochDomain.h"
+#include "Hash.h"
+#include "Noncopyable.h"
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+namespace sunflower
+{
+    /**
+     * Ordered concurrent map, lock-free skiplist after Fraser / Herlihy-Shavit.
+     * The low bit of a next pointer marks its node as logically erased,
+     * whoever marks level 0 owns the erase. Lookups and scans are lock-free
+     * and never write, insert and erase link with CAS.
+     * Unlinked nodes are freed through an epoch domain, every read runs in a guard.
+     * Values are fixed at insert, erase and insert again to replace one.
+     */
+    template <class Key, class Value, class Compare = std::less<Key>>
+    class SkipListMapSafe : public Noncopyable
+    {
+    public:
+        static const int kMaxLevel = 24;
+
+        class Node
+        {
+        public:
+            const Key &k() const { return _k; }
+            const Value &v() const { return _v; }
+
+        private:
+            friend class SkipListMapSafe;
+            Node(const Key &key, const Value &value, int height) : _k(key), _v(value), _height(height) {}
+
+            Key _k;
+            Value _v;
+            int _height;
+            // inserter and eraser both drop one, the last one retires the node
+            std::atomic<int> _refs{2};
+            // _height entries, the tail is allocated past the object
+            std::atomic<uintptr_t> _next[1];
+        };
+
+        /**
+         * Forward iterator in key order, skips erased nodes.
+         * Holds an epoch guard of the creating thread: do not hand it to
+         * another thread and do not keep it around, it delays reclamation.
+         */
+        class iterator
+        {
+        public:
+            iterator() {}
+            iterator(const iterator &other) : _map(other._map), _node(other._node)
+            {
+                if (_map)
+                    _map->_domain.Enter();
+            }
+            iterator &operator=(const iterator &other)
+            {
+                if (this != &other)
+                {
+                    if (other._map)
+                        other._map->_domain.Enter();
+                    if (_map)
+                        _map->_domain.Leave();
+                    _map = other._map;
+                    _node = other._node;
+                }
+                return *this;
+            }
+            ~iterator()
+            {
+                if (_map)
+                    _map->_domain.Leave();
+            }
+
+            const Node &operator*() const { return *_node; }
+            const Node *operator->() const { return _node; }
+            iterator &operator++()
+            {
+                _node = _map->next_live(_node);
+                return *this;
+            }
+            bool operator==(const iterator &other) const { return _node == other._node; }
+            bool operator!=(const iterator &other) const { return _node != other._node; }
+
+        private:
+            friend class SkipListMapSafe;
+            iterator(const SkipListMapSafe *map, Node *node) : _map(map), _node(node) { _map->_domain.Enter(); }
+
+            const SkipListMapSafe *_map = nullptr;
+            Node *_node = nullptr;
+        };
+
+        SkipListMapSafe();
+        ~SkipListMapSafe();
+
+        // Capacity
+        bool empty() const noexcept { return _numElements == 0; }
+        size_t size() const noexcept { return _numElements.load(); }
+
+        // Modifiers
+        std::pair<Value, bool> insert(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void clear();
+
+        // Lookup
+        void find(const Key &key, Value &value, bool &exsit) const;
+        size_t count(const Key &key) const;
+
+        // Ordered access
+        iterator begin() const;
+        iterator end() const { return iterator(); }
+        // first key not less than key
+        iterator lower_bound(const Key &key) const;
+        // fn(key, value) for keys in [from, to) in order, stops early when fn
+        // returns false; returns the number of keys visited
+        template <class Fn>
+        size_t scan(const Key &from, const Key &to, Fn fn) const;
+
+    private:
+        static bool IsMarked(uintptr_t p) { return p & 1; }
+        static Node *Ptr(uintptr_t p) { return reinterpret_cast<Node *>(p & ~(uintptr_t)1); }
+        static uintptr_t Raw(Node *node) { return reinterpret_cast<uintptr_t>(node); }
+
+        static Node *NewNode(const Key &key, const Value &value, int height);
+        static void FreeNode(void *ptr);
+        static int RandomLevel();
+
+        // preds/succs at every level around key, snips marked nodes on the way;
+        // with through, also walks over nodes equal to key
+        bool search(const Key &key, Node **preds, Node **succs, bool through = false) const;
+        Node *seek(const Key &key) const;
+        Node *next_live(Node *node) const;
+        void release(Node *node);
+
+    private:
+        mutable EpochDomain _domain;
+        Node *_head = nullptr;
+        std::atomic<int> _level{1};
+        std::atomic<size_t> _numElements{0};
+        Compare _less;
+    };
+
+    template <class Key, class Value, class Compare>
+    SkipListMapSafe<Key, Value, Compare>::SkipListMapSafe()
+    {
+        // the head key is never compared
+        _head = NewNode(Key(), Value(), kMaxLevel);
+    }
+
+    template <class Key, class Value, class Compare>
+    SkipListMapSafe<Key, Value, Compare>::~SkipListMapSafe()
+    {
+        Node *node = _head;
+        while (node)
+        {
+            Node *next = Ptr(node->_next[0].load(std::memory_order_relaxed));
+            FreeNode(node);
+            node = next;
+        }
+    }
+
+    template <class Key, class Value, class Compare>
+    typename SkipListMapSafe<Key, Value, Compare>::Node *SkipListMapSafe<Key, Value, Compare>::NewNode(const Key &key, const Value &value, int height)
+    {
+        void *mem = ::operator new(sizeof(Node) + (height - 1) * sizeof(std::atomic<uintptr_t>));
+        Node *node = new (mem) Node(key, value, height);
+        for (int i = 0; i < height; i++)
+        {
+            new (&node->_next[i]) std::atomic<uintptr_t>(0);
+        }
+        return node;
+    }
+
+    template <class Key, class Value, class Compare>
+    void SkipListMapSafe<Key, Value, Compare>::FreeNode(void *ptr)
+    {
+        Node *node = static_cast<Node *>(ptr);
+        node->~Node();
+        ::operator delete(ptr);
+    }
+
+    template <class Key, class Value, class Compare>
+    int SkipListMapSafe<Key, Value, Compare>::RandomLevel()
+    {
+        // p = 1/2 per level, xorshift64 per thread
+        static thread_local uint64_t state = RandomSeed() | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int level = 1 + __builtin_ctzll(state | (1ULL << (kMaxLevel - 1)));
+        return level;
+    }
+
+    template <class Key, class Value, class Compare>
+    bool SkipListMapSafe<Key, Value, Compare>::search(const Key &key, Node **preds, Node **succs, bool through) const
+    {
+        int top = _level.load(std::memory_order_acquire);
+        // above the current top only the head, a racing insert fails its CAS
+        for (int level = top; level < kMaxLevel; level++)
+        {
+            preds[level] = _head;
+            succs[level] = nullptr;
+        }
+    retry:
+        Node *pred = _head;
+        for (int level = top - 1; level >= 0; level--)
+        {
+            Node *curr = Ptr(pred->_next[level].load(std::memory_order_acquire));
+            while (curr)
+            {
+                uintptr_t succ = curr->_next[level].load(std::memory_order_acquire);
+                while (IsMarked(succ))
+                {
+                    // snip curr, pred must still point at it unmarked
+                    uintptr_t expected = Raw(curr);
+                    if (not pred->_next[level].compare_exchange_strong(expected, succ & ~(uintptr_t)1, std::memory_order_acq_rel))
+                    {
+                        goto retry;
+                    }
+                    curr = Ptr(succ);
+                    if (curr == nullptr)
+                        break;
+                    succ = curr->_next[level].load(std::memory_order_acquire);
+                }
+                if (curr == nullptr)
+                    break;
+                bool before = through ? !_less(key, curr->_k) : _less(curr->_k, key);
+                if (not before)
+                    break;
+                pred = curr;
+                curr = Ptr(succ);
+            }
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return succs[0] && !_less(key, succs[0]->_k) && !_less(succs[0]->_k, key);
+    }
+
+    template <class Key, class Value, class Compare>
+    typename SkipListMapSafe<Key, Value, Compare>::Node *SkipListMapSafe<Key, Value, Compare>::seek(const Key &key) const
+    {
+        // read only descent, marked nodes are stepped over instead of snipped
+        Node *pred = _head;
+        Node *curr = nullptr;
+        for (int level = _level.load(std::memory_order_acquire) - 1; level >= 0; level--)
+        {
+            curr = Ptr(pred->_next[level].load(std::memory_order_acquire));
+            while (curr)
+            {
+                uintptr_t succ = curr->_next[level].load(std::memory_order_acquire);
+                if (IsMarked(succ))
+                {
+                    curr = Ptr(succ);
+                    continue;
+                }
+                if (not _less(curr->_k, key))
+                    break;
+                pred = curr;
+                curr = Ptr(succ);
+            }
+        }
+        return curr;
+    }
+
+    template <class Key, class Value, class Compare>
+    typename SkipListMapSafe<Key, Value, Compare>::Node *SkipListMapSafe<Key, Value, Compare>::next_live(Node *node) const
+    {
+        Node *curr = Ptr(node->_next[0].load(std::memory_order_acquire));
+        while (curr && IsMarked(curr->_next[0].load(std::memory_order_acquire)))
+        {
+            curr = Ptr(curr->_next[0].load(std::memory_order_acquire));
+        }
+        return curr;
+    }
+
+    template <class Key, class Value, class Compare>
+    void SkipListMapSafe<Key, Value, Compare>::release(Node *node)
+    {
+        if (node->_refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        // both the inserter and the eraser are done with it: snip every level
+        // still pointing at it, then no new reader can reach it
+        Node *preds[kMaxLevel];
+        Node *succs[kMaxLevel];
+        search(node->_k, preds, succs, true);
+        _domain.Retire(node, FreeNode);
+    }
+
+    template <class Key, class Value, class Compare>
+    std::pair<Value, bool> SkipListMapSafe<Key, Value, Compare>::insert(const Key &key, const Value &value)
+    {
+        EpochDomain::Guard guard(_domain);
+        Node *preds[kMaxLevel];
+        Node *succs[kMaxLevel];
+        int height = RandomLevel();
+        Node *node = nullptr;
+
+        while (true)
+        {
+            if (search(key, preds, succs))
+            {
+                if (node)
+                    FreeNode(node);
+                return std::make_pair(succs[0]->_v, false);
+            }
+            if (node == nullptr)
+                node = NewNode(key, value, height);
+            for (int i = 0; i < height; i++)
+            {
+                node->_next[i].store(Raw(succs[i]), std::memory_order_relaxed);
+            }
+            uintptr_t expected = Raw(succs[0]);
+            if (preds[0]->_next[0].compare_exchange_strong(expected, Raw(node), std::memory_order_acq_rel))
+                break;
+        }
+        _numElements++;
+
+        // raised before the upper levels are linked, so searches descend through them
+        int level = _level.load(std::memory_order_relaxed);
+        while (level < height && not _level.compare_exchange_weak(level, height, std::memory_order_acq_rel))
+        {
+        }
+
+        // upper levels are only an index, give up as soon as an eraser marked us
+        for (int i = 1; i < height; i++)
+        {
+            while (true)
+            {
+                uintptr_t next = node->_next[i].load(std::memory_order_acquire);
+                if (IsMarked(next))
+                    goto done;
+                if (next != Raw(succs[i]) && not node->_next[i].compare_exchange_strong(next, Raw(succs[i]), std::memory_order_acq_rel))
+                    goto done;
+                uintptr_t expected = Raw(succs[i]);
+                if (preds[i]->_next[i].compare_exchange_strong(expected, Raw(node), std::memory_order_acq_rel))
+                    break;
+                search(key, preds, succs);
+                if (succs[0] != node)
+                    goto done;
+            }
+        }
+    done:
+        release(node);
+        return std::make_pair(value, true);
+    }
+
+    template <class Key, class Value, class Compare>
+    size_t SkipListMapSafe<Key, Value, Compare>::erase(const Key &key)
+    {
+        EpochDomain::Guard guard(_domain);
+        Node *preds[kMaxLevel];
+        Node *succs[kMaxLevel];
+        if (not search(key, preds, succs))
+            return 0;
+
+        Node *node = succs[0];
+        for (int i = node->_height - 1; i >= 1; i--)
+        {
+            uintptr_t next = node->_next[i].load(std::memory_order_acquire);
+            while (not IsMarked(next) && not node->_next[i].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+            {
+            }
+        }
+
+        uintptr_t next = node->_next[0].load(std::memory_order_acquire);
+        while (true)
+        {
+            if (IsMarked(next))
+                return 0; // another eraser won
+            if (node->_next[0].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+                break;
+        }
+        _numElements--;
+        release(node);
+        return 1;
+    }
+
+    template <class Key, class Value, class Compare>
+    void SkipListMapSafe<Key, Value, Compare>::clear()
+    {
+        EpochDomain::Guard guard(_domain);
+        Node *node = next_live(_head);
+        while (node)
+        {
+            Node *next = next_live(node);
+            erase(node->_k);
+            node = next;
+        }
+    }
+
+    template <class Key, class Value, class Compare>
+    void SkipListMapSafe<Key, Value, Compare>::find(const Key &key, Value &value, bool &exsit) const
+    {
+        EpochDomain::Guard guard(_domain);
+        Node *node = seek(key);
+        exsit = node && !_less(key, node->_k);
+        if (exsit)
+        {
+            value = node->_v;
+        }
+    }
+
+    template <class Key, class Value, class Compare>
+    size_t SkipListMapSafe<Key, Value, Compare>::count(const Key &key) const
+    {
+        EpochDomain::Guard guard(_domain);
+        Node *node = seek(key);
+        return node && !_less(key, node->_k) ? 1 : 0;
+    }
+
+    template <class Key, class Value, class Compare>
+    typename SkipListMapSafe<Key, Value, Compare>::iterator SkipListMapSafe<Key, Value, Compare>::begin() const
+    {
+        iterator it(this, nullptr);
+        it._node = next_live(_head);
+        return it;
+    }
+
+    template <class Key, class Value, class Compare>
+    typename SkipListMapSafe<Key, Value, Compare>::iterator SkipListMapSafe<Key, Value, Compare>::lower_bound(const Key &key) const
+    {
+        iterator it(this, nullptr);
+        it._node = seek(key);
+        return it;
+    }
+
+    template <class Key, class Value, class Compare>
+    template <class Fn>
+    size_t SkipListMapSafe<Key, Value, Compare>::scan(const Key &from, const Key &to, Fn fn) const
+    {
+        EpochDomain::Guard guard(_domain);
+        size_t visited = 0;
+        for (Node *node = seek(from); node && _less(node->_k, to); node = next_live(node))
+        {
+            visited++;
+            if (not fn(node->_k, node->_v))
+                break;
+        }
+        return visited;
+    }
+} // namespace sunflower
+#endif // SKIPLISTMAPSAFE_H
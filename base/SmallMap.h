@@ -0,0 +1,293 @@
+#ifndef SMALLMAP_H
+#define SMALLMAP_H
+
+#include "HashMap.h"
+#include "Noncopyable.h"
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace sunflower
+{
+    /**
+     * Map for the many tables that hold a handful of keys: up to N entries
+     * live inline in the object, no bucket array and no node allocations,
+     * the N + 1th key moves them into a HashMap sized for 2N.
+     * Inline entries are unordered (Key needs no operator<), lookup compares
+     * arithmetic and pointer keys directly and other keys by an 8 bit hash
+     * tag first, 16 tags per SSE2 compare.
+     * Erase moves the last entry into the hole, so inline references from
+     * operator[] are valid until the next erase or the upgrade. The map never
+     * shrinks back inline, except by clear().
+     */
+    template <class Key, class Value, size_t N = 16, class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+    class SmallMap : public Noncopyable
+    {
+    public:
+        using Map = HashMap<Key, Value, Hash, KeyEqual>;
+
+        explicit SmallMap(unsigned memFlags = MEM_DEFAULT) : _memFlags(memFlags) {}
+        ~SmallMap() { clear(); }
+
+        // Capacity
+        bool empty() const noexcept { return size() == 0; }
+        size_t size() const noexcept { return _map ? _map->size() : _size; }
+
+        // Modifiers
+        std::pair<Value, bool> insert(const Key &key, const Value &value);
+        size_t erase(const Key &key);
+        void clear();
+
+        // Lookup
+        Value find(const Key &key);
+        void find(const Key &key, Value &value, bool &exsit);
+        size_t count(const Key &key);
+        Value &operator[](const Key &key);
+        Value &at(const Key &key) { return (*this)[key]; }
+
+        // false once upgraded to the HashMap
+        bool is_inline() const { return !_map; }
+        static constexpr size_t inline_capacity() { return N; }
+
+    private:
+        static_assert(N > 0, "SmallMap needs at least one inline entry");
+
+        struct Entry
+        {
+            Key k;
+            Value v;
+        };
+
+        // keys compared without hashing
+        static constexpr bool kDirectKeys = std::is_arithmetic<Key>::value || std::is_pointer<Key>::value;
+        static constexpr size_t kTagBytes = (N + 15) / 16 * 16;
+
+        static uint8_t Tag(size_t hash) { return (uint8_t)((hash >> 56) ^ hash); }
+
+        Entry *entry(size_t i) { return reinterpret_cast<Entry *>(&_entries[i]); }
+        uint8_t tag_of(const Key &key) const;
+        // inline index of key, -1 if absent
+        long search(const Key &key, uint8_t tag);
+        Value &append(const Key &key, const Value &value, uint8_t tag);
+        void upgrade();
+
+    private:
+        size_t _size = 0;
+        std::unique_ptr<Map> _map;
+        unsigned _memFlags;
+        Hash _hash;
+        KeyEqual _equal;
+        alignas(16) uint8_t _tags[kTagBytes] = {};
+        typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type _entries[N];
+    };
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    uint8_t SmallMap<Key, Value, N, Hash, KeyEqual>::tag_of(const Key &key) const
+    {
+        if constexpr (kDirectKeys)
+        {
+            return 0;
+        }
+        else
+        {
+            return Tag(_hash(key));
+        }
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    long SmallMap<Key, Value, N, Hash, KeyEqual>::search(const Key &key, uint8_t tag)
+    {
+        if constexpr (kDirectKeys)
+        {
+            for (size_t i = 0; i < _size; i++)
+            {
+                if (_equal(key, entry(i)->k))
+                    return i;
+            }
+            return -1;
+        }
+        else
+        {
+#if defined(__SSE2__)
+            __m128i needle = _mm_set1_epi8((char)tag);
+            for (size_t base = 0; base < _size; base += 16)
+            {
+                __m128i tags = _mm_load_si128(reinterpret_cast<const __m128i *>(_tags + base));
+                unsigned bits = _mm_movemask_epi8(_mm_cmpeq_epi8(tags, needle));
+                if (_size - base < 16)
+                {
+                    bits &= (1u << (_size - base)) - 1;
+                }
+                while (bits)
+                {
+                    size_t i = base + __builtin_ctz(bits);
+                    if (_equal(key, entry(i)->k))
+                        return i;
+                    bits &= bits - 1;
+                }
+            }
+#else
+            for (size_t i = 0; i < _size; i++)
+            {
+                if (_tags[i] == tag && _equal(key, entry(i)->k))
+                    return i;
+            }
+#endif
+            return -1;
+        }
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    Value &SmallMap<Key, Value, N, Hash, KeyEqual>::append(const Key &key, const Value &value, uint8_t tag)
+    {
+        Entry *e = new (&_entries[_size]) Entry{key, value};
+        _tags[_size] = tag;
+        _size++;
+        return e->v;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    void SmallMap<Key, Value, N, Hash, KeyEqual>::upgrade()
+    {
+        size_t power = 1;
+        while (((size_t)1 << power) < 2 * N)
+        {
+            power++;
+        }
+        _map.reset(new Map(power, _memFlags));
+        for (size_t i = 0; i < _size; i++)
+        {
+            (*_map)[entry(i)->k] = std::move(entry(i)->v);
+            entry(i)->~Entry();
+        }
+        _size = 0;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    std::pair<Value, bool> SmallMap<Key, Value, N, Hash, KeyEqual>::insert(const Key &key, const Value &value)
+    {
+        if (_map)
+        {
+            return _map->insert(key, value);
+        }
+
+        uint8_t tag = tag_of(key);
+        long i = search(key, tag);
+        if (i >= 0)
+        {
+            return std::make_pair(entry(i)->v, false);
+        }
+        if (_size < N)
+        {
+            return std::make_pair(append(key, value, tag), true);
+        }
+        upgrade();
+        return _map->insert(key, value);
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    size_t SmallMap<Key, Value, N, Hash, KeyEqual>::erase(const Key &key)
+    {
+        if (_map)
+        {
+            return _map->erase(key);
+        }
+
+        long i = search(key, tag_of(key));
+        if (i < 0)
+        {
+            return 0;
+        }
+        size_t last = _size - 1;
+        if ((size_t)i != last)
+        {
+            *entry(i) = std::move(*entry(last));
+            _tags[i] = _tags[last];
+        }
+        entry(last)->~Entry();
+        _size--;
+        return 1;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    void SmallMap<Key, Value, N, Hash, KeyEqual>::clear()
+    {
+        _map.reset();
+        for (size_t i = 0; i < _size; i++)
+        {
+            entry(i)->~Entry();
+        }
+        _size = 0;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    Value SmallMap<Key, Value, N, Hash, KeyEqual>::find(const Key &key)
+    {
+        if (_map)
+        {
+            return _map->find(key);
+        }
+
+        long i = search(key, tag_of(key));
+        if (i >= 0)
+        {
+            return entry(i)->v;
+        }
+        return nullptr;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    void SmallMap<Key, Value, N, Hash, KeyEqual>::find(const Key &key, Value &value, bool &exsit)
+    {
+        if (_map)
+        {
+            _map->find(key, value, exsit);
+            return;
+        }
+
+        long i = search(key, tag_of(key));
+        exsit = i >= 0;
+        if (exsit)
+        {
+            value = entry(i)->v;
+        }
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    size_t SmallMap<Key, Value, N, Hash, KeyEqual>::count(const Key &key)
+    {
+        if (_map)
+        {
+            return _map->count(key);
+        }
+        return search(key, tag_of(key)) >= 0 ? 1 : 0;
+    }
+
+    template <class Key, class Value, size_t N, class Hash, class KeyEqual>
+    Value &SmallMap<Key, Value, N, Hash, KeyEqual>::operator[](const Key &key)
+    {
+        if (_map)
+        {
+            return (*_map)[key];
+        }
+
+        uint8_t tag = tag_of(key);
+        long i = search(key, tag);
+        if (i >= 0)
+        {
+            return entry(i)->v;
+        }
+        if (_size < N)
+        {
+            return append(key, Value(), tag);
+        }
+        upgrade();
+        return (*_map)[key];
+    }
+} // namespace sunflower
+#endif // SMALLMAP_H
@@ -204,10 +204,7 @@ namespace sunflower
             auto stop = []() {};
             for (uint32_t i = 0; i < _workerNum; i++)
             {
-                while (not _vecWorker[i]->_pendingTask.tryPush(stop))
-                {
-                    usleep(50);
-                }
+                _vecWorker[i]->_pendingTask.tryPush(stop);
             }
 
             for (auto &e : _vecWorker)
@@ -220,17 +217,13 @@ namespace sunflower
     bool TaskThreadPoolQueues::TryPushTask(task_t &&task)
     {
         std::lock_guard<std::mutex> lck(_poolMutex);
-        for (uint32_t i = 1; i <= _workerNum; i++)
+        if (_workerNum == 0)
         {
-            uint32_t pos = (_lastPos + i) % _workerNum;
-            if (not _vecWorker[pos]->_pendingTask.full())
-            {
-                _vecWorker[pos]->_pendingTask.tryPush(task);
-                _lastPos = pos;
-                return true;
-            }
+            return false;
         }
-        return false;
+        _lastPos = (_lastPos + 1) % _workerNum;
+        _vecWorker[_lastPos]->_pendingTask.tryPush(std::move(task));
+        return true;
     }
 
     uint32_t TaskThreadPoolQueues::GetTaskNum()
@@ -2,8 +2,8 @@
 #define TASKTHREADPOOL_H
 
 #include "Threads.h"
-#include "RecycleQueue.h"
-#include "RecycleQueueBlockThreadSafeTwo.h"
+#include "RecycleQueueMPMC.h"
+#include "RecycleQueueUnbounded.h"
 #include <condition_variable>
 #include <memory>
 #include <mutex>
@@ -55,7 +55,7 @@ namespace sunflower
         std::mutex _poolMutex = {};
         bool _started = false;
         // queue
-        RecycleQueueBlockThreadSafeTwo<task_t> _pendingTask;
+        RecycleQueueMPMC<task_t> _pendingTask;
     };
 
     class TaskThreadPoolQueues : public Noncopyable
@@ -68,6 +68,9 @@ namespace sunflower
         void Start();
         void Stop();
         void SetWorkerNum(uint32_t num);
+        // Round robin over the workers, never fails once the pool has a
+        // worker: the per-worker queues are unbounded and grow instead of
+        // filling up, so nothing bounds the tasks pending in memory
         bool TryPushTask(task_t &&task);
         uint32_t GetWorkerNum() const { return _vecWorker.size(); }
         uint32_t GetTaskNum();
@@ -87,8 +90,9 @@ namespace sunflower
             bool WaitTask(task_t *task);
 
         public:
-            // queue
-            RecycleQueue<task_t> _pendingTask;
+            // queue, pushed under the pool mutex, popped by this worker only,
+            // grows by 2^queuePow segments instead of filling up
+            RecycleQueueUnboundedSPSC<task_t> _pendingTask;
 
         private:
             TaskThreadPoolQueues *_parent = nullptr;
@@ -0,0 +1,249 @@
+#include "base/Hash.h"
+#include "base/HashMapLockFree.h"
+#include "base/HashMapSnapshot.h"
+#include "base/HashSetLockFree.h"
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace sunflower;
+
+// counts live copies, a value lives in exactly one bucket of each version holding it
+struct Tracked
+{
+    static std::atomic<int> live;
+    int value = 0;
+
+    Tracked() { live++; }
+    Tracked(int v) : value(v) { live++; }
+    Tracked(const Tracked &other) : value(other.value) { live++; }
+    Tracked &operator=(const Tracked &other) = default;
+    ~Tracked() { live--; }
+};
+std::atomic<int> Tracked::live{0};
+
+bool Check(bool ok, const char *what)
+{
+    printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+//HashMapSnapshot, a replaced version is freed once no snapshot pins it
+bool test1()
+{
+    bool ok = true;
+    HashMapSnapshot<int, Tracked> map(4);
+    map.insert(1, Tracked(1));
+    ok &= Check(Tracked::live == 1, "one version, one value");
+
+    {
+        auto snapshot = map.snapshot();
+        map.insert_or_assign(1, Tracked(2));
+        ok &= Check(Tracked::live == 2, "pinned version kept after the update");
+
+        Tracked value;
+        bool exsit = false;
+        snapshot.find(1, value, exsit);
+        ok &= Check(exsit && value.value == 1, "snapshot still reads the old value");
+    }
+    ok &= Check(Tracked::live == 1, "replaced version freed when the snapshot let go");
+
+    // a snapshot released by another thread frees it too
+    std::atomic<int> stage{0};
+    std::thread reader([&map, &stage]
+                       {
+                           auto snapshot = map.snapshot();
+                           stage = 1;
+                           while (stage != 2)
+                               std::this_thread::yield();
+                       });
+    while (stage != 1)
+        std::this_thread::yield();
+    map.insert_or_assign(1, Tracked(3));
+    ok &= Check(Tracked::live == 2, "version pinned by a reader thread kept");
+    stage = 2;
+    reader.join();
+    ok &= Check(Tracked::live == 1, "freed when the reader thread let go");
+
+    // unpinned versions go right away, not after a batch of updates
+    for (int i = 0; i < 10; i++)
+    {
+        map.insert_or_assign(1, Tracked(i));
+    }
+    ok &= Check(Tracked::live == 1, "unpinned versions freed on publish");
+    return ok;
+}
+
+// batch and scalar hashes of strs must agree, for every batch size up to strs.size()
+bool SameAsScalar(const std::vector<const char *> &strs, size_t seed)
+{
+    std::vector<size_t> out(strs.size());
+    for (size_t n = 1; n <= strs.size(); n++)
+    {
+        Time33Batch(strs.data(), n, out.data());
+        for (size_t i = 0; i < n; i++)
+        {
+            if (out[i] != Time33(strs[i]))
+                return false;
+        }
+        SeededStrHashBatch(strs.data(), n, seed, out.data());
+        for (size_t i = 0; i < n; i++)
+        {
+            if (out[i] != SeededStrHash(strs[i], seed))
+                return false;
+        }
+    }
+    return true;
+}
+
+//Time33Batch / SeededStrHashBatch, same as the scalar hashes
+bool test2()
+{
+    bool ok = true;
+    size_t seed = RandomSeed();
+
+    // lengths around every word and vector width, mixed in one batch
+    std::vector<std::string> keys;
+    for (size_t len = 0; len < 80; len++)
+    {
+        std::string key;
+        for (size_t i = 0; i < len; i++)
+            key.push_back((char)('a' + (len * 7 + i * 13) % 26));
+        keys.push_back(key);
+    }
+    keys.push_back(std::string(1000, 'x'));
+    keys.push_back("\xff\x80\x7f high bytes");
+    std::vector<const char *> strs;
+    for (auto &key : keys)
+        strs.push_back(key.c_str());
+    ok &= Check(SameAsScalar(strs, seed), "varied lengths");
+
+    // tails ending right at a page boundary, the next page unreadable
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *mem = (char *)mmap(nullptr, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED || mprotect(mem + page, page, PROT_NONE) != 0)
+    {
+        return Check(false, "guard page");
+    }
+    char *end = mem + page;
+    memset(mem, 'k', page);
+    end[-1] = '\0';
+    strs.clear();
+    for (size_t len = 0; len < 72; len++)
+        strs.push_back(end - 1 - len);
+    ok &= Check(SameAsScalar(strs, seed), "tails at a page boundary");
+    munmap(mem, page * 2);
+    return ok;
+}
+
+//HashSetLockFree / HashMapLockFree, overlapping writers across many migrations
+bool test3()
+{
+    bool ok = true;
+    const int threads = 4;
+    const uint64_t span = 20000, stride = 5000, keys = stride * (threads - 1) + span;
+    const uint64_t churn = 1000000;
+
+    // every thread inserts its range overlapping the next ones and churns
+    // private keys, the tombstones force migrations at the same capacity too
+    HashSetLockFree<uint64_t> set(4);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&set, t, span, stride, churn]
+                             {
+                                 for (uint64_t i = 0; i < span; i++)
+                                 {
+                                     set.insert(t * stride + i);
+                                     set.insert(churn * (t + 1) + i);
+                                     set.erase(churn * (t + 1) + i);
+                                 }
+                             });
+    }
+    for (auto &w : workers)
+        w.join();
+    workers.clear();
+    bool exact = set.size() == keys;
+    for (uint64_t k = 0; k < keys; k++)
+        exact &= set.count(k) == 1;
+    for (int t = 0; t < threads; t++)
+        exact &= set.count(churn * (t + 1)) == 0;
+    ok &= Check(set.migration_count() > 0, "set migrated");
+    ok &= Check(exact, "set size and count exact after inserts");
+
+    // overlapping erases, each even key erased exactly once overall
+    std::atomic<size_t> erased{0};
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&set, &erased, t, span, stride]
+                             {
+                                 size_t n = 0;
+                                 for (uint64_t i = 0; i < span; i++)
+                                 {
+                                     uint64_t k = t * stride + i;
+                                     if (k % 2 == 0)
+                                         n += set.erase(k);
+                                 }
+                                 erased += n;
+                             });
+    }
+    for (auto &w : workers)
+        w.join();
+    workers.clear();
+    exact = erased == keys / 2 && set.size() == keys / 2;
+    for (uint64_t k = 0; k < keys; k++)
+        exact &= set.count(k) == k % 2;
+    ok &= Check(exact, "set size and count exact after erases");
+
+    // concurrent counters over the same overlapping ranges
+    HashMapLockFree<uint64_t, int64_t> map(4);
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&map, t, span, stride, churn]
+                             {
+                                 for (uint64_t i = 0; i < span; i++)
+                                 {
+                                     map.fetch_add(t * stride + i, t + 1);
+                                     map.insert_or_assign(churn * (t + 1) + i, i);
+                                     map.erase(churn * (t + 1) + i);
+                                 }
+                             });
+    }
+    for (auto &w : workers)
+        w.join();
+    exact = map.size() == keys;
+    for (uint64_t k = 0; k < keys; k++)
+    {
+        int64_t total = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            if (k >= t * stride && k < t * stride + span)
+                total += t + 1;
+        }
+        exact &= map.find(k) == total;
+    }
+    ok &= Check(map.migration_count() > 0, "map migrated");
+    ok &= Check(exact, "map fetch_add totals exact");
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+
+    //HashMapSnapshot, version reclamation
+    ok &= test1();
+
+    //Time33Batch / SeededStrHashBatch against Time33 / SeededStrHash
+    ok &= test2();
+
+    //HashSetLockFree / HashMapLockFree under concurrent writers
+    ok &= test3();
+
+    return ok ? 0 : 1;
+}
@@ -1,7 +1,15 @@
 #include "base/RecycleQueue.h"
 #include "base/RecycleQueueBlockThreadSafe.h"
 #include "base/RecycleQueueBlockThreadSafeTwo.h"
+#include "base/RecycleQueueMPMC.h"
+#include "base/RecycleQueuePriority.h"
+#include "base/RecycleQueuePtr.h"
+#include "base/RecycleQueueSPSC.h"
+#include "base/RecycleQueueShm.h"
+#include "base/RecycleQueueUnbounded.h"
+#include <string.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <thread>
 #include <vector>
 #include <iostream>
@@ -139,6 +147,179 @@ void QueueWaitWrite(T &queue, const char *thread_name, int cnt)
     printf("%s write time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
 }
 
+template <typename T>
+void QueueTryReadN(T &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    int values[64];
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        n -= queue.tryPopN(values, n < 64 ? n : 64);
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s read time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+template <typename T>
+void QueueWaitWriteN(T &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    int values[64];
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        int batch = n < 64 ? n : 64;
+        for (int i = 0; i < batch; i++)
+        {
+            values[i] = n - i;
+        }
+        queue.waitPushN(values, values + batch);
+        n -= batch;
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s write time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+struct Message
+{
+    int seq = 0;
+    char body[1020] = {};
+};
+
+void QueuePtrWrite(RecycleQueuePtr<Message> &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        Message *msg = queue.acquire();
+        if (msg)
+        {
+            msg->seq = n;
+            msg->body[0] = (char)n;
+            queue.tryPush(msg);
+            n--;
+        }
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s write time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+void QueuePtrRead(RecycleQueuePtr<Message> &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    Message *msg = nullptr;
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        if (queue.tryPop(msg))
+        {
+            queue.recycle(msg);
+            n--;
+        }
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s read time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+void QueueMessageWrite(RecycleQueueSPSC<Message> &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    Message msg;
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        msg.seq = n;
+        msg.body[0] = (char)n;
+        if (queue.tryPush(msg))
+        {
+            n--;
+        }
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s write time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+void QueueMessageRead(RecycleQueueSPSC<Message> &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    Message msg;
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        if (queue.tryPop(msg))
+        {
+            n--;
+        }
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s read time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
+template <typename T>
+void QueuePriorityWrite(T &queue, const char *thread_name, int cnt)
+{
+    int n = cnt;
+    struct timeval timestamp[3];
+
+    gettimeofday(&timestamp[1], NULL);
+
+    while (n > 0)
+    {
+        queue.waitPush(n, n % queue.levels());
+        n--;
+    }
+
+    gettimeofday(&timestamp[2], NULL);
+
+    GetTimeInterval(timestamp);
+
+    printf("%s write time interval:%luus\n", thread_name, timestamp[0].tv_sec * 1000000 + timestamp[0].tv_usec);
+}
+
 void test1()
 {
     RecycleQueue<int> queue(20);
@@ -324,6 +505,243 @@ void test13()
     std::cout << "RecycleQueueBlockThreadSafeTwo queue size: " << queue.size() << std::endl;
 }
 
+void test14()
+{
+    RecycleQueueSPSC<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueRead<RecycleQueueSPSC<int>>, std::ref(queue), "test14_tryread_1", 100000000));
+    vecThread.push_back(std::thread(QueueTryWrite<RecycleQueueSPSC<int>>, std::ref(queue), "test14_trywrite_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueSPSC queue size: " << queue.size() << std::endl;
+}
+
+void test15()
+{
+    RecycleQueueSPSC<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueTryRead<RecycleQueueSPSC<int>>, std::ref(queue), "test15_tryread_1", 100000000));
+    vecThread.push_back(std::thread(QueueTryWrite<RecycleQueueSPSC<int>>, std::ref(queue), "test15_trywrite_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueSPSC queue size: " << queue.size() << std::endl;
+}
+
+void test16()
+{
+    RecycleQueueMPMC<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueTryWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test16_trywrite_1", 100000000));
+    vecThread.push_back(std::thread(QueueTryRead<RecycleQueueMPMC<int>>, std::ref(queue), "test16_tryread_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueMPMC queue size: " << queue.size() << std::endl;
+}
+
+void test17()
+{
+    RecycleQueueMPMC<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test17_waitwrite_1", 100000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueMPMC<int>>, std::ref(queue), "test17_waitread_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueMPMC queue size: " << queue.size() << std::endl;
+}
+
+void test18()
+{
+    RecycleQueueMPMC<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitwrite_1", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitwrite_2", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitwrite_3", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitwrite_4", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitread_1", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitread_2", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitread_3", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueMPMC<int>>, std::ref(queue), "test18_waitread_4", 25000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueMPMC queue size: " << queue.size() << std::endl;
+}
+
+void test19()
+{
+    RecycleQueueBlockThreadSafeTwo<int> queue(20);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueWaitWriteN<RecycleQueueBlockThreadSafeTwo<int>>, std::ref(queue), "test19_waitwriteN_1", 100000000));
+    vecThread.push_back(std::thread(QueueTryReadN<RecycleQueueBlockThreadSafeTwo<int>>, std::ref(queue), "test19_tryreadN_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueBlockThreadSafeTwo queue size: " << queue.size() << std::endl;
+}
+
+void test20()
+{
+    RecycleQueueBlockThreadSafeTwo<int> queue(20);
+    queue.setWaitPolicy(WaitPolicy::BUSY_POLL);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueBlockThreadSafeTwo<int>>, std::ref(queue), "test20_waitwrite_1", 100000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueBlockThreadSafeTwo<int>>, std::ref(queue), "test20_waitread_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueBlockThreadSafeTwo queue size: " << queue.size() << std::endl;
+}
+
+void test21()
+{
+    RecycleQueuePtr<Message> queue(10);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueuePtrRead, std::ref(queue), "test21_tryread_1", 10000000));
+    vecThread.push_back(std::thread(QueuePtrWrite, std::ref(queue), "test21_trywrite_1", 10000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueuePtr queue size: " << queue.size() << std::endl;
+}
+
+void test22()
+{
+    RecycleQueueSPSC<Message> queue(10);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueMessageRead, std::ref(queue), "test22_tryread_1", 10000000));
+    vecThread.push_back(std::thread(QueueMessageWrite, std::ref(queue), "test22_trywrite_1", 10000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueSPSC queue size: " << queue.size() << std::endl;
+}
+
+void test23()
+{
+    RecycleQueueUnboundedSPSC<int> queue(10);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueTryRead<RecycleQueueUnboundedSPSC<int>>, std::ref(queue), "test23_tryread_1", 100000000));
+    vecThread.push_back(std::thread(QueueTryWrite<RecycleQueueUnboundedSPSC<int>>, std::ref(queue), "test23_trywrite_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueUnboundedSPSC queue size: " << queue.size() << std::endl;
+}
+
+void test24()
+{
+    RecycleQueueUnboundedMPMC<int> queue(10);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitwrite_1", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitwrite_2", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitwrite_3", 25000000));
+    vecThread.push_back(std::thread(QueueWaitWrite<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitwrite_4", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitread_1", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitread_2", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitread_3", 25000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueueUnboundedMPMC<int>>, std::ref(queue), "test24_waitread_4", 25000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueueUnboundedMPMC queue size: " << queue.size() << std::endl;
+}
+
+void test25()
+{
+    RecycleQueuePriority<int> queue(8, 17);
+    std::vector<std::thread> vecThread;
+    vecThread.push_back(std::thread(QueuePriorityWrite<RecycleQueuePriority<int>>, std::ref(queue), "test25_waitwrite_1", 50000000));
+    vecThread.push_back(std::thread(QueuePriorityWrite<RecycleQueuePriority<int>>, std::ref(queue), "test25_waitwrite_2", 50000000));
+    vecThread.push_back(std::thread(QueueWaitRead<RecycleQueuePriority<int>>, std::ref(queue), "test25_waitread_1", 100000000));
+    for (auto &e : vecThread)
+    {
+        e.join();
+    }
+    std::cout << "RecycleQueuePriority queue size: " << queue.size() << std::endl;
+}
+
+// variable length records, seq first, lengths chosen so records keep wrapping
+void ShmRecord(uint32_t seq, std::string &rec)
+{
+    rec.resize(sizeof(seq) + (seq * 37) % 300);
+    memcpy(&rec[0], &seq, sizeof(seq));
+    for (size_t i = sizeof(seq); i < rec.size(); i++)
+    {
+        rec[i] = (char)(seq + i);
+    }
+}
+
+void QueueShmWrite(RecycleQueueShm &queue, uint32_t start, uint32_t count)
+{
+    std::string rec;
+    for (uint32_t seq = start; seq < start + count; seq++)
+    {
+        ShmRecord(seq, rec);
+        queue.waitPush(rec.data(), rec.size());
+    }
+}
+
+bool QueueShmRead(RecycleQueueShm &queue, uint32_t start, uint32_t count)
+{
+    bool ok = true;
+    std::string rec, expect;
+    for (uint32_t seq = start; seq < start + count; seq++)
+    {
+        queue.waitPop(rec);
+        ShmRecord(seq, expect);
+        ok &= rec == expect;
+    }
+    return ok;
+}
+
+void test26()
+{
+    // 1KB ring, most records leave a padding record at the tail
+    RecycleQueueShm queue;
+    if (not queue.createAnonymous(10))
+    {
+        std::cout << "RecycleQueueShm createAnonymous FAILED" << std::endl;
+        return;
+    }
+    const uint32_t count = 100000;
+    std::thread writer(QueueShmWrite, std::ref(queue), 0, count);
+    bool ok = QueueShmRead(queue, 0, count);
+    writer.join();
+    std::cout << "RecycleQueueShm thread producer: " << (ok ? "ok" : "FAILED") << std::endl;
+
+    // a forked producer attached through a duplicate of the segment fd
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        RecycleQueueShm child;
+        if (not child.attachFd(dup(queue.fd())))
+        {
+            _exit(1);
+        }
+        QueueShmWrite(child, count, count);
+        _exit(0);
+    }
+    ok = pid > 0 && QueueShmRead(queue, count, count);
+    int status = 0;
+    ok &= pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    std::cout << "RecycleQueueShm forked producer: " << (ok ? "ok" : "FAILED") << " size: " << queue.size() << std::endl;
+}
+
 int main()
 {
     RecycleQueueBlockThreadSafeTwo<int> queue3(20);
@@ -332,6 +750,12 @@ int main()
     //RecycleQueue, try read 1 write 1
     test1();
 
+    //RecycleQueueSPSC, try read 1 write 1, same loop as test1
+    test14();
+
+    //RecycleQueueSPSC, try read 1 write 1 with tryPop
+    test15();
+
     //RecycleQueueBlockThreadSafe, try read 1 write 1
     test2();
 
@@ -368,5 +792,38 @@ int main()
     //RecycleQueueBlockThreadSafeTwo, wait read 4 write 1
     test13();
 
+    //RecycleQueueMPMC, try read 1 write 1
+    test16();
+
+    //RecycleQueueMPMC, wait read 1 write 1
+    test17();
+
+    //RecycleQueueMPMC, wait read 4 write 4
+    test18();
+
+    //RecycleQueueBlockThreadSafeTwo, batches of 64, try read 1 wait write 1
+    test19();
+
+    //RecycleQueueBlockThreadSafeTwo, busy poll, wait read 1 write 1
+    test20();
+
+    //RecycleQueuePtr, 1KB messages passed by pointer, try read 1 write 1
+    test21();
+
+    //RecycleQueueSPSC, the same messages copied, try read 1 write 1
+    test22();
+
+    //RecycleQueueUnboundedSPSC, 1K segments, try read 1 write 1
+    test23();
+
+    //RecycleQueueUnboundedMPMC, 1K segments, wait read 4 write 4
+    test24();
+
+    //RecycleQueuePriority, 8 levels, wait read 1 write 2
+    test25();
+
+    //RecycleQueueShm, variable length records, wait read 1 write 1 thread then forked process
+    test26();
+
     return 0;
 }